@@ -0,0 +1,104 @@
+#include "analyzer.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+namespace {
+
+constexpr auto default_depth = 400u;
+constexpr auto default_variables = 2000u;
+constexpr auto repetitions = 5u;
+
+/// Identifiers are letters only
+auto variable_name(unsigned index) -> std::string {
+    auto name = std::string{"v"};
+    do {
+        name += static_cast<char>('a' + index % 26);
+        index /= 26;
+    } while (index > 0);
+    return name;
+}
+
+/// Main with `variables` declarations and blocks nested `depth` deep, every block touches a few of the variables
+auto generate_source(unsigned depth, unsigned variables) -> std::string {
+    auto source = std::string{"PROGRAM IS\n"};
+    for (auto i = 0u; i < variables; i++) {
+        source += (i > 0 ? ", " : "  ") + variable_name(i);
+    }
+    source += "\nIN\n";
+    for (auto i = 0u; i < variables; i++) {
+        source += "  " + variable_name(i) + " := " + std::to_string(i) + ";\n";
+    }
+
+    const auto variable = [&](unsigned level) { return variable_name(level * 7919 % variables); };
+    for (auto level = 0u; level < depth; level++) {
+        switch (level % 3) {
+        case 0:
+            source += "WHILE " + variable(level) + " > 0 DO\n";
+            break;
+        case 1:
+            source += "IF " + variable(level) + " = 0 THEN\n";
+            break;
+        default:
+            source += "REPEAT\n";
+            break;
+        }
+        source += variable(level + 1) + " := " + variable(level + 2) + " + " + variable(level) + ";\n";
+        source += "WRITE " + variable(level + 3) + ";\n";
+    }
+    for (auto level = depth; level-- > 0;) {
+        switch (level % 3) {
+        case 0:
+            source += variable(level) + " := " + variable(level) + " - 1;\nENDWHILE\n";
+            break;
+        case 1:
+            source += "ELSE\nREAD " + variable(level) + ";\nENDIF\n";
+            break;
+        default:
+            source += "UNTIL " + variable(level) + " = 0;\n";
+            break;
+        }
+    }
+
+    return source + "END\n";
+}
+
+} // namespace
+
+/// Time the analyzer takes on a deeply nested program, the depth and the number of variables can be given as the first
+/// two arguments
+auto main(int argc, char **argv) -> int {
+    const auto depth = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : default_depth;
+    const auto variables = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : default_variables;
+    const auto source = generate_source(depth, variables);
+
+    auto lexer = Lexer(source);
+    auto parser = parser::Parser(lexer);
+    auto program = parser.parse_program();
+    if (!program || !parser.get_errors().empty()) {
+        std::cerr << "Parsing the generated program failed\n";
+        return EXIT_FAILURE;
+    }
+
+    auto best = std::chrono::duration<double>::max();
+    auto diagnostics = size_t{0};
+    for (auto repetition = 0u; repetition < repetitions; repetition++) {
+        const auto start = std::chrono::steady_clock::now();
+
+        auto analyzer = analyzer::Analyzer(*program);
+        if (!analyzer.analyze()) {
+            std::cerr << "Analysis of the generated program failed\n";
+            return EXIT_FAILURE;
+        }
+        diagnostics = analyzer.get_errors().size();
+
+        best = std::min<std::chrono::duration<double>>(best, std::chrono::steady_clock::now() - start);
+    }
+
+    std::cout << "Depth " << depth << ", " << variables << " variables, " << diagnostics << " warnings\n";
+    std::cout << "Best of " << repetitions << ": " << best.count() * 1000.0 << " ms\n";
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,105 @@
+#include "emitter.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr auto default_procedures = 2000u;
+constexpr auto chain_length = 8u;
+constexpr auto repetitions = 3u;
+
+/// Identifiers are letters only
+auto procedure_name(unsigned index) -> std::string {
+    auto name = std::string{"p"};
+    do {
+        name += static_cast<char>('a' + index % 26);
+        index /= 26;
+    } while (index > 0);
+    return name;
+}
+
+/// Procedures doing some arithmetic in a loop, every procedure calls the one before it except at the start of a chain.
+/// The first procedures of all chains are declared first, then the second ones and so on, so the procedures fall into
+/// `chain_length` batches emitted in parallel.
+auto generate_source(unsigned procedures) -> std::string {
+    auto source = std::string{};
+    auto order = std::vector<unsigned>{};
+    for (auto position = 0u; position < chain_length; position++) {
+        for (auto i = position; i < procedures; i += chain_length) {
+            order.push_back(i);
+        }
+    }
+    for (const auto i : order) {
+        source += "PROCEDURE " + procedure_name(i) + "(a, b) IS\n  x, y, t[8]\nIN\n";
+        source += "  x := a * b;\n  y := x / 7;\n  t[3] := y % 5;\n";
+        source += "  WHILE x > y DO\n    x := x - t[3];\n    y := y + x;\n    t[y] := x / 2;\n  ENDWHILE\n";
+        source += "  IF x = 0 THEN\n    b := a;\n  ELSE\n    a := b * y;\n  ENDIF\n";
+        if (i % chain_length != 0) {
+            source += "  " + procedure_name(i - 1) + "(a, x);\n";
+        }
+        source += "END\n";
+    }
+
+    source += "PROGRAM IS\n  m, n\nIN\n  READ m;\n  READ n;\n";
+    for (auto i = chain_length - 1; i < procedures; i += chain_length) {
+        source += "  " + procedure_name(i) + "(m, n);\n";
+    }
+    return source + "  WRITE m;\nEND\n";
+}
+
+} // namespace
+
+/// Time the emitter takes on a program with many procedures with 1, 2, 4, ... threads, the number of procedures and
+/// the most threads (all cores by default) can be given as the first two arguments
+auto main(int argc, char **argv) -> int {
+    const auto procedures = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : default_procedures;
+    const auto source = generate_source(procedures);
+
+    auto lexer = Lexer(source);
+    auto parser = parser::Parser(lexer);
+    const auto program = parser.parse_program();
+    if (!program || !parser.get_errors().empty()) {
+        std::cerr << "Parsing the generated program failed\n";
+        return EXIT_FAILURE;
+    }
+
+    std::cout << procedures << " procedures\n";
+
+    const auto max_jobs = argc > 2 ? static_cast<unsigned>(std::strtoul(argv[2], nullptr, 10))
+                                   : std::max(1u, std::thread::hardware_concurrency());
+    auto lines = size_t{0};
+    for (auto jobs = 1u;; jobs = std::min(2 * jobs, max_jobs)) {
+        auto best = std::chrono::duration<double>::max();
+        for (auto repetition = 0u; repetition < repetitions; repetition++) {
+            auto copy = *program;
+            const auto start = std::chrono::steady_clock::now();
+
+            auto emitter = emitter::Emitter(std::move(copy), nullptr, jobs);
+            emitter.emit_program();
+
+            best = std::min<std::chrono::duration<double>>(best, std::chrono::steady_clock::now() - start);
+            if (!emitter.get_errors().empty()) {
+                std::cerr << "Emitting the generated program failed\n";
+                return EXIT_FAILURE;
+            }
+            if (jobs > 1 && emitter.get_lines().size() != lines) {
+                std::cerr << "The code depends on the number of threads\n";
+                return EXIT_FAILURE;
+            }
+            lines = emitter.get_lines().size();
+        }
+
+        std::cout << jobs << " threads, " << lines << " lines, best of " << repetitions << ": " << best.count() * 1000.0
+                  << " ms\n";
+        if (jobs == max_jobs) {
+            break;
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,95 @@
+#include "lexer.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+
+namespace {
+
+constexpr auto default_megabytes = 8u;
+constexpr auto repetitions = 5u;
+
+auto random_identifier(std::mt19937 &generator) -> std::string {
+    auto length = std::uniform_int_distribution<>(1, 12)(generator);
+    auto letter = std::uniform_int_distribution<>(0, 26);
+    auto identifier = std::string{};
+    while (length-- > 0) {
+        const auto index = letter(generator);
+        identifier += index < 26 ? static_cast<char>('a' + index) : '_';
+    }
+    return identifier;
+}
+
+/// Procedures made of every kind of statement, until the source is at least `size` bytes long
+auto generate_source(size_t size) -> std::string {
+    auto generator = std::mt19937(42);
+    auto number = std::uniform_int_distribution<uint64_t>(0, 1'000'000);
+    auto statement = std::uniform_int_distribution<>(0, 5);
+
+    auto source = std::string{};
+    source.reserve(size + 1024);
+
+    for (auto procedure = 0u; source.size() < size; procedure++) {
+        const auto a = random_identifier(generator);
+        const auto b = random_identifier(generator);
+        source += "PROCEDURE p" + std::to_string(procedure) + "(T " + a + ", " + b + ") IS\n  x, y[16]\nIN\n";
+        for (auto i = 0u; i < 32; i++) {
+            switch (statement(generator)) {
+            case 0:
+                source += "  x := " + b + " * " + std::to_string(number(generator)) + ";\n";
+                break;
+            case 1:
+                source += "  " + a + "[x] := y[" + std::to_string(i % 16) + "] % " + b + ";\n";
+                break;
+            case 2:
+                source += "  IF x >= " + b + " THEN\n    WRITE x;\n  ELSE\n    READ " + b + ";\n  ENDIF\n";
+                break;
+            case 3:
+                source += "  WHILE x != 0 DO\n    x := x - 1;\n  ENDWHILE\n";
+                break;
+            case 4:
+                source += "  REPEAT\n    x := x / 2;\n  UNTIL x <= " + std::to_string(number(generator)) + ";\n";
+                break;
+            default:
+                source += "  # " + random_identifier(generator) + " is a comment\n";
+                break;
+            }
+        }
+        source += "END\n";
+    }
+
+    return source + "PROGRAM IS\n  a\nIN\n  READ a;\nEND\n";
+}
+
+} // namespace
+
+/// Lexer throughput on a generated source, the size in megabytes can be given as the first argument
+auto main(int argc, char **argv) -> int {
+    const auto megabytes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : default_megabytes;
+    const auto source = generate_source(megabytes * 1024 * 1024);
+
+    auto best = std::chrono::duration<double>::max();
+    auto tokens = size_t{0};
+    for (auto repetition = 0u; repetition < repetitions; repetition++) {
+        const auto start = std::chrono::steady_clock::now();
+
+        tokens = 0;
+        for (auto &token : Lexer(source)) {
+            if (!token) {
+                std::cerr << "Lexing failed: " << token.error().message << '\n';
+                return EXIT_FAILURE;
+            }
+            tokens++;
+        }
+
+        best = std::min<std::chrono::duration<double>>(best, std::chrono::steady_clock::now() - start);
+    }
+
+    const auto seconds = best.count();
+    std::cout << "Source: " << source.size() / (1024.0 * 1024.0) << " MiB, " << tokens << " tokens\n";
+    std::cout << "Best of " << repetitions << ": " << seconds * 1000.0 << " ms, "
+              << source.size() / (1024.0 * 1024.0) / seconds << " MiB/s, " << tokens / seconds / 1e6
+              << " Mtokens/s\n";
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,30 @@
+#include "phase-report.hpp"
+#include <cstdlib>
+#include <new>
+
+// Replaces the global operator new of the compiler executable only, so that --time-report can count allocations. The
+// array and nothrow forms call these.
+
+auto operator new(std::size_t size) -> void * {
+    count_allocation();
+    if (auto *pointer = std::malloc(size == 0 ? 1 : size)) {
+        return pointer;
+    }
+    throw std::bad_alloc{};
+}
+
+auto operator new(std::size_t size, std::align_val_t alignment) -> void * {
+    count_allocation();
+    const auto align = static_cast<std::size_t>(alignment);
+    // aligned_alloc wants a nonzero multiple of the alignment
+    const auto rounded = size == 0 ? align : (size + align - 1) / align * align;
+    if (auto *pointer = std::aligned_alloc(align, rounded)) {
+        return pointer;
+    }
+    throw std::bad_alloc{};
+}
+
+void operator delete(void *pointer) noexcept { std::free(pointer); }
+void operator delete(void *pointer, std::size_t) noexcept { std::free(pointer); }
+void operator delete(void *pointer, std::align_val_t) noexcept { std::free(pointer); }
+void operator delete(void *pointer, std::size_t, std::align_val_t) noexcept { std::free(pointer); }
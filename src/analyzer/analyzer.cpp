@@ -6,6 +6,24 @@
 
 using namespace analyzer;
 
+auto Scope::operator[](const std::string &name) -> Variable & {
+    const auto it = variables.find(name);
+    undo_log.emplace_back(name, it == variables.end() ? std::nullopt : std::optional{it->second});
+    return it == variables.end() ? variables[name] : it->second;
+}
+
+void Scope::leave(Mark mark) {
+    while (undo_log.size() > mark) {
+        auto &[name, previous] = undo_log.back();
+        if (previous) {
+            variables[name] = *previous;
+        } else {
+            variables.erase(name);
+        }
+        undo_log.pop_back();
+    }
+}
+
 void Analyzer::check_duplicate_declarations(var_map &already_declared,
                                             const IdentifierVarCollection auto &new_declarations, bool is_args) {
     for (const auto &var : new_declarations) {
@@ -37,13 +55,16 @@ void Analyzer::analyze_procedure(const ast::Procedure &procedure) {
     analyze_context(procedure.context, variable_declarations);
 }
 
-void Analyzer::analyze_context(const ast::Context &context, var_map variables) {
+void Analyzer::analyze_context(const ast::Context &context, var_map &variables) {
     check_duplicate_declarations(variables, context.declarations, false);
 
     analyze_commands(context.commands, variables);
 }
 
-void Analyzer::analyze_commands(const std::vector<ast::Command> &commands, var_map variables) {
+void Analyzer::analyze_commands(const std::vector<ast::Command> &commands, var_map &variables) {
+    // Nothing a block changes is visible after it
+    const auto mark = variables.enter();
+
     for (const auto &command : commands) {
         std::visit(overloaded{[&](const ast::Assignment &assignment) { analyze_assignment(assignment, variables); },
                               [&](const ast::Read &read) {
@@ -105,6 +126,8 @@ void Analyzer::analyze_commands(const std::vector<ast::Command> &commands, var_m
                               }},
                    command);
     }
+
+    variables.leave(mark);
 }
 
 void Analyzer::analyze_assignment(const ast::Assignment &assignment, var_map &variables) {
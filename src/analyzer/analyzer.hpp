@@ -2,7 +2,9 @@
 
 #include "ast.hpp"
 #include "error.hpp"
+#include <optional>
 #include <unordered_map>
+#include <vector>
 
 namespace analyzer {
 // TODO: Add information about being array and array size
@@ -13,6 +15,28 @@ struct Variable {
     bool is_pointer;
 };
 
+/// Variables visible in the block being analyzed. What a block changes is undone when it is left: entering one only
+/// remembers the length of the undo log, and leaving it restores the entries logged since.
+class Scope {
+  public:
+    using Mark = size_t;
+
+    auto contains(const std::string &name) const -> bool { return variables.contains(name); }
+    auto begin() const { return variables.begin(); }
+    auto end() const { return variables.end(); }
+
+    /// Entry of the variable to be changed, created if it is not declared
+    auto operator[](const std::string &name) -> Variable &;
+
+    auto enter() const -> Mark { return undo_log.size(); }
+    void leave(Mark mark);
+
+  private:
+    std::unordered_map<std::string, Variable> variables{};
+    // Entries before they were changed, nullopt for the ones that did not exist
+    std::vector<std::pair<std::string, std::optional<Variable>>> undo_log{};
+};
+
 struct Procedure {
     const ast::Procedure *procedure;
     bool used = false;
@@ -20,14 +44,14 @@ struct Procedure {
 
 class Analyzer {
   public:
-    using var_map = std::unordered_map<std::string, Variable>;
+    using var_map = Scope;
     Analyzer() = delete;
     Analyzer(ast::Program &program) : program(program) {}
 
     auto analyze() -> bool;
     void analyze_procedure(const ast::Procedure &procedure);
-    void analyze_context(const ast::Context &context, var_map variables);
-    void analyze_commands(const std::vector<ast::Command> &commands, var_map already_declared);
+    void analyze_context(const ast::Context &context, var_map &variables);
+    void analyze_commands(const std::vector<ast::Command> &commands, var_map &variables);
     void analyze_assignment(const ast::Assignment &assignment, var_map &variables);
     void analyze_read(const ast::Read &read, var_map &variables);
     void analyze_write(const ast::Write &write, var_map &variables);
@@ -0,0 +1,265 @@
+#include "ast-interpreter.hpp"
+#include "common.hpp"
+#include <limits>
+#include <ranges>
+#include <stdexcept>
+
+auto evaluate_binary(uint64_t lhs, TokenType op, uint64_t rhs) -> std::optional<uint64_t> {
+    constexpr auto max = std::numeric_limits<uint64_t>::max();
+    switch (op) {
+    case TokenType::Plus:
+        if (lhs > max - rhs) {
+            return std::nullopt;
+        }
+        return lhs + rhs;
+    case TokenType::Minus:
+        // SUB saturates at 0
+        return lhs > rhs ? lhs - rhs : 0;
+    case TokenType::Star:
+        if (lhs != 0 && rhs > max / lhs) {
+            return std::nullopt;
+        }
+        return lhs * rhs;
+    case TokenType::Slash:
+        return rhs == 0 ? 0 : lhs / rhs;
+    case TokenType::Percent:
+        return rhs == 0 ? 0 : lhs % rhs;
+    default:
+        return std::nullopt;
+    }
+}
+
+auto evaluate_comparison(uint64_t lhs, TokenType op, uint64_t rhs) -> std::optional<bool> {
+    switch (op) {
+    case TokenType::Equals:
+        return lhs == rhs;
+    case TokenType::BangEquals:
+        return lhs != rhs;
+    case TokenType::Greater:
+        return lhs > rhs;
+    case TokenType::GreaterEquals:
+        return lhs >= rhs;
+    case TokenType::Less:
+        return lhs < rhs;
+    case TokenType::LessEquals:
+        return lhs <= rhs;
+    default:
+        return std::nullopt;
+    }
+}
+
+AstInterpreter::AstInterpreter(const ast::Program &program, uint64_t step_budget) : step_budget(step_budget) {
+    for (const auto &procedure : program.procedures) {
+        procedures[procedure.name.lexeme] = &procedure;
+    }
+
+    frames.emplace_back();
+    allocate(frames.back(), program.main.declarations);
+}
+
+auto AstInterpreter::get_main_value(const std::string &name, uint64_t offset) const -> std::optional<uint64_t> {
+    const auto &main = frames.front();
+    if (!main.contains(name) || offset >= main.at(name).size) {
+        return std::nullopt;
+    }
+    return memory[main.at(name).address + offset];
+}
+
+void AstInterpreter::checkpoint() {
+    saved.steps = steps;
+    saved.memory_size = memory.size();
+    saved.outputs_size = outputs.size();
+    saved.overwritten.clear();
+}
+
+void AstInterpreter::rollback() {
+    // A failed command may have stopped inside a call, whose frames are above the checkpoint
+    frames.resize(1);
+    memory.resize(saved.memory_size);
+    for (const auto &[address, value] : saved.overwritten | std::views::reverse) {
+        memory[address] = value;
+    }
+    outputs.resize(saved.outputs_size);
+    steps = saved.steps;
+    saved.overwritten.clear();
+}
+
+auto AstInterpreter::step() -> bool { return ++steps <= step_budget; }
+
+void AstInterpreter::allocate(frame &variables, const std::vector<ast::Declaration> &declarations) {
+    for (const auto &declaration : declarations) {
+        const auto size = declaration.array_size ? std::stoull(declaration.array_size->lexeme) : 1;
+        variables[declaration.identifier.lexeme] = Binding{memory.size(), size};
+        memory.resize(memory.size() + size);
+    }
+}
+
+auto AstInterpreter::resolve(const ast::Identifier &identifier) -> std::optional<uint64_t> {
+    const auto &variables = frames.back();
+    if (!variables.contains(identifier.name.lexeme)) {
+        return std::nullopt;
+    }
+    const auto binding = variables.at(identifier.name.lexeme);
+
+    auto offset = uint64_t{0};
+    if (identifier.index) {
+        const auto index = identifier.index->token_type == TokenType::Num
+                               ? evaluate(ast::Value{*identifier.index})
+                               : evaluate(ast::Value{ast::Identifier{*identifier.index, std::nullopt}});
+        if (!index) {
+            return std::nullopt;
+        }
+        offset = *index;
+    }
+
+    if (offset >= binding.size) {
+        return std::nullopt;
+    }
+    return binding.address + offset;
+}
+
+auto AstInterpreter::evaluate(const ast::Value &value) -> std::optional<uint64_t> {
+    if (std::holds_alternative<ast::Num>(value)) {
+        try {
+            return std::stoull(std::get<ast::Num>(value).lexeme);
+        } catch (const std::out_of_range &) {
+            return std::nullopt;
+        }
+    }
+
+    const auto address = resolve(std::get<ast::Identifier>(value));
+    if (!address) {
+        return std::nullopt;
+    }
+    return memory[*address];
+}
+
+auto AstInterpreter::evaluate(const ast::Expression &expression) -> std::optional<uint64_t> {
+    if (std::holds_alternative<ast::Value>(expression)) {
+        return evaluate(std::get<ast::Value>(expression));
+    }
+
+    const auto &binary = std::get<ast::BinaryExpression>(expression);
+    const auto lhs = evaluate(binary.lhs);
+    const auto rhs = evaluate(binary.rhs);
+    if (!lhs || !rhs) {
+        return std::nullopt;
+    }
+    return evaluate_binary(*lhs, binary.op.token_type, *rhs);
+}
+
+auto AstInterpreter::evaluate(const ast::Condition &condition) -> std::optional<bool> {
+    const auto lhs = evaluate(condition.lhs);
+    const auto rhs = evaluate(condition.rhs);
+    if (!lhs || !rhs) {
+        return std::nullopt;
+    }
+    return evaluate_comparison(*lhs, condition.op.token_type, *rhs);
+}
+
+auto AstInterpreter::call(const ast::Call &call) -> bool {
+    if (!procedures.contains(call.name.lexeme)) {
+        return false;
+    }
+    const auto &procedure = *procedures.at(call.name.lexeme);
+    if (procedure.args.size() != call.args.size()) {
+        return false;
+    }
+
+    // Arguments are passed by reference, so they are bound to the caller's memory
+    auto variables = frame{};
+    for (auto i = 0u; i < call.args.size(); i++) {
+        if (!frames.back().contains(call.args[i].lexeme)) {
+            return false;
+        }
+        variables[procedure.args[i].identifier.lexeme] = frames.back().at(call.args[i].lexeme);
+    }
+
+    const auto frame_start = memory.size();
+    allocate(variables, procedure.context.declarations);
+
+    frames.push_back(std::move(variables));
+    const auto finished = execute(procedure.context.commands);
+    frames.pop_back();
+
+    memory.resize(frame_start);
+    return finished;
+}
+
+auto AstInterpreter::execute(const std::span<const ast::Command> commands) -> bool {
+    for (const auto &command : commands) {
+        if (!execute(command)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+auto AstInterpreter::execute(const ast::Command &command) -> bool {
+    if (!step()) {
+        return false;
+    }
+
+    return std::visit(overloaded{[&](const ast::Assignment &assignment) {
+                                     const auto address = resolve(assignment.identifier);
+                                     const auto value = evaluate(assignment.expression);
+                                     if (!address || !value) {
+                                         return false;
+                                     }
+                                     if (*address < saved.memory_size) {
+                                         saved.overwritten.emplace_back(*address, memory[*address]);
+                                     }
+                                     memory[*address] = *value;
+                                     return true;
+                                 },
+                                 [&](const ast::Read &) { return false; },
+                                 [&](const ast::Write &write) {
+                                     const auto value = evaluate(write.value);
+                                     if (!value) {
+                                         return false;
+                                     }
+                                     outputs.push_back(*value);
+                                     return true;
+                                 },
+                                 [&](const ast::If &if_statement) {
+                                     const auto condition = evaluate(if_statement.condition);
+                                     if (!condition) {
+                                         return false;
+                                     }
+                                     if (*condition) {
+                                         return execute(if_statement.commands);
+                                     }
+                                     return !if_statement.else_commands || execute(*if_statement.else_commands);
+                                 },
+                                 [&](const ast::While &while_statement) {
+                                     while (true) {
+                                         const auto condition = evaluate(while_statement.condition);
+                                         if (!condition || !step()) {
+                                             return false;
+                                         }
+                                         if (!*condition) {
+                                             return true;
+                                         }
+                                         if (!execute(while_statement.commands)) {
+                                             return false;
+                                         }
+                                     }
+                                 },
+                                 [&](const ast::Repeat &repeat) {
+                                     while (true) {
+                                         if (!execute(repeat.commands)) {
+                                             return false;
+                                         }
+                                         const auto condition = evaluate(repeat.condition);
+                                         if (!condition || !step()) {
+                                             return false;
+                                         }
+                                         if (*condition) {
+                                             return true;
+                                         }
+                                     }
+                                 },
+                                 [&](const ast::Call &call_statement) { return call(call_statement); },
+                                 [&](const ast::InlinedProcedure &procedure) { return execute(procedure.commands); }},
+                      command);
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include "ast.hpp"
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/// Evaluates `lhs op rhs` the way the machine does, nullopt if the result does not fit in 64 bits
+auto evaluate_binary(uint64_t lhs, TokenType op, uint64_t rhs) -> std::optional<uint64_t>;
+auto evaluate_comparison(uint64_t lhs, TokenType op, uint64_t rhs) -> std::optional<bool>;
+
+struct Binding {
+    uint64_t address;
+    uint64_t size;
+};
+
+/// State of the interpreter at a checkpoint, the memory is restored from the old values of the cells written since
+struct Checkpoint {
+    uint64_t steps;
+    size_t memory_size;
+    size_t outputs_size;
+    std::vector<std::pair<uint64_t, std::optional<uint64_t>>> overwritten;
+};
+
+/// Runs commands at compile time. Execution stops at the first READ, when the step budget runs out or when the
+/// outcome depends on something that is not modelled (uninitialized memory, values above 64 bits, out of bounds
+/// indices), in which case execute returns false and the state is unspecified.
+class AstInterpreter {
+  public:
+    using frame = std::unordered_map<std::string, Binding>;
+
+    AstInterpreter() = delete;
+    AstInterpreter(const ast::Program &program, uint64_t step_budget);
+
+    auto execute(const ast::Command &command) -> bool;
+    auto execute(const std::span<const ast::Command> commands) -> bool;
+
+    auto get_outputs() const -> const std::vector<uint64_t> & { return outputs; }
+    auto get_main_value(const std::string &name, uint64_t offset) const -> std::optional<uint64_t>;
+
+    /// Only the cells written after the checkpoint are recorded, so rolling back does not copy the whole memory
+    void checkpoint();
+    void rollback();
+
+  private:
+    auto step() -> bool;
+    void allocate(frame &variables, const std::vector<ast::Declaration> &declarations);
+    auto resolve(const ast::Identifier &identifier) -> std::optional<uint64_t>;
+    auto evaluate(const ast::Value &value) -> std::optional<uint64_t>;
+    auto evaluate(const ast::Expression &expression) -> std::optional<uint64_t>;
+    auto evaluate(const ast::Condition &condition) -> std::optional<bool>;
+    auto call(const ast::Call &call) -> bool;
+
+    std::unordered_map<std::string, const ast::Procedure *> procedures{};
+    std::vector<frame> frames{};
+    std::vector<std::optional<uint64_t>> memory{};
+    std::vector<uint64_t> outputs{};
+    uint64_t steps = 0;
+    uint64_t step_budget;
+    Checkpoint saved{.steps = 0, .memory_size = 0, .outputs_size = 0, .overwritten = {}};
+};
@@ -1,11 +1,17 @@
 #include "ast-optimizer.hpp"
+#include "ast-interpreter.hpp"
+#include <algorithm>
+#include <functional>
 #include <iostream>
+#include <optional>
+#include <set>
+#include <stdexcept>
 
 void substitute_identifier(const std::unordered_map<std::string, std::string> &mapped_args,
                            ast::Identifier &identifier) {
     identifier.name.lexeme = mapped_args.at(identifier.name.lexeme);
 
-    if (identifier.index) {
+    if (identifier.index && identifier.index->token_type == TokenType::Pidentifier) {
         identifier.index->lexeme = mapped_args.at(identifier.index->lexeme);
     }
 }
@@ -63,82 +69,1492 @@ void change_inlined_occurences(const std::unordered_map<std::string, std::string
     }
 }
 
+// Rough costs of the machine, used to decide whether inlining a call or replacing a load by a constant pays off
+constexpr auto load_cost = 50u;
+constexpr auto add_cost = 5u;
+constexpr auto loop_operation_cost = 100u;
+
+// A call stores a pointer to every argument in the frame of the callee, saves the return address and loads it back
+// on return (see Emitter::emit_call and Emitter::emit_procedure_body). Inside the callee every access to an argument
+// loads its pointer first.
+constexpr auto call_cost = 2 * load_cost + 30u;
+constexpr auto argument_cost = load_cost + 15u;
+constexpr auto pointer_access_cost = load_cost + 5u;
+
+// Loops are assumed to run this many times when weighing a call site
+constexpr auto loop_frequency = 10u;
+constexpr auto max_loop_depth = 4u;
+
+auto loop_weight(unsigned loop_depth) -> uint64_t {
+    auto weight = uint64_t{1};
+    for (auto i = 0u; i < std::min(loop_depth, max_loop_depth); ++i) {
+        weight *= loop_frequency;
+    }
+    return weight;
+}
+
+/// Approximate number of instructions needed to get the value into a register
+auto value_size(const ast::Value &value) -> unsigned {
+    if (std::holds_alternative<ast::Num>(value)) {
+        return 8;
+    }
+    return std::get<ast::Identifier>(value).index ? 20 : 10;
+}
+
+auto condition_size(const ast::Condition &condition) -> unsigned {
+    return value_size(condition.lhs) + value_size(condition.rhs) + 10;
+}
+
+/// Accesses to the given arguments weighted by the loops they are in, each of them goes through a pointer
+auto count_argument_accesses(const std::span<const ast::Command> commands,
+                             const std::unordered_set<std::string> &arguments, unsigned loop_depth) -> uint64_t {
+    auto count = uint64_t{0};
+    auto access_identifier = [&](const ast::Identifier &identifier) {
+        auto accesses = uint64_t{arguments.contains(identifier.name.lexeme)};
+        if (identifier.index && identifier.index->token_type == TokenType::Pidentifier) {
+            accesses += arguments.contains(identifier.index->lexeme);
+        }
+        count += accesses * loop_weight(loop_depth);
+    };
+    auto access_value = [&](const ast::Value &value) {
+        if (std::holds_alternative<ast::Identifier>(value)) {
+            access_identifier(std::get<ast::Identifier>(value));
+        }
+    };
+    auto access_condition = [&](const ast::Condition &condition) {
+        access_value(condition.lhs);
+        access_value(condition.rhs);
+    };
+
+    for (const auto &command : commands) {
+        std::visit(
+            overloaded{[&](const ast::Read &read) { access_identifier(read.identifier); },
+                       [&](const ast::Write &write) { access_value(write.value); },
+                       [&](const ast::If &if_statement) {
+                           access_condition(if_statement.condition);
+                           count += count_argument_accesses(if_statement.commands, arguments, loop_depth);
+                           if (if_statement.else_commands) {
+                               count += count_argument_accesses(*if_statement.else_commands, arguments, loop_depth);
+                           }
+                       },
+                       [&](const ast::Repeat &repeat) {
+                           access_condition(repeat.condition);
+                           count += count_argument_accesses(repeat.commands, arguments, loop_depth + 1);
+                       },
+                       [&](const ast::Assignment &assignment) {
+                           access_identifier(assignment.identifier);
+                           std::visit(overloaded{[&](const ast::Value &value) { access_value(value); },
+                                                 [&](const ast::BinaryExpression &binary_expression) {
+                                                     access_value(binary_expression.lhs);
+                                                     access_value(binary_expression.rhs);
+                                                 }},
+                                      assignment.expression);
+                       },
+                       [&](const ast::While &while_statement) {
+                           access_condition(while_statement.condition);
+                           count += count_argument_accesses(while_statement.commands, arguments, loop_depth + 1);
+                       },
+                       [&](const ast::Call &call) {
+                           for (const auto &arg : call.args) {
+                               count += arguments.contains(arg.lexeme) * loop_weight(loop_depth);
+                           }
+                       },
+                       [&](const ast::InlinedProcedure &procedure) {
+                           count += count_argument_accesses(procedure.commands, arguments, loop_depth);
+                       }},
+            command);
+    }
+    return count;
+}
+
+/// Calls in the commands with how often they run, taken from the profile when there is one
+void collect_call_sites(std::vector<ast::Command> &commands, unsigned loop_depth, const Profile *profile,
+                        std::vector<AstOptimizer::CallSite> &call_sites) {
+    for (auto &command : commands) {
+        std::visit(overloaded{[&](ast::If &if_statement) {
+                                  collect_call_sites(if_statement.commands, loop_depth, profile, call_sites);
+                                  if (if_statement.else_commands) {
+                                      collect_call_sites(*if_statement.else_commands, loop_depth, profile, call_sites);
+                                  }
+                              },
+                              [&](ast::Repeat &repeat) {
+                                  collect_call_sites(repeat.commands, loop_depth + 1, profile, call_sites);
+                              },
+                              [&](ast::While &while_statement) {
+                                  collect_call_sites(while_statement.commands, loop_depth + 1, profile, call_sites);
+                              },
+                              [&](ast::Call &) {
+                                  const auto count = profile ? profile->get_count(command) : std::nullopt;
+                                  call_sites.push_back({&command, count.value_or(loop_weight(loop_depth))});
+                              },
+                              [&](ast::InlinedProcedure &procedure) {
+                                  collect_call_sites(procedure.commands, loop_depth, profile, call_sites);
+                              },
+                              [&](auto &) {}},
+                   command);
+    }
+}
+
 void AstOptimizer::inline_procedures() {
+    // A procedure can only call the ones declared before it, so going in declaration order inlines the callees
+    // first and the bodies copied into their callers are already optimized
+    for (auto &procedure : program->procedures) {
+        while (inline_calls(procedure.context)) {
+        }
+        calculate_procedure_metadata(procedure);
+    }
+
+    while (inline_calls(program->main)) {
+    }
+
+    remove_unused_procedures();
+}
+
+auto AstOptimizer::inline_calls(ast::Context &context) -> bool {
+    calculate_procedure_call_counts();
+
+    auto call_sites = std::vector<CallSite>{};
+    collect_call_sites(context.commands, 0, profile, call_sites);
+
+    // Calls in the hottest loops get the growth budget first
+    std::ranges::stable_sort(call_sites, std::greater{}, &CallSite::frequency);
+
+    auto inlined = false;
+    for (const auto &call_site : call_sites) {
+        const auto &call = std::get<ast::Call>(*call_site.command);
+        const auto &name = call.name.lexeme;
+
+        const auto benefit = call_site.frequency * procedure_call_savings[name];
+        const auto growth = int64_t{procedure_costs[name]} - calculate_commands_cost({call_site.command, 1});
+        // The body of a procedure called from a single place is removed once inlined so it does not grow the code
+        const auto is_only_call = procedure_call_counts[name] == 1;
+
+        if (growth > 0 && !is_only_call) {
+            if (benefit < static_cast<uint64_t>(growth) || static_cast<uint64_t>(growth) > inline_growth_budget) {
+                continue;
+            }
+            inline_growth_budget -= growth;
+        }
+
+        *call_site.command = inline_call(call, context.declarations);
+        inlined = true;
+    }
+
+    return inlined;
+}
+
+auto AstOptimizer::inline_call(const ast::Call &call, std::vector<ast::Declaration> &declarations)
+    -> ast::InlinedProcedure {
+    const auto &callee = *procedures.at(call.name.lexeme);
+
+    auto mapped_names = std::unordered_map<std::string, std::string>{};
+    for (auto i = 0u; i < callee.args.size(); ++i) {
+        mapped_names[callee.args[i].identifier.lexeme] = call.args[i].lexeme;
+    }
+
+    for (const auto &declaration : callee.context.declarations) {
+        const auto &name = declaration.identifier.lexeme;
+        const auto mapped_name = name + "@" + call.signature();
+        mapped_names[name] = mapped_name;
+
+        // Copies inlined with the same arguments share their locals, just like consecutive calls share the frame
+        const auto is_declared = std::ranges::any_of(
+            declarations, [&](const auto &other) { return other.identifier.lexeme == mapped_name; });
+        if (!is_declared) {
+            auto renamed_declaration = declaration;
+            renamed_declaration.identifier.lexeme = mapped_name;
+            declarations.push_back(renamed_declaration);
+        }
+    }
+
+    auto commands = callee.context.commands;
+    change_inlined_occurences(mapped_names, commands);
+
+    return ast::InlinedProcedure{std::move(commands), call.name};
+}
+
+void AstOptimizer::remove_unused_procedures() {
+    calculate_procedure_call_counts();
+    std::erase_if(program->procedures, [&](const ast::Procedure &procedure) {
+        return !procedure_call_counts.contains(procedure.name.lexeme);
+    });
+    calculate_procedure_call_counts();
+}
+
+void AstOptimizer::calculate_procedure_call_counts_helper(const std::span<const ast::Command> commands,
+                                                          std::unordered_set<std::string> &callees) {
+    for (const auto &command : commands) {
+        std::visit(overloaded{[&](const ast::If &if_statement) {
+                                  calculate_procedure_call_counts_helper(if_statement.commands, callees);
+                                  if (if_statement.else_commands) {
+                                      calculate_procedure_call_counts_helper(*if_statement.else_commands, callees);
+                                  }
+                              },
+                              [&](const ast::Repeat &repeat) {
+                                  calculate_procedure_call_counts_helper(repeat.commands, callees);
+                              },
+                              [&](const ast::While &while_statement) {
+                                  calculate_procedure_call_counts_helper(while_statement.commands, callees);
+                              },
+                              [&](const ast::Call &call) {
+                                  procedure_call_counts[call.name.lexeme] += 1;
+                                  callees.insert(call.name.lexeme);
+                              },
+                              [&](const ast::InlinedProcedure &procedure) {
+                                  calculate_procedure_call_counts_helper(procedure.commands, callees);
+                              },
+                              [&](const auto &) {}},
+                   command);
+    }
+}
+
+void AstOptimizer::calculate_procedure_call_counts() {
+    procedures.clear();
+    call_graph.clear();
+    procedure_call_counts.clear();
+
     for (auto &procedure : program->procedures) {
         procedures[procedure.name.lexeme] = &procedure;
-        for (auto &command : procedure.context.commands) {
-            std::visit(overloaded{[&](const ast::Call &call) {
-                                      bool should_be_inlined = procedure_call_counts[call.name.lexeme] <= 5;
-                                      should_be_inlined |= procedure_costs[call.name.lexeme] <= 5;
-                                      // TODO: Find a better way to determine if procedure should be inlined
-                                      if (!should_be_inlined) {
-                                          return;
-                                      }
+    }
 
-                                      const auto inlined_procedure = procedures[call.name.lexeme];
-                                      auto procedure_commands_copy = procedures[call.name.lexeme]->context.commands;
+    // Only calls made from main or from the procedures it reaches are counted, so procedures whose every call got
+    // inlined end up without any
+    auto main_callees = std::unordered_set<std::string>{};
+    calculate_procedure_call_counts_helper(program->main.commands, main_callees);
 
-                                      auto mapped_args = std::unordered_map<std::string, std::string>{};
-                                      for (auto i = 0u; i < inlined_procedure->args.size(); ++i) {
-                                          mapped_args[inlined_procedure->args[i].identifier.lexeme] =
-                                              call.args[i].lexeme;
-                                      }
+    auto worklist = std::vector<std::string>(main_callees.begin(), main_callees.end());
+    while (!worklist.empty()) {
+        const auto name = worklist.back();
+        worklist.pop_back();
+        if (call_graph.contains(name) || !procedures.contains(name)) {
+            continue;
+        }
 
-                                      for (auto i = 0u; i < inlined_procedure->context.declarations.size(); ++i) {
-                                          const auto name =
-                                              inlined_procedure->context.declarations[i].identifier.lexeme;
-                                          auto declaration = inlined_procedure->context.declarations[i];
-                                          mapped_args[name] = name + "@" + call.signature();
-                                          declaration.identifier.lexeme = mapped_args[name];
-                                          procedure.context.declarations.push_back(declaration);
-                                      }
+        auto &callees = call_graph[name];
+        calculate_procedure_call_counts_helper(procedures.at(name)->context.commands, callees);
+        worklist.insert(worklist.end(), callees.begin(), callees.end());
+    }
+}
 
-                                      change_inlined_occurences(mapped_args, procedure_commands_copy);
+auto AstOptimizer::calculate_commands_cost(const std::span<const ast::Command> commands) -> unsigned {
+    auto size = 0u;
+    for (const auto &command : commands) {
+        std::visit(
+            overloaded{[&](const ast::Read &read) { size += value_size(read.identifier) + 2; },
+                       [&](const ast::Write &write) { size += value_size(write.value) + 1; },
+                       [&](const ast::If &if_statement) {
+                           size += condition_size(if_statement.condition) +
+                                   calculate_commands_cost(if_statement.commands);
+                           if (if_statement.else_commands) {
+                               size += calculate_commands_cost(*if_statement.else_commands) + 1;
+                           }
+                       },
+                       [&](const ast::Repeat &repeat) {
+                           size += condition_size(repeat.condition) + calculate_commands_cost(repeat.commands);
+                       },
+                       [&](const ast::Assignment &assignment) {
+                           size += value_size(assignment.identifier);
+                           std::visit(overloaded{[&](const ast::Value &value) { size += value_size(value); },
+                                                 [&](const ast::BinaryExpression &binary_expression) {
+                                                     size += value_size(binary_expression.lhs) +
+                                                             value_size(binary_expression.rhs);
+                                                     // Multiplication, division and modulo are emitted as loops
+                                                     const auto op = binary_expression.op.token_type;
+                                                     size += op == TokenType::Plus || op == TokenType::Minus ? 1 : 30;
+                                                 }},
+                                      assignment.expression);
+                       },
+                       [&](const ast::While &while_statement) {
+                           size += condition_size(while_statement.condition) +
+                                   calculate_commands_cost(while_statement.commands) + 1;
+                       },
+                       [&](const ast::Call &call) { size += 12 + 12 * call.arity(); },
+                       [&](const ast::InlinedProcedure &procedure) {
+                           size += calculate_commands_cost(procedure.commands);
+                       }},
+            command);
+    }
+    return size;
+}
+
+void AstOptimizer::calculate_procedure_metadata(const ast::Procedure &procedure) {
+    const auto &name = procedure.name.lexeme;
+    procedure_costs[name] = calculate_commands_cost(procedure.context.commands);
+
+    auto arguments = std::unordered_set<std::string>{};
+    for (const auto &arg : procedure.args) {
+        arguments.insert(arg.identifier.lexeme);
+    }
+    const auto argument_accesses = count_argument_accesses(procedure.context.commands, arguments, 0);
+    procedure_call_savings[name] =
+        call_cost + argument_cost * procedure.arity() + pointer_access_cost * argument_accesses;
+}
+
+/// Cost of building the value in a register with RST/INC/SHL (see Emitter::set_register)
+auto constant_cost(uint64_t value) -> uint64_t {
+    auto cost = 1u;
+    for (; value > 1; value >>= 1) {
+        cost += 1 + (value & 1);
+    }
+    return cost + value;
+}
+
+auto parse_constant(const ast::Num &num) -> std::optional<uint64_t> {
+    try {
+        return std::stoull(num.lexeme);
+    } catch (const std::out_of_range &) {
+        return std::nullopt;
+    }
+}
 
-                                      command = ast::InlinedProcedure{procedure_commands_copy};
-                                  },
-                                  [&](const auto &) {}},
-                       command);
+auto make_constant(uint64_t value, const Token &origin) -> ast::Num {
+    return ast::Num{.token_type = TokenType::Num, .lexeme = std::to_string(value), .line = origin.line,
+                    .column = origin.column};
+}
+
+auto lookup_constant(const ast::Value &value, const AstOptimizer::constant_map &constants) -> std::optional<uint64_t> {
+    if (std::holds_alternative<ast::Num>(value)) {
+        return parse_constant(std::get<ast::Num>(value));
+    }
+
+    const auto &identifier = std::get<ast::Identifier>(value);
+    if (identifier.index || !constants.contains(identifier.name.lexeme)) {
+        return std::nullopt;
+    }
+    return constants.at(identifier.name.lexeme);
+}
+
+auto evaluate_condition(const ast::Condition &condition, const AstOptimizer::constant_map &constants)
+    -> std::optional<bool> {
+    const auto lhs = lookup_constant(condition.lhs, constants);
+    const auto rhs = lookup_constant(condition.rhs, constants);
+    if (!lhs || !rhs) {
+        return std::nullopt;
+    }
+
+    return evaluate_comparison(*lhs, condition.op.token_type, *rhs);
+}
+
+auto operand_cost(const ast::Value &value, const AstOptimizer::constant_map &constants) -> uint64_t {
+    const auto constant = lookup_constant(value, constants);
+    if (!constant) {
+        return load_cost;
+    }
+    return std::min<uint64_t>(constant_cost(*constant), load_cost);
+}
+
+auto operation_cost(TokenType op) -> uint64_t {
+    return op == TokenType::Plus || op == TokenType::Minus ? add_cost : loop_operation_cost;
+}
+
+/// Keeps only the constants that are known to be the same on both paths
+void meet(AstOptimizer::constant_map &constants, const AstOptimizer::constant_map &other) {
+    std::erase_if(constants, [&](const auto &entry) {
+        const auto it = other.find(entry.first);
+        return it == other.end() || it->second != entry.second;
+    });
+}
+
+void substitute_index(ast::Identifier &identifier, const AstOptimizer::constant_map &constants,
+                      const std::unordered_map<std::string, uint64_t> &array_sizes) {
+    if (!identifier.index || identifier.index->token_type != TokenType::Pidentifier ||
+        !constants.contains(identifier.index->lexeme)) {
+        return;
+    }
+
+    const auto offset = constants.at(identifier.index->lexeme);
+    // Leave indices that would be out of bounds for the emitter to report at the original spot
+    if (array_sizes.contains(identifier.name.lexeme) && offset >= array_sizes.at(identifier.name.lexeme)) {
+        return;
+    }
+
+    identifier.index = make_constant(offset, *identifier.index);
+}
+
+void substitute_value(ast::Value &value, const AstOptimizer::constant_map &constants,
+                      const std::unordered_map<std::string, uint64_t> &array_sizes) {
+    if (std::holds_alternative<ast::Num>(value)) {
+        return;
+    }
+
+    auto &identifier = std::get<ast::Identifier>(value);
+    const auto constant = lookup_constant(value, constants);
+    if (constant && constant_cost(*constant) <= load_cost) {
+        value = make_constant(*constant, identifier.name);
+        return;
+    }
+
+    substitute_index(identifier, constants, array_sizes);
+}
+
+void collect_used_variables(const std::span<const ast::Command> commands, std::unordered_set<std::string> &used) {
+    auto use_identifier = [&](const ast::Identifier &identifier) {
+        used.insert(identifier.name.lexeme);
+        if (identifier.index && identifier.index->token_type == TokenType::Pidentifier) {
+            used.insert(identifier.index->lexeme);
+        }
+    };
+    auto use_value = [&](const ast::Value &value) {
+        if (std::holds_alternative<ast::Identifier>(value)) {
+            use_identifier(std::get<ast::Identifier>(value));
         }
+    };
+    auto use_condition = [&](const ast::Condition &condition) {
+        use_value(condition.lhs);
+        use_value(condition.rhs);
+    };
+
+    for (const auto &command : commands) {
+        std::visit(overloaded{[&](const ast::Assignment &assignment) {
+                                  use_identifier(assignment.identifier);
+                                  std::visit(overloaded{[&](const ast::Value &value) { use_value(value); },
+                                                        [&](const ast::BinaryExpression &expression) {
+                                                            use_value(expression.lhs);
+                                                            use_value(expression.rhs);
+                                                        }},
+                                             assignment.expression);
+                              },
+                              [&](const ast::Read &read) { use_identifier(read.identifier); },
+                              [&](const ast::Write &write) { use_value(write.value); },
+                              [&](const ast::If &if_statement) {
+                                  use_condition(if_statement.condition);
+                                  collect_used_variables(if_statement.commands, used);
+                                  if (if_statement.else_commands) {
+                                      collect_used_variables(*if_statement.else_commands, used);
+                                  }
+                              },
+                              [&](const ast::While &while_statement) {
+                                  use_condition(while_statement.condition);
+                                  collect_used_variables(while_statement.commands, used);
+                              },
+                              [&](const ast::Repeat &repeat) {
+                                  use_condition(repeat.condition);
+                                  collect_used_variables(repeat.commands, used);
+                              },
+                              [&](const ast::Call &call) {
+                                  for (const auto &arg : call.args) {
+                                      used.insert(arg.lexeme);
+                                  }
+                              },
+                              [&](const ast::InlinedProcedure &procedure) {
+                                  collect_used_variables(procedure.commands, used);
+                              }},
+                   command);
     }
 }
 
-void AstOptimizer::calculate_procedure_call_counts_helper(const std::span<const ast::Command> commands) {
+/// Runs main at compile time up to the first command that needs input (or exceeds the budget) and replaces
+/// the part that ran with WRITEs of its outputs followed by assignments of the memory the rest of main reads
+void AstOptimizer::evaluate_constant_prefix(uint64_t step_budget) {
+    auto &commands = program->main.commands;
+    auto interpreter = AstInterpreter(*program, step_budget);
+
+    auto prefix_length = 0u;
+    for (; prefix_length < commands.size(); prefix_length++) {
+        interpreter.checkpoint();
+        if (!interpreter.execute(commands[prefix_length]) ||
+            interpreter.get_outputs().size() > max_evaluated_commands) {
+            interpreter.rollback();
+            break;
+        }
+    }
+
+    if (prefix_length == 0) {
+        return;
+    }
+
+    const auto remaining = std::span<const ast::Command>(commands).subspan(prefix_length);
+    auto used = std::unordered_set<std::string>{};
+    collect_used_variables(remaining, used);
+
+    const auto origin = Token{.token_type = TokenType::Num, .lexeme = "", .line = 0, .column = 0};
+
+    auto evaluated = std::vector<ast::Command>{};
+    for (const auto output : interpreter.get_outputs()) {
+        evaluated.push_back(ast::Write{make_constant(output, origin)});
+    }
+
+    for (const auto &declaration : program->main.declarations) {
+        if (!used.contains(declaration.identifier.lexeme)) {
+            continue;
+        }
+
+        const auto size = declaration.array_size ? std::stoull(declaration.array_size->lexeme) : 1;
+        for (auto offset = uint64_t{0}; offset < size; offset++) {
+            const auto value = interpreter.get_main_value(declaration.identifier.lexeme, offset);
+            if (!value) {
+                continue;
+            }
+
+            auto identifier = ast::Identifier{.name = declaration.identifier, .index = std::nullopt};
+            if (declaration.array_size) {
+                identifier.index = make_constant(offset, declaration.identifier);
+            }
+            const auto constant = make_constant(*value, declaration.identifier);
+            evaluated.push_back(ast::Assignment{.identifier = identifier, .expression = ast::Value{constant}});
+        }
+    }
+
+    if (evaluated.size() > max_evaluated_commands) {
+        return;
+    }
+
+    evaluated.insert(evaluated.end(), remaining.begin(), remaining.end());
+    commands = std::move(evaluated);
+}
+
+void AstOptimizer::propagate_constants() {
+    for (auto &procedure : program->procedures) {
+        propagate_constants(procedure.context);
+    }
+
+    propagate_constants(program->main);
+}
+
+void AstOptimizer::track_declarations(const ast::Context &context) {
+    tracked_scalars.clear();
+    array_sizes.clear();
+
+    for (const auto &declaration : context.declarations) {
+        if (declaration.array_size) {
+            array_sizes[declaration.identifier.lexeme] = std::stoull(declaration.array_size->lexeme);
+        } else {
+            tracked_scalars.insert(declaration.identifier.lexeme);
+        }
+    }
+}
+
+void AstOptimizer::propagate_constants(ast::Context &context) {
+    track_declarations(context);
+    auto constants = constant_map{};
+    context.commands = propagate_constants(context.commands, constants);
+}
+
+/// Forward constant propagation and folding, `constants` holds the known values on entry and is updated to the
+/// known values on exit. Branches and loops that can never execute are dropped from the result.
+auto AstOptimizer::propagate_constants(const std::span<const ast::Command> commands, constant_map &constants)
+    -> std::vector<ast::Command> {
+    auto result = std::vector<ast::Command>{};
+
+    auto assign = [&](const ast::Identifier &identifier, std::optional<uint64_t> value) {
+        if (identifier.index || !tracked_scalars.contains(identifier.name.lexeme)) {
+            return;
+        }
+        if (value) {
+            constants[identifier.name.lexeme] = *value;
+        } else {
+            constants.erase(identifier.name.lexeme);
+        }
+    };
+
+    auto substitute_condition = [&](ast::Condition &condition, const constant_map &known) {
+        substitute_value(condition.lhs, known, array_sizes);
+        substitute_value(condition.rhs, known, array_sizes);
+    };
+
     for (const auto &command : commands) {
         std::visit(
-            overloaded{[&](const ast::If &if_statement) { calculate_commands_cost(if_statement.commands); },
-                       [&](const ast::Repeat &repeat) { calculate_commands_cost(repeat.commands); },
-                       [&](const ast::While &while_statement) { calculate_commands_cost(while_statement.commands); },
-                       [&](const ast::Call &call) { procedure_call_counts[call.name.lexeme] += 1; },
-                       [&](const auto &) {}},
+            overloaded{
+                [&](const ast::Assignment &assignment) {
+                    auto folded = assignment;
+                    substitute_index(folded.identifier, constants, array_sizes);
+
+                    auto value = std::optional<uint64_t>{};
+                    auto fold_expression = false;
+                    std::visit(overloaded{[&](ast::Value &operand) {
+                                              value = lookup_constant(operand, constants);
+                                              substitute_value(operand, constants, array_sizes);
+                                          },
+                                          [&](ast::BinaryExpression &expression) {
+                                              const auto lhs = lookup_constant(expression.lhs, constants);
+                                              const auto rhs = lookup_constant(expression.rhs, constants);
+                                              if (lhs && rhs) {
+                                                  value = evaluate_binary(*lhs, expression.op.token_type, *rhs);
+                                              }
+
+                                              const auto expression_cost = operand_cost(expression.lhs, constants) +
+                                                                           operand_cost(expression.rhs, constants) +
+                                                                           operation_cost(expression.op.token_type);
+                                              fold_expression = value && constant_cost(*value) <= expression_cost;
+
+                                              substitute_value(expression.lhs, constants, array_sizes);
+                                              substitute_value(expression.rhs, constants, array_sizes);
+                                          }},
+                               folded.expression);
+
+                    if (fold_expression) {
+                        folded.expression = ast::Value{make_constant(*value, folded.identifier.name)};
+                    }
+
+                    assign(folded.identifier, value);
+                    result.push_back(folded);
+                },
+                [&](const ast::Read &read) {
+                    auto folded = read;
+                    substitute_index(folded.identifier, constants, array_sizes);
+                    assign(folded.identifier, std::nullopt);
+                    result.push_back(folded);
+                },
+                [&](const ast::Write &write) {
+                    auto folded = write;
+                    substitute_value(folded.value, constants, array_sizes);
+                    result.push_back(folded);
+                },
+                [&](const ast::If &if_statement) {
+                    if (const auto taken = evaluate_condition(if_statement.condition, constants)) {
+                        const auto branch = *taken ? if_statement.commands
+                                                   : if_statement.else_commands.value_or(std::vector<ast::Command>{});
+                        for (auto &folded : propagate_constants(branch, constants)) {
+                            result.push_back(std::move(folded));
+                        }
+                        return;
+                    }
+
+                    auto folded = if_statement;
+                    substitute_condition(folded.condition, constants);
+
+                    auto else_constants = constants;
+                    folded.commands = propagate_constants(if_statement.commands, constants);
+                    if (folded.else_commands) {
+                        folded.else_commands = propagate_constants(*if_statement.else_commands, else_constants);
+                    }
+                    meet(constants, else_constants);
+
+                    result.push_back(folded);
+                },
+                [&](const ast::While &while_statement) {
+                    if (evaluate_condition(while_statement.condition, constants) == false) {
+                        return;
+                    }
+
+                    // Iterate until the constants reaching the loop head stop changing, the body folded by the last
+                    // iteration is already the result so nested loops are not visited once more per level
+                    auto folded = while_statement;
+                    auto head = constants;
+                    while (true) {
+                        auto body_constants = head;
+                        folded.commands = propagate_constants(while_statement.commands, body_constants);
+                        auto next_head = head;
+                        meet(next_head, body_constants);
+                        if (next_head == head) {
+                            break;
+                        }
+                        head = std::move(next_head);
+                    }
+
+                    substitute_condition(folded.condition, head);
+
+                    constants = std::move(head);
+                    result.push_back(folded);
+                },
+                [&](const ast::Repeat &repeat) {
+                    auto folded = repeat;
+                    auto head = constants;
+                    auto body_constants = head;
+                    while (true) {
+                        body_constants = head;
+                        folded.commands = propagate_constants(repeat.commands, body_constants);
+                        auto next_head = head;
+                        meet(next_head, body_constants);
+                        if (next_head == head) {
+                            break;
+                        }
+                        head = std::move(next_head);
+                    }
+
+                    // The body runs exactly once when the exit condition holds after every iteration
+                    if (evaluate_condition(repeat.condition, body_constants) == true) {
+                        for (auto &once : propagate_constants(repeat.commands, constants)) {
+                            result.push_back(std::move(once));
+                        }
+                        return;
+                    }
+
+                    substitute_condition(folded.condition, body_constants);
+
+                    constants = std::move(body_constants);
+                    result.push_back(folded);
+                },
+                [&](const ast::Call &call) {
+                    // Arguments are passed by reference so the callee may overwrite any of them
+                    for (const auto &arg : call.args) {
+                        constants.erase(arg.lexeme);
+                    }
+                    result.push_back(call);
+                },
+                [&](const ast::InlinedProcedure &procedure) {
+                    result.push_back(
+                        ast::InlinedProcedure{propagate_constants(procedure.commands, constants), procedure.name});
+                }},
             command);
     }
+
+    return result;
 }
 
-void AstOptimizer::calculate_procedure_call_counts() {
-    for (const auto &procedure : program->procedures) {
-        calculate_procedure_call_counts_helper(procedure.context.commands);
+/// Runs the loop at compile time as long as its condition is known, folding a copy of the body for every iteration.
+/// Gives up when the trip count or the size of the copies exceeds the limits, or when the work budget of the pass
+/// runs out, the loop is then kept as it is.
+auto AstOptimizer::unroll_fully(const ast::While &while_statement, constant_map &constants)
+    -> std::optional<std::vector<ast::Command>> {
+    auto unrolled_constants = constants;
+    auto unrolled = std::vector<ast::Command>{};
+
+    for (auto iteration = 0u;; iteration++) {
+        const auto holds = evaluate_condition(while_statement.condition, unrolled_constants);
+        if (!holds) {
+            return std::nullopt;
+        }
+        if (!*holds) {
+            break;
+        }
+        if (iteration == max_unrolled_iterations) {
+            return std::nullopt;
+        }
+
+        auto copy = propagate_constants(while_statement.commands, unrolled_constants);
+        const auto copy_cost = calculate_commands_cost(copy);
+        if (copy_cost > full_unroll_budget) {
+            full_unroll_budget = 0;
+            return std::nullopt;
+        }
+        full_unroll_budget -= copy_cost;
+
+        unrolled.insert(unrolled.end(), std::make_move_iterator(copy.begin()), std::make_move_iterator(copy.end()));
+        if (calculate_commands_cost(unrolled) > max_unrolled_size) {
+            return std::nullopt;
+        }
     }
 
-    calculate_procedure_call_counts_helper(program->main.commands);
+    constants = std::move(unrolled_constants);
+    unrolled_loops++;
+    return unrolled;
 }
 
-auto AstOptimizer::calculate_commands_cost(const std::span<const ast::Command> commands) -> unsigned {
-    auto len = 0u;
+/// Variables the commands may write to, arguments of calls included
+void collect_assigned_variables(const std::span<const ast::Command> commands,
+                                std::unordered_set<std::string> &assigned) {
+    for (const auto &command : commands) {
+        std::visit(overloaded{[&](const ast::Assignment &assignment) {
+                                  assigned.insert(assignment.identifier.name.lexeme);
+                              },
+                              [&](const ast::Read &read) { assigned.insert(read.identifier.name.lexeme); },
+                              [&](const ast::Write &) {},
+                              [&](const ast::If &if_statement) {
+                                  collect_assigned_variables(if_statement.commands, assigned);
+                                  if (if_statement.else_commands) {
+                                      collect_assigned_variables(*if_statement.else_commands, assigned);
+                                  }
+                              },
+                              [&](const ast::While &while_statement) {
+                                  collect_assigned_variables(while_statement.commands, assigned);
+                              },
+                              [&](const ast::Repeat &repeat) { collect_assigned_variables(repeat.commands, assigned); },
+                              [&](const ast::Call &call) {
+                                  for (const auto &arg : call.args) {
+                                      assigned.insert(arg.lexeme);
+                                  }
+                              },
+                              [&](const ast::InlinedProcedure &procedure) {
+                                  collect_assigned_variables(procedure.commands, assigned);
+                              }},
+                   command);
+    }
+}
+
+auto contains_loop(const std::span<const ast::Command> commands) -> bool {
+    return std::ranges::any_of(commands, [](const ast::Command &command) {
+        return std::visit(overloaded{[](const ast::While &) { return true; }, [](const ast::Repeat &) { return true; },
+                                     [](const ast::If &if_statement) {
+                                         return contains_loop(if_statement.commands) ||
+                                                (if_statement.else_commands &&
+                                                 contains_loop(*if_statement.else_commands));
+                                     },
+                                     [](const ast::InlinedProcedure &procedure) {
+                                         return contains_loop(procedure.commands);
+                                     },
+                                     [](const auto &) { return false; }},
+                          command);
+    });
+}
+
+auto mirror(TokenType op) -> TokenType {
+    switch (op) {
+    case TokenType::Less:
+        return TokenType::Greater;
+    case TokenType::Greater:
+        return TokenType::Less;
+    case TokenType::LessEquals:
+        return TokenType::GreaterEquals;
+    case TokenType::GreaterEquals:
+        return TokenType::LessEquals;
+    default:
+        return op;
+    }
+}
+
+void AstOptimizer::unroll_loops_fully() {
+    for (auto &procedure : program->procedures) {
+        unroll_loops_fully(procedure.context);
+    }
+
+    unroll_loops_fully(program->main);
+}
+
+void AstOptimizer::unroll_loops_fully(ast::Context &context) {
+    track_declarations(context);
+    const auto unrolled = unrolled_loops;
+    auto constants = constant_map{};
+    context.commands = unroll_loops_fully(context.commands, constants);
+
+    // The copies are folded with the values known where they now run, and unrolled loops leave arrays indexed by
+    // numbers, which can be replaced by scalars and folded as well
+    if (unrolled_loops != unrolled) {
+        scalarize_arrays(context);
+        propagate_constants(context);
+    }
+}
+
+/// Tries every loop once, innermost first: the body of a loop is handled before the loop itself, knowing nothing about
+/// the values reaching it. `constants` only decides which loops have a known trip count, the commands that are not
+/// unrolled are left as they are and a loop that stays forgets the variables it assigns.
+auto AstOptimizer::unroll_loops_fully(const std::span<const ast::Command> commands, constant_map &constants)
+    -> std::vector<ast::Command> {
+    auto result = std::vector<ast::Command>{};
+
     for (const auto &command : commands) {
-        std::visit(overloaded{[&](const ast::Read &read) { len += 1; }, [&](const ast::Write &write) {},
-                              [&](const ast::If &if_statement) {}, [&](const ast::Repeat &repeat) {},
-                              [&](const ast::Assignment &assignment) {}, [&](const ast::While &while_statement) {},
-                              [&](const ast::Call &call) {}, [&](const ast::InlinedProcedure &procedure) {}},
+        auto rewritten = command;
+        auto constants_updated = false;
+        std::visit(overloaded{[&](ast::While &while_statement) {
+                                  auto body_constants = constant_map{};
+                                  while_statement.commands =
+                                      unroll_loops_fully(while_statement.commands, body_constants);
+                              },
+                              [&](ast::Repeat &repeat) {
+                                  auto body_constants = constant_map{};
+                                  repeat.commands = unroll_loops_fully(repeat.commands, body_constants);
+                              },
+                              [&](ast::If &if_statement) {
+                                  auto else_constants = constants;
+                                  if_statement.commands = unroll_loops_fully(if_statement.commands, constants);
+                                  if (if_statement.else_commands) {
+                                      if_statement.else_commands =
+                                          unroll_loops_fully(*if_statement.else_commands, else_constants);
+                                  }
+                                  meet(constants, else_constants);
+                                  constants_updated = true;
+                              },
+                              [&](ast::InlinedProcedure &procedure) {
+                                  procedure.commands = unroll_loops_fully(procedure.commands, constants);
+                                  constants_updated = true;
+                              },
+                              [](auto &) {}},
+                   rewritten);
+
+        if (const auto *while_statement = std::get_if<ast::While>(&rewritten)) {
+            if (auto unrolled = unroll_fully(*while_statement, constants)) {
+                for (auto &folded : *unrolled) {
+                    result.push_back(std::move(folded));
+                }
+                continue;
+            }
+        }
+
+        if (std::holds_alternative<ast::While>(rewritten) || std::holds_alternative<ast::Repeat>(rewritten)) {
+            // Forgetting what the loop may change is enough here and does not iterate over nested loops
+            auto assigned = std::unordered_set<std::string>{};
+            collect_assigned_variables(std::span(&rewritten, 1), assigned);
+            for (const auto &variable : assigned) {
+                constants.erase(variable);
+            }
+        } else if (!constants_updated) {
+            propagate_constants(std::span(&rewritten, 1), constants);
+        }
+        result.push_back(std::move(rewritten));
+    }
+
+    return result;
+}
+
+void AstOptimizer::unroll_loops() {
+    for (auto &procedure : program->procedures) {
+        unroll_loops(procedure.context);
+    }
+
+    unroll_loops(program->main);
+}
+
+void AstOptimizer::unroll_loops(ast::Context &context) {
+    track_declarations(context);
+    unroll_loops(context.commands, context.declarations);
+}
+
+/// Unrolls the innermost counted loops, loops containing other loops gain little from saving their own condition
+void AstOptimizer::unroll_loops(std::vector<ast::Command> &commands, std::vector<ast::Declaration> &declarations) {
+    auto result = std::vector<ast::Command>{};
+
+    for (auto &command : commands) {
+        std::visit(overloaded{[&](ast::While &while_statement) {
+                                  unroll_loops(while_statement.commands, declarations);
+                              },
+                              [&](ast::Repeat &repeat) { unroll_loops(repeat.commands, declarations); },
+                              [&](ast::If &if_statement) {
+                                  unroll_loops(if_statement.commands, declarations);
+                                  if (if_statement.else_commands) {
+                                      unroll_loops(*if_statement.else_commands, declarations);
+                                  }
+                              },
+                              [&](ast::InlinedProcedure &procedure) { unroll_loops(procedure.commands, declarations); },
+                              [](auto &) {}},
+                   command);
+
+        auto unrolled = std::holds_alternative<ast::While>(command)
+                            ? unroll_counted_loop(std::get<ast::While>(command), declarations)
+                            : std::nullopt;
+        if (!unrolled) {
+            result.push_back(std::move(command));
+            continue;
+        }
+        for (auto &unrolled_command : *unrolled) {
+            result.push_back(std::move(unrolled_command));
+        }
+    }
+
+    commands = std::move(result);
+}
+
+/// Unrolls `WHILE i < n DO ... i := i + s; ENDWHILE` (and its <=, > and >= forms) by a factor k into a loop that runs
+/// while k more iterations are left, followed by the original loop for the rest:
+///
+///     limit := n - (k - 1) * s;
+///     WHILE i < limit DO ... i := i + s; ... i := i + s; ENDWHILE
+///     WHILE i < n DO ... i := i + s; ENDWHILE
+///
+/// so k iterations test the condition once. The counter has to be a local scalar updated only by the last command
+/// and the bound must not change inside the loop.
+auto AstOptimizer::unroll_counted_loop(const ast::While &while_statement, std::vector<ast::Declaration> &declarations)
+    -> std::optional<std::vector<ast::Command>> {
+    const auto &body = while_statement.commands;
+    if (body.empty() || !std::holds_alternative<ast::Assignment>(body.back())) {
+        return std::nullopt;
+    }
+
+    const auto &update = std::get<ast::Assignment>(body.back());
+    const auto &counter = update.identifier;
+    if (counter.index || !tracked_scalars.contains(counter.name.lexeme) ||
+        !std::holds_alternative<ast::BinaryExpression>(update.expression)) {
+        return std::nullopt;
+    }
+
+    const auto &step_expression = std::get<ast::BinaryExpression>(update.expression);
+    const auto step_op = step_expression.op.token_type;
+    const auto step = std::holds_alternative<ast::Num>(step_expression.rhs)
+                          ? parse_constant(std::get<ast::Num>(step_expression.rhs)).value_or(0)
+                          : 0;
+    const auto is_counter = [&](const ast::Value &value) {
+        return std::holds_alternative<ast::Identifier>(value) && !std::get<ast::Identifier>(value).index &&
+               std::get<ast::Identifier>(value).name.lexeme == counter.name.lexeme;
+    };
+    if (!is_counter(step_expression.lhs) || step == 0 || step > max_unrolled_size ||
+        (step_op != TokenType::Plus && step_op != TokenType::Minus)) {
+        return std::nullopt;
+    }
+
+    // Normalize the condition to `counter op bound`
+    const auto &condition = while_statement.condition;
+    auto op = condition.op.token_type;
+    auto bound = condition.rhs;
+    if (is_counter(condition.rhs)) {
+        op = mirror(op);
+        bound = condition.lhs;
+    } else if (!is_counter(condition.lhs)) {
+        return std::nullopt;
+    }
+
+    const auto increasing = op == TokenType::Less || op == TokenType::LessEquals;
+    const auto decreasing = op == TokenType::Greater || op == TokenType::GreaterEquals;
+    if ((step_op == TokenType::Plus && !increasing) || (step_op == TokenType::Minus && !decreasing)) {
+        return std::nullopt;
+    }
+
+    const auto rest = std::span<const ast::Command>(body).first(body.size() - 1);
+    auto assigned = std::unordered_set<std::string>{};
+    collect_assigned_variables(rest, assigned);
+    if (contains_loop(rest) || assigned.contains(counter.name.lexeme)) {
+        return std::nullopt;
+    }
+
+    if (std::holds_alternative<ast::Identifier>(bound)) {
+        const auto &bound_identifier = std::get<ast::Identifier>(bound);
+        if (bound_identifier.index || is_counter(bound) || assigned.contains(bound_identifier.name.lexeme)) {
+            return std::nullopt;
+        }
+
+        // An argument may alias any other argument the loop writes to
+        const auto is_local = [&](const std::string &name) {
+            return std::ranges::any_of(declarations, [&](const auto &declaration) {
+                return declaration.identifier.lexeme == name;
+            });
+        };
+        if (!is_local(bound_identifier.name.lexeme) && !std::ranges::all_of(assigned, is_local)) {
+            return std::nullopt;
+        }
+    }
+
+    // The copies of the body replace the condition and the jump back of all but one of the iterations they cover
+    const auto body_size = std::max(calculate_commands_cost(body), 1u);
+    const auto factor = std::min(max_unroll_factor, max_unrolled_size / body_size);
+    const auto growth = factor * body_size + condition_size(condition) + 2 * value_size(bound) + 2;
+    if (factor < 2 || growth > unroll_growth_budget) {
+        return std::nullopt;
+    }
+
+    // Loops that did not run for a whole unrolled iteration on average would only pay for the extra code
+    if (profile) {
+        const auto &op = while_statement.condition.op;
+        const auto entries = profile->get_count(SourcePosition{op.line, op.column});
+        const auto iterations = profile->get_count(body.back());
+        if (entries && iterations && *iterations < factor * *entries) {
+            return std::nullopt;
+        }
+    }
+    unroll_growth_budget -= growth;
+
+    const auto distance = (factor - 1) * step;
+    const auto &origin = condition.op;
+    auto make_operator = [&](TokenType token_type, const std::string &lexeme) {
+        return Token{.token_type = token_type, .lexeme = lexeme, .line = origin.line, .column = origin.column};
+    };
+
+    auto unrolled = std::vector<ast::Command>{};
+    // i <= n becomes i < n + 1 - distance, which stays false when the subtraction saturates
+    const auto unrolled_op = op == TokenType::LessEquals ? make_operator(TokenType::Less, "<")
+                             : op == TokenType::Less     ? make_operator(TokenType::Less, "<")
+                             : op == TokenType::Greater  ? make_operator(TokenType::Greater, ">")
+                                                         : make_operator(TokenType::GreaterEquals, ">=");
+    auto unrolled_condition = ast::Condition{.lhs = counter, .op = unrolled_op, .rhs = bound};
+
+    if (std::holds_alternative<ast::Num>(bound)) {
+        const auto bound_value = parse_constant(std::get<ast::Num>(bound));
+        if (!bound_value) {
+            return std::nullopt;
+        }
+        auto limit = *bound_value + (op == TokenType::LessEquals ? 1 : 0);
+        limit = increasing ? (limit > distance ? limit - distance : 0) : limit + distance;
+        unrolled_condition.rhs = make_constant(limit, origin);
+    } else {
+        auto limit_name = make_operator(TokenType::Pidentifier, counter.name.lexeme + "#limit");
+        if (std::ranges::none_of(declarations, [&](const auto &declaration) {
+                return declaration.identifier.lexeme == limit_name.lexeme;
+            })) {
+            declarations.push_back(ast::Declaration{.identifier = limit_name, .array_size = std::nullopt});
+        }
+
+        const auto limit = ast::Identifier{.name = limit_name, .index = std::nullopt};
+        auto limit_base = bound;
+        if (op == TokenType::LessEquals) {
+            unrolled.push_back(ast::Assignment{
+                .identifier = limit,
+                .expression = ast::BinaryExpression{.lhs = bound,
+                                                    .op = make_operator(TokenType::Plus, "+"),
+                                                    .rhs = make_constant(1, origin)}});
+            limit_base = limit;
+        }
+        unrolled.push_back(ast::Assignment{
+            .identifier = limit,
+            .expression = ast::BinaryExpression{.lhs = limit_base,
+                                                .op = increasing ? make_operator(TokenType::Minus, "-")
+                                                                 : make_operator(TokenType::Plus, "+"),
+                                                .rhs = make_constant(distance, origin)}});
+        unrolled_condition.rhs = limit;
+    }
+
+    auto unrolled_loop = ast::While{.condition = unrolled_condition, .commands = {}};
+    for (auto i = 0u; i < factor; i++) {
+        unrolled_loop.commands.insert(unrolled_loop.commands.end(), body.begin(), body.end());
+    }
+    unrolled.push_back(std::move(unrolled_loop));
+    unrolled.push_back(while_statement);
+
+    unrolled_loops++;
+    return unrolled;
+}
+
+/// Calls `on_identifier` for every identifier used in the commands and `on_argument` for every argument of a call
+template <typename OnIdentifier, typename OnArgument>
+void for_each_identifier(std::span<ast::Command> commands, OnIdentifier &&on_identifier, OnArgument &&on_argument) {
+    auto on_value = [&](ast::Value &value) {
+        if (std::holds_alternative<ast::Identifier>(value)) {
+            on_identifier(std::get<ast::Identifier>(value));
+        }
+    };
+    auto on_condition = [&](ast::Condition &condition) {
+        on_value(condition.lhs);
+        on_value(condition.rhs);
+    };
+
+    for (auto &command : commands) {
+        std::visit(overloaded{[&](ast::Read &read) { on_identifier(read.identifier); },
+                              [&](ast::Write &write) { on_value(write.value); },
+                              [&](ast::If &if_statement) {
+                                  on_condition(if_statement.condition);
+                                  for_each_identifier(if_statement.commands, on_identifier, on_argument);
+                                  if (if_statement.else_commands) {
+                                      for_each_identifier(*if_statement.else_commands, on_identifier, on_argument);
+                                  }
+                              },
+                              [&](ast::Repeat &repeat) {
+                                  on_condition(repeat.condition);
+                                  for_each_identifier(repeat.commands, on_identifier, on_argument);
+                              },
+                              [&](ast::Assignment &assignment) {
+                                  on_identifier(assignment.identifier);
+                                  std::visit(overloaded{[&](ast::Value &value) { on_value(value); },
+                                                        [&](ast::BinaryExpression &binary_expression) {
+                                                            on_value(binary_expression.lhs);
+                                                            on_value(binary_expression.rhs);
+                                                        }},
+                                             assignment.expression);
+                              },
+                              [&](ast::While &while_statement) {
+                                  on_condition(while_statement.condition);
+                                  for_each_identifier(while_statement.commands, on_identifier, on_argument);
+                              },
+                              [&](ast::Call &call) {
+                                  for (auto &arg : call.args) {
+                                      on_argument(arg);
+                                  }
+                              },
+                              [&](ast::InlinedProcedure &procedure) {
+                                  for_each_identifier(procedure.commands, on_identifier, on_argument);
+                              }},
                    command);
     }
-    return len;
 }
 
-void AstOptimizer::calculate_procedure_metadata() {
-    for (const auto &procedure : program->procedures) {
-        auto cost = 0u;
-        cost += calculate_commands_cost(procedure.context.commands);
-        procedure_costs[procedure.name.lexeme] = cost;
+void AstOptimizer::scalarize_arrays() {
+    for (auto &procedure : program->procedures) {
+        scalarize_arrays(procedure.context);
     }
+
+    scalarize_arrays(program->main);
+}
+
+/// Replaces the local arrays that are only ever indexed by numbers, and never passed to a procedure, by one scalar per
+/// used element named `t[k]`, which constant propagation and the memory layout then treat like any other variable
+void AstOptimizer::scalarize_arrays(ast::Context &context) {
+    auto used_elements = std::unordered_map<std::string, std::set<uint64_t>>{};
+    for (const auto &declaration : context.declarations) {
+        if (declaration.array_size) {
+            used_elements[declaration.identifier.lexeme] = {};
+        }
+    }
+
+    auto escape = [&](const std::string &name) { used_elements.erase(name); };
+    // Named by the value of the index, `t[01]` and `t[1]` are the same element
+    auto element_name = [](const std::string &name, uint64_t offset) {
+        return name + "[" + std::to_string(offset) + "]";
+    };
+
+    for_each_identifier(
+        context.commands,
+        [&](ast::Identifier &identifier) {
+            if (!used_elements.contains(identifier.name.lexeme)) {
+                return;
+            }
+
+            const auto offset = identifier.index && identifier.index->token_type == TokenType::Num
+                                    ? parse_constant(*identifier.index)
+                                    : std::nullopt;
+            if (!offset) {
+                escape(identifier.name.lexeme);
+                return;
+            }
+            used_elements[identifier.name.lexeme].insert(*offset);
+        },
+        [&](Token &arg) { escape(arg.lexeme); });
+
+    std::erase_if(used_elements, [&](const auto &entry) { return entry.second.size() > max_scalarized_elements; });
+
+    auto declarations = std::vector<ast::Declaration>{};
+    for (const auto &declaration : context.declarations) {
+        const auto &name = declaration.identifier.lexeme;
+        const auto it = used_elements.find(name);
+        if (it == used_elements.end()) {
+            declarations.push_back(declaration);
+            continue;
+        }
+
+        const auto size = std::stoull(declaration.array_size->lexeme);
+        // Out of bounds accesses are left for the emitter to report
+        if (!it->second.empty() && *it->second.rbegin() >= size) {
+            used_elements.erase(it);
+            declarations.push_back(declaration);
+            continue;
+        }
+
+        for (const auto offset : it->second) {
+            auto element = declaration;
+            element.identifier.lexeme = element_name(name, offset);
+            element.array_size = std::nullopt;
+            declarations.push_back(element);
+        }
+    }
+
+    if (used_elements.empty()) {
+        return;
+    }
+
+    context.declarations = std::move(declarations);
+
+    for_each_identifier(
+        context.commands,
+        [&](ast::Identifier &identifier) {
+            if (used_elements.contains(identifier.name.lexeme)) {
+                identifier.name.lexeme = element_name(identifier.name.lexeme, *parse_constant(*identifier.index));
+                identifier.index = std::nullopt;
+            }
+        },
+        [](Token &) {});
+}
+
+void AstOptimizer::eliminate_common_subexpressions() {
+    for (auto &procedure : program->procedures) {
+        eliminate_common_subexpressions(procedure.context);
+    }
+
+    eliminate_common_subexpressions(program->main);
+}
+
+void AstOptimizer::eliminate_common_subexpressions(ast::Context &context) {
+    track_declarations(context);
+    auto available = value_map{};
+    context.commands = eliminate_common_subexpressions(context.commands, available);
+}
+
+/// Scalars and arrays the value is read from
+void collect_operands(const ast::Value &value, std::vector<std::string> &operands) {
+    if (std::holds_alternative<ast::Num>(value)) {
+        return;
+    }
+
+    const auto &identifier = std::get<ast::Identifier>(value);
+    operands.push_back(identifier.name.lexeme);
+    if (identifier.index && identifier.index->token_type == TokenType::Pidentifier) {
+        operands.push_back(identifier.index->lexeme);
+    }
+}
+
+auto is_array_element(const ast::Value &value) -> bool {
+    return std::holds_alternative<ast::Identifier>(value) && std::get<ast::Identifier>(value).index.has_value();
+}
+
+/// Key of the value computed by the expression, the same for both orders of the operands of + and *
+auto expression_key(const ast::BinaryExpression &expression) -> std::string {
+    auto lhs = ast::get_str(expression.lhs);
+    auto rhs = ast::get_str(expression.rhs);
+    const auto op = expression.op.token_type;
+    if ((op == TokenType::Plus || op == TokenType::Star) && rhs < lhs) {
+        std::swap(lhs, rhs);
+    }
+    return lhs + " " + expression.op.lexeme + " " + rhs;
+}
+
+/// Drops the values that writing to the variable may change. Arguments are passed by reference, so a write to one of
+/// them may change any other argument of the same kind.
+void AstOptimizer::invalidate(value_map &available, const std::string &variable) const {
+    auto is_local = [&](const std::string &name) {
+        return tracked_scalars.contains(name) || array_sizes.contains(name);
+    };
+
+    const auto local = is_local(variable);
+    std::erase_if(available, [&](const auto &entry) {
+        const auto &[holder, operands] = entry.second;
+        if (std::holds_alternative<ast::Identifier>(holder) &&
+            std::get<ast::Identifier>(holder).name.lexeme == variable) {
+            return true;
+        }
+        return std::ranges::any_of(operands, [&](const std::string &operand) {
+            return local ? operand == variable : !is_local(operand);
+        });
+    });
+}
+
+/// Keeps only the values that are available in the same place on both paths
+void meet(AstOptimizer::value_map &available, const AstOptimizer::value_map &other) {
+    std::erase_if(available, [&](const auto &entry) {
+        const auto it = other.find(entry.first);
+        return it == other.end() || ast::get_str(it->second.holder) != ast::get_str(entry.second.holder);
+    });
+}
+
+/// Value numbering over the structured control flow: expressions and array elements whose value is still held by a
+/// scalar are replaced by that scalar. `available` holds the values available on entry and is updated to the ones
+/// available on exit.
+auto AstOptimizer::eliminate_common_subexpressions(const std::span<const ast::Command> commands,
+                                                   value_map &available) -> std::vector<ast::Command> {
+    auto result = std::vector<ast::Command>{};
+
+    // The holder of the value at the position of the expression it replaces
+    auto replacement = [](const AvailableValue &available_value, const Token &origin) -> ast::Value {
+        if (std::holds_alternative<ast::Num>(available_value.holder)) {
+            auto number = std::get<ast::Num>(available_value.holder);
+            number.line = origin.line;
+            number.column = origin.column;
+            return number;
+        }
+        auto scalar = origin;
+        scalar.lexeme = std::get<ast::Identifier>(available_value.holder).name.lexeme;
+        return ast::Identifier{.name = scalar, .index = std::nullopt};
+    };
+
+    auto substitute = [&](ast::Value &value, const value_map &known) {
+        if (!is_array_element(value)) {
+            return;
+        }
+        if (const auto it = known.find(ast::get_str(value)); it != known.end()) {
+            value = replacement(it->second, std::get<ast::Identifier>(value).name);
+        }
+    };
+
+    auto substitute_condition = [&](ast::Condition &condition, const value_map &known) {
+        substitute(condition.lhs, known);
+        substitute(condition.rhs, known);
+    };
+
+    auto write = [&](const ast::Identifier &identifier, value_map &known) {
+        invalidate(known, identifier.name.lexeme);
+    };
+
+    for (const auto &command : commands) {
+        std::visit(
+            overloaded{
+                [&](const ast::Assignment &assignment) {
+                    auto replaced = assignment;
+                    const auto &target = replaced.identifier;
+
+                    auto key = std::optional<std::string>{};
+                    auto operands = std::vector<std::string>{};
+                    std::visit(overloaded{[&](ast::Value &value) {
+                                              substitute(value, available);
+                                              if (is_array_element(value)) {
+                                                  key = ast::get_str(value);
+                                                  collect_operands(value, operands);
+                                              }
+                                          },
+                                          [&](ast::BinaryExpression &expression) {
+                                              substitute(expression.lhs, available);
+                                              substitute(expression.rhs, available);
+                                              key = expression_key(expression);
+                                              collect_operands(expression.lhs, operands);
+                                              collect_operands(expression.rhs, operands);
+                                          }},
+                               replaced.expression);
+
+                    if (key && available.contains(*key)) {
+                        replaced.expression = replacement(available.at(*key), target.name);
+                    }
+
+                    // The target already holds the value
+                    if (!target.index && std::holds_alternative<ast::Value>(replaced.expression) &&
+                        ast::get_str(std::get<ast::Value>(replaced.expression)) == target.name.lexeme) {
+                        return;
+                    }
+
+                    write(target, available);
+
+                    const auto is_tracked = [&](const ast::Value &value) {
+                        return std::holds_alternative<ast::Num>(value) ||
+                               (!is_array_element(value) &&
+                                tracked_scalars.contains(std::get<ast::Identifier>(value).name.lexeme));
+                    };
+
+                    if (!target.index && tracked_scalars.contains(target.name.lexeme)) {
+                        const auto self_dependent =
+                            std::ranges::find(operands, target.name.lexeme) != operands.end();
+                        if (key && !available.contains(*key) && !self_dependent) {
+                            available[*key] = AvailableValue{.holder = target, .operands = std::move(operands)};
+                        }
+                    } else if (target.index && std::holds_alternative<ast::Value>(replaced.expression) &&
+                               is_tracked(std::get<ast::Value>(replaced.expression))) {
+                        // A load of the element just stored reuses the stored value
+                        const auto &value = std::get<ast::Value>(replaced.expression);
+                        auto element_operands = std::vector<std::string>{};
+                        collect_operands(target, element_operands);
+                        if (std::ranges::find(element_operands, ast::get_str(value)) == element_operands.end()) {
+                            collect_operands(value, element_operands);
+                            available[target.get_str()] =
+                                AvailableValue{.holder = value, .operands = std::move(element_operands)};
+                        }
+                    }
+
+                    result.push_back(std::move(replaced));
+                },
+                [&](const ast::Read &read) {
+                    write(read.identifier, available);
+                    result.push_back(read);
+                },
+                [&](const ast::Write &write_command) {
+                    auto replaced = write_command;
+                    substitute(replaced.value, available);
+                    result.push_back(replaced);
+                },
+                [&](const ast::If &if_statement) {
+                    auto replaced = if_statement;
+                    substitute_condition(replaced.condition, available);
+
+                    auto else_available = available;
+                    replaced.commands = eliminate_common_subexpressions(if_statement.commands, available);
+                    if (replaced.else_commands) {
+                        replaced.else_commands =
+                            eliminate_common_subexpressions(*if_statement.else_commands, else_available);
+                    }
+                    meet(available, else_available);
+
+                    result.push_back(replaced);
+                },
+                [&](const ast::While &while_statement) {
+                    // Only the values that no iteration changes are available at the loop head
+                    auto assigned = std::unordered_set<std::string>{};
+                    collect_assigned_variables(while_statement.commands, assigned);
+                    for (const auto &variable : assigned) {
+                        invalidate(available, variable);
+                    }
+
+                    auto replaced = while_statement;
+                    substitute_condition(replaced.condition, available);
+                    auto body_available = available;
+                    replaced.commands = eliminate_common_subexpressions(while_statement.commands, body_available);
+
+                    result.push_back(replaced);
+                },
+                [&](const ast::Repeat &repeat) {
+                    auto assigned = std::unordered_set<std::string>{};
+                    collect_assigned_variables(repeat.commands, assigned);
+                    for (const auto &variable : assigned) {
+                        invalidate(available, variable);
+                    }
+
+                    // The body runs at least once, so whatever it leaves available is available after the loop
+                    auto replaced = repeat;
+                    replaced.commands = eliminate_common_subexpressions(repeat.commands, available);
+                    substitute_condition(replaced.condition, available);
+
+                    result.push_back(replaced);
+                },
+                [&](const ast::Call &call) {
+                    // Arguments are passed by reference so the callee may overwrite any of them
+                    for (const auto &arg : call.args) {
+                        invalidate(available, arg.lexeme);
+                    }
+                    result.push_back(call);
+                },
+                [&](const ast::InlinedProcedure &procedure) {
+                    result.push_back(ast::InlinedProcedure{
+                        eliminate_common_subexpressions(procedure.commands, available), procedure.name});
+                }},
+            command);
+    }
+
+    return result;
 }
@@ -1,21 +1,107 @@
 #pragma once
 #include "ast.hpp"
 #include "common.hpp"
+#include "profile.hpp"
 #include <unordered_map>
+#include <unordered_set>
 
 class AstOptimizer {
   public:
+    using constant_map = std::unordered_map<std::string, uint64_t>;
+
+    /// Value computed earlier that is still held by a scalar (or is a known number)
+    struct AvailableValue {
+        ast::Value holder;
+        // Scalars and arrays the value was computed from
+        std::vector<std::string> operands;
+    };
+    // Available values by the expression or array element that computed them
+    using value_map = std::unordered_map<std::string, AvailableValue>;
+
+    static constexpr uint64_t default_evaluation_budget = 1'000'000;
+    // Upper bound on the WRITEs and assignments that may replace the evaluated part of main
+    static constexpr uint64_t max_evaluated_commands = 4096;
+    // Arrays with more distinct elements used than this are kept in memory
+    static constexpr uint64_t max_scalarized_elements = 32;
+    // Instructions that inlining may add to the program on top of the bodies of procedures called only once
+    static constexpr uint64_t default_inline_growth_budget = 8192;
+    // Loops whose trip count is known are replaced by copies of their body up to this many iterations
+    static constexpr uint64_t max_unrolled_iterations = 16;
+    // Upper bound on the instructions of a fully unrolled loop and of the unrolled body of a counted loop
+    static constexpr uint64_t max_unrolled_size = 256;
+    static constexpr uint64_t max_unroll_factor = 4;
+    // Instructions that partial unrolling may add to the program
+    static constexpr uint64_t default_unroll_growth_budget = 2048;
+    // Instructions of the copies that full unrolling may fold in total, whether the loops end up unrolled or not
+    static constexpr uint64_t default_full_unroll_budget = 65536;
+
+    struct CallSite {
+        ast::Command *command;
+        uint64_t frequency;
+    };
+
     AstOptimizer() = delete;
-    AstOptimizer(ast::Program *program) : program(program) {}
+    AstOptimizer(ast::Program *program, const Profile *profile = nullptr) : program(program), profile(profile) {}
 
-    void calculate_procedure_call_counts_helper(const std::span<const ast::Command> commands);
+    void calculate_procedure_call_counts_helper(const std::span<const ast::Command> commands,
+                                                std::unordered_set<std::string> &callees);
     void calculate_procedure_call_counts();
+    /// Estimated number of instructions the emitter produces for the commands
     auto calculate_commands_cost(const std::span<const ast::Command> commands) -> unsigned;
-    void calculate_procedure_metadata();
+    void calculate_procedure_metadata(const ast::Procedure &procedure);
+
     void inline_procedures();
+    auto inline_calls(ast::Context &context) -> bool;
+    auto inline_call(const ast::Call &call, std::vector<ast::Declaration> &declarations) -> ast::InlinedProcedure;
+    void remove_unused_procedures();
+
+    void track_declarations(const ast::Context &context);
+
+    void scalarize_arrays();
+    void scalarize_arrays(ast::Context &context);
+
+    void evaluate_constant_prefix(uint64_t step_budget = default_evaluation_budget);
+
+    void propagate_constants();
+    void propagate_constants(ast::Context &context);
+    auto propagate_constants(const std::span<const ast::Command> commands, constant_map &constants)
+        -> std::vector<ast::Command>;
+
+    /// Replaces the loops whose trip count is known by a folded copy of their body per iteration
+    void unroll_loops_fully();
+    void unroll_loops_fully(ast::Context &context);
+    auto unroll_loops_fully(const std::span<const ast::Command> commands, constant_map &constants)
+        -> std::vector<ast::Command>;
+    auto unroll_fully(const ast::While &while_statement, constant_map &constants)
+        -> std::optional<std::vector<ast::Command>>;
+
+    void unroll_loops();
+    void unroll_loops(ast::Context &context);
+    void unroll_loops(std::vector<ast::Command> &commands, std::vector<ast::Declaration> &declarations);
+    auto unroll_counted_loop(const ast::While &while_statement, std::vector<ast::Declaration> &declarations)
+        -> std::optional<std::vector<ast::Command>>;
+
+    void eliminate_common_subexpressions();
+    void eliminate_common_subexpressions(ast::Context &context);
+    auto eliminate_common_subexpressions(const std::span<const ast::Command> commands, value_map &available)
+        -> std::vector<ast::Command>;
+    void invalidate(value_map &available, const std::string &variable) const;
 
     std::unordered_map<std::string, ast::Procedure *> procedures;
+    std::unordered_map<std::string, std::unordered_set<std::string>> call_graph;
     std::unordered_map<std::string, unsigned> procedure_call_counts;
     std::unordered_map<std::string, unsigned> procedure_costs;
+    // Runtime cost saved by every call that is replaced by the body of the procedure
+    std::unordered_map<std::string, uint64_t> procedure_call_savings;
+    uint64_t inline_growth_budget = default_inline_growth_budget;
+    uint64_t unroll_growth_budget = default_unroll_growth_budget;
+    uint64_t full_unroll_budget = default_full_unroll_budget;
+    uint64_t unrolled_loops = 0;
+
+    // Scalars of the context currently being folded, procedure arguments are left out since they may alias
+    std::unordered_set<std::string> tracked_scalars;
+    std::unordered_map<std::string, uint64_t> array_sizes;
     ast::Program *program;
+    // Execution counts replacing the loop based estimates of how often the commands run
+    const Profile *profile;
 };
@@ -90,6 +90,8 @@ using Command = std::variant<Assignment, Read, Write, While, Call, If, Repeat, I
 
 struct InlinedProcedure {
     std::vector<Command> commands;
+    // Name of the procedure at the call that was replaced
+    Token name;
 };
 
 struct While {
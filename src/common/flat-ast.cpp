@@ -0,0 +1,432 @@
+#include "flat-ast.hpp"
+#include "common.hpp"
+#include <algorithm>
+#include <ranges>
+#include <span>
+#include <string>
+#include <unordered_map>
+
+namespace ast::flat {
+
+namespace {
+
+auto operator_lexeme(TokenType token_type) -> std::string {
+    switch (token_type) {
+    case Plus:
+        return "+";
+    case Minus:
+        return "-";
+    case Star:
+        return "*";
+    case Slash:
+        return "/";
+    case Percent:
+        return "%";
+    case Equals:
+        return "=";
+    case BangEquals:
+        return "!=";
+    case Greater:
+        return ">";
+    case GreaterEquals:
+        return ">=";
+    case Less:
+        return "<";
+    case LessEquals:
+        return "<=";
+    default:
+        return to_string(token_type);
+    }
+}
+
+auto position_of(const Token &token) -> Position { return {token.line, token.column}; }
+
+auto size_of(size_t size) -> Index { return static_cast<Index>(size); }
+
+class Flattener {
+  public:
+    explicit Flattener(Program &program) : program(program) {}
+
+    auto flatten_context(const ast::Context &context) -> Context {
+        auto declarations = Range{size_of(program.declarations.size()), size_of(context.declarations.size())};
+        for (const auto &declaration : context.declarations) {
+            auto flat = Declaration{intern(declaration.identifier), std::nullopt, position_of(declaration.identifier)};
+            if (declaration.array_size) {
+                flat.array_size = intern(*declaration.array_size);
+                flat.size_position = position_of(*declaration.array_size);
+            }
+            program.declarations.push_back(flat);
+        }
+        return {declarations, flatten_commands(context.commands)};
+    }
+
+    auto flatten_procedure(const ast::Procedure &procedure) -> Procedure {
+        auto parameters = Range{size_of(program.parameters.size()), size_of(procedure.args.size())};
+        for (const auto &arg : procedure.args) {
+            program.parameters.push_back({intern(arg.identifier), arg.is_array, position_of(arg.identifier)});
+        }
+        const auto context = flatten_context(procedure.context);
+        return {intern(procedure.name), position_of(procedure.name), parameters, context};
+    }
+
+  private:
+    Program &program;
+
+    auto intern(const Token &token) -> Symbol { return program.symbols.intern(token.lexeme); }
+
+    /// Slots for the whole block are taken first so the commands stay consecutive, their children go after them
+    auto flatten_commands(const std::vector<ast::Command> &commands) -> Range {
+        const auto range = Range{size_of(program.commands.size()), size_of(commands.size())};
+        program.commands.resize(range.end(), Command{Command::Kind::Assignment});
+        for (auto i = 0u; i < commands.size(); i++) {
+            const auto command = flatten_command(commands[i]);
+            program.commands[range.begin + i] = command;
+        }
+        return range;
+    }
+
+    auto flatten_command(const ast::Command &command) -> Command {
+        using Kind = Command::Kind;
+        return std::visit(
+            overloaded{
+                [&](const ast::Assignment &assignment) {
+                    auto flat = Command{Kind::Assignment, flatten_identifier(assignment.identifier)};
+                    flat.expression = flatten_expression(assignment.expression);
+                    flat.position = position_of(assignment.identifier.name);
+                    return flat;
+                },
+                [&](const ast::Read &read) {
+                    auto flat = Command{Kind::Read, flatten_identifier(read.identifier)};
+                    flat.position = position_of(read.identifier.name);
+                    return flat;
+                },
+                [&](const ast::Write &write) { return Command{Kind::Write, flatten_value(write.value)}; },
+                [&](const ast::If &if_statement) {
+                    auto flat = Command{Kind::If, flatten_condition(if_statement.condition)};
+                    flat.body = flatten_commands(if_statement.commands);
+                    if (if_statement.else_commands) {
+                        flat.else_body = flatten_commands(*if_statement.else_commands);
+                    }
+                    return flat;
+                },
+                [&](const ast::While &while_statement) {
+                    auto flat = Command{Kind::While, flatten_condition(while_statement.condition)};
+                    flat.body = flatten_commands(while_statement.commands);
+                    return flat;
+                },
+                [&](const ast::Repeat &repeat) {
+                    auto flat = Command{Kind::Repeat, flatten_condition(repeat.condition)};
+                    flat.body = flatten_commands(repeat.commands);
+                    return flat;
+                },
+                [&](const ast::Call &call) {
+                    auto flat = Command{Kind::Call};
+                    flat.name = intern(call.name);
+                    flat.position = position_of(call.name);
+                    flat.arguments = Range{size_of(program.arguments.size()), size_of(call.args.size())};
+                    for (const auto &arg : call.args) {
+                        program.arguments.push_back({intern(arg), position_of(arg)});
+                    }
+                    return flat;
+                },
+                [&](const ast::InlinedProcedure &procedure) {
+                    auto flat = Command{Kind::Inlined};
+                    flat.name = intern(procedure.name);
+                    flat.position = position_of(procedure.name);
+                    flat.body = flatten_commands(procedure.commands);
+                    return flat;
+                }},
+            command);
+    }
+
+    auto flatten_identifier(const ast::Identifier &identifier) -> Index {
+        auto value = Value{Value::Kind::Scalar, intern(identifier.name), 0, position_of(identifier.name)};
+        if (identifier.index) {
+            value.kind = identifier.index->token_type == TokenType::Num ? Value::Kind::ElementByNumber
+                                                                         : Value::Kind::Element;
+            value.index = intern(*identifier.index);
+            value.index_position = position_of(*identifier.index);
+        }
+        program.values.push_back(value);
+        return size_of(program.values.size() - 1);
+    }
+
+    auto flatten_value(const ast::Value &value) -> Index {
+        if (std::holds_alternative<ast::Identifier>(value)) {
+            return flatten_identifier(std::get<ast::Identifier>(value));
+        }
+        const auto &number = std::get<ast::Num>(value);
+        program.values.push_back({Value::Kind::Number, intern(number), 0, position_of(number)});
+        return size_of(program.values.size() - 1);
+    }
+
+    auto flatten_expression(const ast::Expression &expression) -> Index {
+        if (std::holds_alternative<ast::Value>(expression)) {
+            program.expressions.push_back({flatten_value(std::get<ast::Value>(expression)), std::nullopt});
+        } else {
+            const auto &binary = std::get<ast::BinaryExpression>(expression);
+            const auto lhs = flatten_value(binary.lhs);
+            const auto rhs = flatten_value(binary.rhs);
+            program.expressions.push_back({lhs, binary.op.token_type, rhs, position_of(binary.op)});
+        }
+        return size_of(program.expressions.size() - 1);
+    }
+
+    auto flatten_condition(const ast::Condition &condition) -> Index {
+        const auto lhs = flatten_value(condition.lhs);
+        const auto rhs = flatten_value(condition.rhs);
+        program.conditions.push_back({lhs, condition.op.token_type, rhs, position_of(condition.op)});
+        return size_of(program.conditions.size() - 1);
+    }
+};
+
+/// Names of the procedure bodies being expanded, mapped to the names they have at the call site
+using Renaming = std::unordered_map<std::string, std::string>;
+
+auto call_signature(const Program &program, const Command &command) -> std::string;
+
+class Expander {
+  public:
+    explicit Expander(const Program &program) : program(program) {}
+
+    auto expand_context(const Context &context) -> ast::Context {
+        auto result = ast::Context{};
+        for (auto i = context.declarations.begin; i < context.declarations.end(); i++) {
+            const auto &declaration = program.declarations[i];
+            auto expanded = ast::Declaration{name_token(declaration.name, declaration.position), std::nullopt};
+            if (declaration.array_size) {
+                expanded.array_size = number_token(*declaration.array_size, declaration.size_position);
+            }
+            result.declarations.push_back(std::move(expanded));
+        }
+        result.commands = expand_commands(context.body);
+        return result;
+    }
+
+    auto expand_procedure(const Procedure &procedure) -> ast::Procedure {
+        auto result = ast::Procedure{procedure_token(procedure.name, procedure.position), {}, {}};
+        for (auto i = procedure.parameters.begin; i < procedure.parameters.end(); i++) {
+            const auto &parameter = program.parameters[i];
+            result.args.push_back({name_token(parameter.name, parameter.position), parameter.is_array});
+        }
+        result.context = expand_context(procedure.context);
+        return result;
+    }
+
+  private:
+    const Program &program;
+    // Innermost inlined call last
+    std::vector<Renaming> renamings{};
+
+    auto rename(Symbol symbol) const -> std::string {
+        auto name = program.symbols.name(symbol);
+        for (const auto &renaming : renamings | std::views::reverse) {
+            if (const auto it = renaming.find(name); it != renaming.end()) {
+                name = it->second;
+            }
+        }
+        return name;
+    }
+
+    auto name_token(Symbol symbol, Position position) const -> Token {
+        return Token{TokenType::Pidentifier, rename(symbol), position.line, position.column};
+    }
+
+    /// Procedure names are never renamed by inlining
+    auto procedure_token(Symbol symbol, Position position) const -> Token {
+        return Token{TokenType::Pidentifier, program.symbols.name(symbol), position.line, position.column};
+    }
+
+    auto number_token(Symbol symbol, Position position) const -> Token {
+        return Token{TokenType::Num, program.symbols.name(symbol), position.line, position.column};
+    }
+
+    auto expand_commands(Range range) -> std::vector<ast::Command> {
+        auto commands = std::vector<ast::Command>{};
+        commands.reserve(range.size);
+        for (auto i = range.begin; i < range.end(); i++) {
+            commands.push_back(expand_command(program.commands[i]));
+        }
+        return commands;
+    }
+
+    auto expand_command(const Command &command) -> ast::Command {
+        using Kind = Command::Kind;
+        switch (command.kind) {
+        case Kind::Assignment:
+            return ast::Assignment{expand_identifier(command.operand), expand_expression(command.expression)};
+        case Kind::Read:
+            return ast::Read{expand_identifier(command.operand)};
+        case Kind::Write:
+            return ast::Write{expand_value(command.operand)};
+        case Kind::If: {
+            auto if_statement = ast::If{expand_condition(command.operand), expand_commands(command.body), std::nullopt};
+            if (command.else_body) {
+                if_statement.else_commands = expand_commands(*command.else_body);
+            }
+            return if_statement;
+        }
+        case Kind::While:
+            return ast::While{expand_condition(command.operand), expand_commands(command.body)};
+        case Kind::Repeat: {
+            auto commands = expand_commands(command.body);
+            return ast::Repeat{std::move(commands), expand_condition(command.operand)};
+        }
+        case Kind::Call: {
+            auto call = ast::Call{procedure_token(command.name, command.position), {}};
+            for (auto i = command.arguments.begin; i < command.arguments.end(); i++) {
+                const auto &argument = program.arguments[i];
+                call.args.push_back(name_token(argument.name, argument.position));
+            }
+            return call;
+        }
+        case Kind::Inlined:
+            return ast::InlinedProcedure{expand_commands(command.body),
+                                         procedure_token(command.name, command.position)};
+        case Kind::InlinedCall:
+            return expand_inlined_call(command);
+        }
+        assert(false && "Unreachable");
+        return ast::Write{};
+    }
+
+    /// The shared body gets the names `AstOptimizer::inline_call` would give it
+    auto expand_inlined_call(const Command &command) -> ast::InlinedProcedure {
+        const auto &callee = *program.find_procedure(command.name);
+        const auto signature = call_signature(program, command);
+
+        auto renaming = Renaming{};
+        for (auto i = 0u; i < callee.parameters.size; i++) {
+            renaming[program.symbols.name(program.parameters[callee.parameters.begin + i].name)] =
+                program.symbols.name(program.arguments[command.arguments.begin + i].name);
+        }
+        for (auto i = callee.context.declarations.begin; i < callee.context.declarations.end(); i++) {
+            const auto &name = program.symbols.name(program.declarations[i].name);
+            renaming[name] = name + "@" + signature;
+        }
+
+        auto name = procedure_token(command.name, command.position);
+        renamings.push_back(std::move(renaming));
+        auto commands = expand_commands(callee.context.body);
+        renamings.pop_back();
+
+        return ast::InlinedProcedure{std::move(commands), std::move(name)};
+    }
+
+    auto expand_identifier(Index index) -> ast::Identifier {
+        const auto &value = program.values[index];
+        auto identifier = ast::Identifier{name_token(value.name, value.position), std::nullopt};
+        if (value.kind == Value::Kind::Element) {
+            identifier.index = name_token(value.index, value.index_position);
+        } else if (value.kind == Value::Kind::ElementByNumber) {
+            identifier.index = number_token(value.index, value.index_position);
+        }
+        return identifier;
+    }
+
+    auto expand_value(Index index) -> ast::Value {
+        const auto &value = program.values[index];
+        if (value.kind == Value::Kind::Number) {
+            return number_token(value.name, value.position);
+        }
+        return expand_identifier(index);
+    }
+
+    auto expand_expression(Index index) -> ast::Expression {
+        const auto &expression = program.expressions[index];
+        if (!expression.op) {
+            return expand_value(expression.lhs);
+        }
+        const auto op = Token{*expression.op, operator_lexeme(*expression.op), expression.op_position.line,
+                              expression.op_position.column};
+        return ast::BinaryExpression{expand_value(expression.lhs), op, expand_value(expression.rhs)};
+    }
+
+    auto expand_condition(Index index) -> ast::Condition {
+        const auto &condition = program.conditions[index];
+        const auto op = Token{condition.op, operator_lexeme(condition.op), condition.op_position.line,
+                              condition.op_position.column};
+        return ast::Condition{expand_value(condition.lhs), op, expand_value(condition.rhs)};
+    }
+
+};
+
+/// Same as `ast::Call::signature`, from the names written at the call
+auto call_signature(const Program &program, const Command &command) -> std::string {
+    auto result = program.symbols.name(command.name) + "(";
+    for (auto i = command.arguments.begin; i < command.arguments.end(); i++) {
+        result += program.symbols.name(program.arguments[i].name);
+        result += i + 1 < command.arguments.end() ? ", " : "";
+    }
+    return result + ")";
+}
+
+} // namespace
+
+auto Program::find_procedure(Symbol name) const -> const Procedure * {
+    const auto it = std::ranges::find(procedures, name, &Procedure::name);
+    return it == procedures.end() ? nullptr : &*it;
+}
+
+auto Program::node_count() const -> size_t {
+    return values.size() + expressions.size() + conditions.size() + commands.size() + arguments.size() +
+           declarations.size() + parameters.size() + procedures.size();
+}
+
+auto Program::inline_call(Index command_index, Context &caller) -> bool {
+    auto &command = commands[command_index];
+    const auto *callee = find_procedure(command.name);
+    if (command.kind != Command::Kind::Call || callee == nullptr || callee->parameters.size != command.arguments.size) {
+        return false;
+    }
+
+    // The renamed locals join the declarations of the caller, which have to be the last ones in the arena to grow
+    if (caller.declarations.end() != declarations.size()) {
+        const auto begin = size_of(declarations.size());
+        for (auto i = caller.declarations.begin; i < caller.declarations.end(); i++) {
+            declarations.push_back(declarations[i]);
+        }
+        caller.declarations.begin = begin;
+    }
+
+    const auto signature = call_signature(*this, command);
+    for (auto i = callee->context.declarations.begin; i < callee->context.declarations.end(); i++) {
+        auto declaration = declarations[i];
+        declaration.name = symbols.intern(symbols.name(declaration.name) + "@" + signature);
+
+        // Copies inlined with the same arguments share their locals, just like consecutive calls share the frame
+        const auto declared = std::span(declarations).subspan(caller.declarations.begin);
+        if (std::ranges::find(declared, declaration.name, &Declaration::name) == declared.end()) {
+            declarations.push_back(declaration);
+            caller.declarations.size++;
+        }
+    }
+
+    command.kind = Command::Kind::InlinedCall;
+    command.body = callee->context.body;
+    return true;
+}
+
+auto flatten(const ast::Program &program) -> Program {
+    auto result = Program{};
+    auto flattener = Flattener(result);
+    for (const auto &procedure : program.procedures) {
+        // Every procedure is pushed before the next one is flattened, `flatten_procedure` only appends to the arenas
+        auto flat = flattener.flatten_procedure(procedure);
+        result.procedures.push_back(flat);
+    }
+    result.main = flattener.flatten_context(program.main);
+    return result;
+}
+
+auto expand(const Program &program) -> ast::Program {
+    auto result = ast::Program{};
+    auto expander = Expander(program);
+    for (const auto &procedure : program.procedures) {
+        result.procedures.push_back(expander.expand_procedure(procedure));
+    }
+    result.main = expander.expand_context(program.main);
+    return result;
+}
+
+} // namespace ast::flat
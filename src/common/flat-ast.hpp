@@ -0,0 +1,130 @@
+#pragma once
+
+#include "ast.hpp"
+#include "interner.hpp"
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+/// Alternative layout of the AST. The nodes of every kind live in one contiguous arena and refer to each other by
+/// 32-bit indices, the children of a command are a range of consecutive commands. Names are interned symbols.
+namespace ast::flat {
+
+using Index = uint32_t;
+
+/// Consecutive entries of an arena
+struct Range {
+    Index begin = 0;
+    Index size = 0;
+
+    auto end() const -> Index { return begin + size; }
+    auto operator==(const Range &other) const -> bool = default;
+};
+
+struct Position {
+    unsigned line = 0;
+    unsigned column = 0;
+};
+
+struct Value {
+    enum class Kind : uint8_t { Number, Scalar, Element, ElementByNumber };
+
+    Kind kind;
+    // Digits of a number, name of a scalar or an array
+    Symbol name;
+    // Variable or digits indexing an array
+    Symbol index = 0;
+    Position position{};
+    Position index_position{};
+};
+
+/// A single value when `op` is nullopt, `rhs` is unused then
+struct Expression {
+    Index lhs;
+    std::optional<TokenType> op;
+    Index rhs = 0;
+    Position op_position{};
+};
+
+struct Condition {
+    Index lhs;
+    TokenType op;
+    Index rhs;
+    Position op_position{};
+};
+
+struct Argument {
+    Symbol name;
+    Position position{};
+};
+
+struct Command {
+    // Inlined commands have their own copy of the body, an inlined call refers to the body of the procedure and
+    // renames its names on the fly
+    enum class Kind : uint8_t { Assignment, Read, Write, If, While, Repeat, Call, Inlined, InlinedCall };
+
+    Kind kind;
+    // Target of assignments and READs, value of WRITEs, condition of IFs and loops
+    Index operand = 0;
+    // Expression of assignments
+    Index expression = 0;
+    Range body{};
+    std::optional<Range> else_body{};
+    // Procedure that is called or inlined
+    Symbol name = 0;
+    Position position{};
+    Range arguments{};
+};
+
+struct Declaration {
+    Symbol name;
+    std::optional<Symbol> array_size{};
+    Position position{};
+    Position size_position{};
+};
+
+struct Parameter {
+    Symbol name;
+    bool is_array;
+    Position position{};
+};
+
+struct Context {
+    Range declarations{};
+    Range body{};
+};
+
+struct Procedure {
+    Symbol name;
+    Position position{};
+    Range parameters{};
+    Context context{};
+};
+
+struct Program {
+    Interner symbols{};
+
+    std::vector<Value> values{};
+    std::vector<Expression> expressions{};
+    std::vector<Condition> conditions{};
+    std::vector<Command> commands{};
+    std::vector<Argument> arguments{};
+    std::vector<Declaration> declarations{};
+    std::vector<Parameter> parameters{};
+    std::vector<Procedure> procedures{};
+    Context main{};
+
+    auto find_procedure(Symbol name) const -> const Procedure *;
+    auto node_count() const -> size_t;
+
+    /// Replaces the call by a reference to the body of the procedure without copying it. The locals of the procedure
+    /// are declared in the caller under the same names `AstOptimizer::inline_call` gives them. False if the command is
+    /// not a call of a known procedure.
+    auto inline_call(Index command, Context &caller) -> bool;
+};
+
+auto flatten(const ast::Program &program) -> Program;
+/// Tree form of the program, inlined calls get their own renamed copy of the body
+auto expand(const Program &program) -> ast::Program;
+
+} // namespace ast::flat
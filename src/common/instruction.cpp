@@ -136,4 +136,14 @@ auto mnemonic_from_string(const std::string &instruction) -> std::optional<Instr
     return std::nullopt;
 }
 
+auto cost(const Instruction &instruction) -> uint64_t {
+    if (std::holds_alternative<Load>(instruction) || std::holds_alternative<Store>(instruction)) {
+        return 50;
+    }
+    if (std::holds_alternative<Add>(instruction) || std::holds_alternative<Sub>(instruction)) {
+        return 5;
+    }
+    return 1;
+}
+
 } // namespace instruction
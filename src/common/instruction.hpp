@@ -87,6 +87,8 @@ auto to_string(const Instruction &instruction) -> std::string;
 auto mnemonic_from_string(const std::string &instruction) -> std::optional<Instruction>;
 void set_jump_location(Instruction &instruction, uint64_t location);
 void set_instruction_register(Instruction &instruction, Register reg);
+/// Cycles the machine takes to execute the instruction
+auto cost(const Instruction &instruction) -> uint64_t;
 
 struct Line {
     Instruction instruction;
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+using Symbol = uint32_t;
+
+/// Keeps one copy of every name, symbols are dense indices that compare and hash as integers
+class Interner {
+  public:
+    auto intern(std::string_view name) -> Symbol {
+        if (const auto it = symbols.find(name); it != symbols.end()) {
+            return it->second;
+        }
+        const auto symbol = static_cast<Symbol>(names.size());
+        // A deque never moves its elements, so the views used as keys stay valid
+        const auto &stored = names.emplace_back(name);
+        symbols.emplace(stored, symbol);
+        return symbol;
+    }
+
+    /// Symbol of a name interned before, without adding it
+    auto find(std::string_view name) const -> std::optional<Symbol> {
+        if (const auto it = symbols.find(name); it != symbols.end()) {
+            return it->second;
+        }
+        return std::nullopt;
+    }
+
+    auto name(Symbol symbol) const -> const std::string & { return names[symbol]; }
+    auto size() const -> size_t { return names.size(); }
+
+  private:
+    std::deque<std::string> names{};
+    std::unordered_map<std::string_view, Symbol> symbols{};
+};
@@ -0,0 +1,80 @@
+#include "phase-report.hpp"
+#include <atomic>
+#include <format>
+#include <sys/resource.h>
+
+namespace {
+
+std::atomic<uint64_t> allocations{0};
+
+} // namespace
+
+void count_allocation() { allocations.fetch_add(1, std::memory_order_relaxed); }
+
+auto allocation_count() -> uint64_t { return allocations.load(std::memory_order_relaxed); }
+
+auto peak_rss_kib() -> uint64_t {
+    auto usage = rusage{};
+    getrusage(RUSAGE_SELF, &usage);
+    // Linux reports kilobytes
+    return static_cast<uint64_t>(usage.ru_maxrss);
+}
+
+void PhaseReport::begin(const std::string &name) {
+    phases.push_back(PhaseStats{name});
+    start_rss_kib = peak_rss_kib();
+    start_allocations = allocation_count();
+    start = std::chrono::steady_clock::now();
+}
+
+void PhaseReport::end() {
+    auto &phase = phases.back();
+    phase.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    phase.allocations = allocation_count() - start_allocations;
+    phase.peak_rss_growth_kib = peak_rss_kib() - start_rss_kib;
+}
+
+void PhaseReport::record(const std::string &output, uint64_t value) {
+    phases.back().outputs.emplace_back(output, value);
+}
+
+void PhaseReport::write_table(std::ostream &output) const {
+    auto total = PhaseStats{"total"};
+    for (const auto &phase : phases) {
+        total.seconds += phase.seconds;
+        total.allocations += phase.allocations;
+        total.peak_rss_growth_kib += phase.peak_rss_growth_kib;
+    }
+
+    output << std::format("{:<34} {:>10} {:>7} {:>12} {:>12}  {}\n", "phase", "wall ms", "%", "allocations",
+                          "peak RSS +KiB", "outputs");
+    for (const auto &phase : phases) {
+        auto outputs = std::string{};
+        for (const auto &[name, value] : phase.outputs) {
+            outputs += std::format("{}{}={}", outputs.empty() ? "" : " ", name, value);
+        }
+        const auto share = total.seconds > 0 ? 100.0 * phase.seconds / total.seconds : 0.0;
+        output << std::format("{:<34} {:>10.3f} {:>7.1f} {:>12} {:>12}", phase.name, phase.seconds * 1000.0, share,
+                              phase.allocations, phase.peak_rss_growth_kib)
+               << (outputs.empty() ? "" : "  ") << outputs << '\n';
+    }
+    output << std::format("{:<34} {:>10.3f} {:>7.1f} {:>12} {:>12}\n", total.name, total.seconds * 1000.0, 100.0,
+                          total.allocations, total.peak_rss_growth_kib);
+}
+
+void PhaseReport::write_json(std::ostream &output) const {
+    // Names of phases and outputs are plain identifiers, nothing needs escaping
+    output << "{\"phases\": [";
+    for (auto i = 0u; i < phases.size(); i++) {
+        const auto &phase = phases[i];
+        output << (i > 0 ? ", " : "")
+               << std::format("{{\"name\": \"{}\", \"seconds\": {}, \"allocations\": {}, \"peak_rss_growth_kib\": {}, "
+                              "\"outputs\": {{",
+                              phase.name, phase.seconds, phase.allocations, phase.peak_rss_growth_kib);
+        for (auto j = 0u; j < phase.outputs.size(); j++) {
+            output << std::format("{}\"{}\": {}", j > 0 ? ", " : "", phase.outputs[j].first, phase.outputs[j].second);
+        }
+        output << "}}";
+    }
+    output << "]}\n";
+}
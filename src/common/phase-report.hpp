@@ -0,0 +1,45 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+/// Heap allocations made by the process so far, by every thread, as counted by `count_allocation`. Only the compiler
+/// executable replaces the global operator new to call it, elsewhere the count stays 0.
+auto allocation_count() -> uint64_t;
+void count_allocation();
+/// Peak resident set size of the process in KiB
+auto peak_rss_kib() -> uint64_t;
+
+struct PhaseStats {
+    std::string name;
+    double seconds = 0;
+    // Growth of the peak resident set size while the phase ran
+    uint64_t peak_rss_growth_kib = 0;
+    uint64_t allocations = 0;
+    // Sizes of what the phase produced, e.g. tokens, AST nodes or emitted lines
+    std::vector<std::pair<std::string, uint64_t>> outputs{};
+};
+
+/// Where the compile time and memory go, phase by phase, in the spirit of -ftime-report
+class PhaseReport {
+  public:
+    void begin(const std::string &name);
+    void end();
+    /// Adds a size to the phase that ended last
+    void record(const std::string &output, uint64_t value);
+
+    auto get_phases() const -> const std::vector<PhaseStats> & { return phases; }
+
+    void write_table(std::ostream &output) const;
+    void write_json(std::ostream &output) const;
+
+  private:
+    std::vector<PhaseStats> phases{};
+    std::chrono::steady_clock::time_point start{};
+    uint64_t start_rss_kib = 0;
+    uint64_t start_allocations = 0;
+};
@@ -0,0 +1,87 @@
+#include "profile.hpp"
+#include "common.hpp"
+#include <sstream>
+#include <string>
+
+auto statement_position(const ast::Command &command) -> std::optional<SourcePosition> {
+    const auto token = std::visit(
+        overloaded{[](const ast::Assignment &assignment) -> std::optional<Token> { return assignment.identifier.name; },
+                   [](const ast::Read &read) -> std::optional<Token> { return read.identifier.name; },
+                   [](const ast::Write &write) -> std::optional<Token> {
+                       if (std::holds_alternative<ast::Num>(write.value)) {
+                           return std::get<ast::Num>(write.value);
+                       }
+                       return std::get<ast::Identifier>(write.value).name;
+                   },
+                   [](const ast::If &if_statement) -> std::optional<Token> { return if_statement.condition.op; },
+                   [](const ast::While &while_statement) -> std::optional<Token> {
+                       return while_statement.condition.op;
+                   },
+                   [](const ast::Repeat &repeat) -> std::optional<Token> { return repeat.condition.op; },
+                   [](const ast::Call &call) -> std::optional<Token> { return call.name; },
+                   [](const ast::InlinedProcedure &procedure) -> std::optional<Token> { return procedure.name; }},
+        command);
+
+    // Commands made up by the optimizer are placed at line 0
+    if (!token || token->line == 0) {
+        return std::nullopt;
+    }
+    return SourcePosition{token->line, token->column};
+}
+
+auto Profile::from_line_counts(const std::vector<std::pair<SourcePosition, uint64_t>> &statement_lines,
+                               const std::vector<uint64_t> &line_counts) -> Profile {
+    auto profile = Profile{};
+    for (const auto &[position, line] : statement_lines) {
+        profile.counts[position] += line < line_counts.size() ? line_counts[line] : 0;
+    }
+    return profile;
+}
+
+auto Profile::read(std::istream &input) -> std::optional<Profile> {
+    auto profile = Profile{};
+    auto line = std::string{};
+    while (std::getline(input, line)) {
+        if (line.empty() || line.starts_with('#')) {
+            continue;
+        }
+
+        auto fields = std::istringstream(line);
+        auto position = SourcePosition{};
+        auto count = uint64_t{0};
+        if (!(fields >> position.first >> position.second >> count)) {
+            return std::nullopt;
+        }
+        profile.counts[position] += count;
+    }
+    return profile;
+}
+
+void Profile::write(std::ostream &output) const {
+    output << "# line column count" << std::endl;
+    for (const auto &[position, count] : counts) {
+        output << position.first << ' ' << position.second << ' ' << count << std::endl;
+    }
+}
+
+void Profile::merge(const Profile &other) {
+    for (const auto &[position, count] : other.counts) {
+        counts[position] += count;
+    }
+}
+
+auto Profile::get_count(const ast::Command &command) const -> std::optional<uint64_t> {
+    const auto position = statement_position(command);
+    if (!position) {
+        return std::nullopt;
+    }
+    return get_count(*position);
+}
+
+auto Profile::get_count(const SourcePosition &position) const -> std::optional<uint64_t> {
+    const auto it = counts.find(position);
+    if (it == counts.end()) {
+        return std::nullopt;
+    }
+    return it->second;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "ast.hpp"
+#include <cstdint>
+#include <istream>
+#include <map>
+#include <optional>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+/// Line and column of a token in the source
+using SourcePosition = std::pair<unsigned, unsigned>;
+
+/// Position of the token a statement starts with, inlined procedures take the position of their call. Nullopt for
+/// commands that do not come from the source.
+auto statement_position(const ast::Command &command) -> std::optional<SourcePosition>;
+
+/// How many times every statement ran on the training inputs. Statements are keyed by their source position and the
+/// copies the optimizer makes of them (inlined, unrolled, specialized) keep it, so the counts of all copies add up.
+class Profile {
+  public:
+    /// Counts of the first line of every statement, `statement_lines` pairs statements with their first line
+    static auto from_line_counts(const std::vector<std::pair<SourcePosition, uint64_t>> &statement_lines,
+                                 const std::vector<uint64_t> &line_counts) -> Profile;
+    /// Reads the `line column count` triples written by `write`, nullopt if the input is malformed
+    static auto read(std::istream &input) -> std::optional<Profile>;
+    void write(std::ostream &output) const;
+
+    void merge(const Profile &other);
+    auto get_count(const ast::Command &command) const -> std::optional<uint64_t>;
+    auto get_count(const SourcePosition &position) const -> std::optional<uint64_t>;
+    auto empty() const -> bool { return counts.empty(); }
+
+  private:
+    std::map<SourcePosition, uint64_t> counts{};
+};
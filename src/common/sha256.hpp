@@ -0,0 +1,23 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/// SHA-256 of data fed in pieces, used where equal hashes have to mean equal contents
+class Sha256 {
+  public:
+    Sha256();
+
+    void update(std::string_view data);
+    /// Hash of everything fed so far as 64 lowercase hex digits, the object must not be used afterwards
+    auto finish() -> std::string;
+
+  private:
+    void compress(const uint8_t *block);
+
+    std::array<uint32_t, 8> state;
+    std::array<uint8_t, 64> buffer{};
+    uint64_t length = 0;
+};
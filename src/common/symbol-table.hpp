@@ -0,0 +1,46 @@
+#pragma once
+
+#include "interner.hpp"
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+
+using VariableId = uint32_t;
+
+/// Names of procedures and variables, each interned once. Every variable declared in a scope gets a dense id, so the
+/// data a backend keeps per variable can live in a vector indexed by it.
+class SymbolTable {
+  public:
+    auto intern(std::string_view name) -> Symbol { return names.intern(name); }
+    auto name(Symbol symbol) const -> const std::string & { return names.name(symbol); }
+
+    /// Id of the variable, a new one unless the name is already declared in the scope
+    auto declare(Symbol scope, std::string_view name) -> VariableId {
+        const auto [it, inserted] = variables.try_emplace(key(scope, intern(name)), variable_count());
+        if (inserted) {
+            count++;
+        }
+        return it->second;
+    }
+
+    /// Looks the name up without building any string, nullopt if it is not declared in the scope
+    auto find(Symbol scope, std::string_view name) const -> std::optional<VariableId> {
+        const auto symbol = names.find(name);
+        if (!symbol) {
+            return std::nullopt;
+        }
+        if (const auto it = variables.find(key(scope, *symbol)); it != variables.end()) {
+            return it->second;
+        }
+        return std::nullopt;
+    }
+
+    auto variable_count() const -> VariableId { return count; }
+
+  private:
+    static auto key(Symbol scope, Symbol name) -> uint64_t { return uint64_t{scope} << 32 | name; }
+
+    Interner names{};
+    std::unordered_map<uint64_t, VariableId> variables{};
+    VariableId count = 0;
+};
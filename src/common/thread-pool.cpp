@@ -0,0 +1,81 @@
+#include "thread-pool.hpp"
+
+ThreadPool::ThreadPool(unsigned threads) {
+    for (auto i = 1u; i < threads; i++) {
+        workers.emplace_back([this] { work(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        const auto lock = std::lock_guard(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::for_each(size_t count, const std::function<void(size_t)> &body) {
+    if (workers.empty() || count <= 1) {
+        for (auto i = size_t{0}; i < count; i++) {
+            body(i);
+        }
+        return;
+    }
+
+    {
+        const auto lock = std::lock_guard(mutex);
+        this->body = &body;
+        this->count = count;
+        next = 0;
+        busy = workers.size();
+        generation++;
+    }
+    wake.notify_all();
+
+    run_iterations();
+
+    auto lock = std::unique_lock(mutex);
+    done.wait(lock, [this] { return busy == 0; });
+    this->body = nullptr;
+
+    if (exception) {
+        std::rethrow_exception(std::exchange(exception, nullptr));
+    }
+}
+
+void ThreadPool::work() {
+    auto seen = uint64_t{0};
+    while (true) {
+        {
+            auto lock = std::unique_lock(mutex);
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+        }
+
+        run_iterations();
+
+        const auto lock = std::lock_guard(mutex);
+        if (--busy == 0) {
+            done.notify_one();
+        }
+    }
+}
+
+void ThreadPool::run_iterations() {
+    for (auto i = next++; i < count; i = next++) {
+        try {
+            (*body)(i);
+        } catch (...) {
+            const auto lock = std::lock_guard(mutex);
+            if (!exception) {
+                exception = std::current_exception();
+            }
+        }
+    }
+}
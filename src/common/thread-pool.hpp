@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/// Worker threads started once and reused for every loop they run
+class ThreadPool {
+  public:
+    /// The calling thread counts as one of the threads, so a pool of one thread runs everything on the caller
+    explicit ThreadPool(unsigned threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    auto operator=(const ThreadPool &) -> ThreadPool & = delete;
+
+    /// Calls `body` once for every index below `count` and returns when all calls returned. The first exception thrown
+    /// by a call is rethrown here.
+    void for_each(size_t count, const std::function<void(size_t)> &body);
+
+    auto size() const -> unsigned { return static_cast<unsigned>(workers.size()) + 1; }
+
+  private:
+    void work();
+    void run_iterations();
+
+    std::vector<std::thread> workers{};
+    std::mutex mutex{};
+    std::condition_variable wake{};
+    std::condition_variable done{};
+
+    // The loop being run, replaced only while no worker is inside it
+    const std::function<void(size_t)> *body = nullptr;
+    size_t count = 0;
+    std::atomic<size_t> next = 0;
+    std::exception_ptr exception{};
+    // Workers that have not finished the current loop yet
+    size_t busy = 0;
+    uint64_t generation = 0;
+    bool stopping = false;
+};
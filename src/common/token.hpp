@@ -3,6 +3,7 @@
 #include <cassert>
 #include <format>
 #include <string>
+#include <string_view>
 enum TokenType {
     Pidentifier,
     Num,
@@ -135,6 +136,19 @@ struct Token {
     }
 };
 
+/// Token as the lexer produces it, the lexeme is a view of the source, which has to outlive the token
+struct SourceToken {
+    TokenType token_type;
+    std::string_view lexeme;
+    unsigned line;
+    unsigned column;
+
+    auto operator==(const SourceToken &other) const -> bool = default;
+
+    /// Copy that owns its lexeme, the AST keeps these and the passes add names that are not in the source
+    auto to_token() const -> Token { return Token{token_type, std::string(lexeme), line, column}; }
+};
+
 inline auto to_string(const Token &token) -> std::string {
     auto out = std::format("({}:{}, {})", token.line, token.column, token.lexeme);
 
@@ -0,0 +1,422 @@
+#include "compile-cache.hpp"
+#include "common.hpp"
+#include "sha256.hpp"
+#include <algorithm>
+#include <chrono>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+namespace compiler {
+
+namespace {
+
+namespace fs = std::filesystem;
+
+constexpr auto entry_magic = std::string_view("IMPC");
+// Changes whenever the layout of an entry does
+constexpr auto entry_format = uint32_t{1};
+constexpr auto entry_extension = ".entry";
+// Temporary files older than this were left by a writer that died
+constexpr auto abandoned_after = std::chrono::hours(1);
+
+/// Appends little-endian integers and length-prefixed strings
+class Writer {
+  public:
+    void integer(uint64_t value, unsigned bytes = 8) {
+        for (auto i = 0u; i < bytes; i++) {
+            data += static_cast<char>(value >> (8 * i));
+        }
+    }
+    void string(std::string_view value) {
+        integer(value.size());
+        data += value;
+    }
+
+    std::string data{};
+};
+
+/// Reads what a Writer wrote, once anything is missing every read gives 0 or "" and `failed` is set
+class Reader {
+  public:
+    explicit Reader(std::string_view data) : data(data) {}
+
+    auto integer(unsigned bytes = 8) -> uint64_t {
+        if (failed || data.size() < bytes) {
+            failed = true;
+            return 0;
+        }
+        auto value = uint64_t{0};
+        for (auto i = 0u; i < bytes; i++) {
+            value |= uint64_t{static_cast<uint8_t>(data[i])} << (8 * i);
+        }
+        data.remove_prefix(bytes);
+        return value;
+    }
+    auto string() -> std::string {
+        const auto size = integer();
+        if (failed || data.size() < size) {
+            failed = true;
+            return "";
+        }
+        auto value = std::string(data.substr(0, size));
+        data.remove_prefix(size);
+        return value;
+    }
+
+    auto at_end() const -> bool { return data.empty(); }
+
+    bool failed = false;
+
+  private:
+    std::string_view data;
+};
+
+/// FNV-1a, catches entries damaged on disk
+auto checksum(std::string_view data) -> uint64_t {
+    auto hash = uint64_t{0xcbf29ce484222325};
+    for (const auto byte : data) {
+        hash = (hash ^ static_cast<uint8_t>(byte)) * 0x100000001b3;
+    }
+    return hash;
+}
+
+void write_instruction(Writer &writer, const instruction::Instruction &instruction) {
+    using namespace instruction;
+
+    writer.integer(instruction.index(), 1);
+    std::visit(overloaded{[&](const Jump &jump) { writer.integer(jump.line); },
+                          [&](const Jpos &jpos) { writer.integer(jpos.line); },
+                          [&](const Jzero &jzero) { writer.integer(jzero.line); },
+                          [&](const Strk &strk) { writer.integer(static_cast<uint64_t>(strk.reg), 1); },
+                          [&](const Jumpr &jumpr) { writer.integer(static_cast<uint64_t>(jumpr.reg), 1); },
+                          [&](const Comment &comment) {
+                              writer.string(comment.comment);
+                              writer.integer(comment.indent);
+                          },
+                          [](const instruction::Read &) {}, [](const instruction::Write &) {}, [](const Halt &) {},
+                          [&](const auto &with_register) {
+                              writer.integer(static_cast<uint64_t>(with_register.address), 1);
+                          }},
+               instruction);
+}
+
+template <size_t... Indices>
+auto instruction_of_index(size_t index, std::index_sequence<Indices...>) -> std::optional<instruction::Instruction> {
+    auto instruction = std::optional<instruction::Instruction>{};
+    ((index == Indices ? (instruction.emplace(std::in_place_index<Indices>), 0) : 0), ...);
+    return instruction;
+}
+
+auto read_instruction(Reader &reader) -> std::optional<instruction::Instruction> {
+    using namespace instruction;
+
+    auto instruction = instruction_of_index(
+        reader.integer(1), std::make_index_sequence<std::variant_size_v<instruction::Instruction>>{});
+    if (!instruction) {
+        return std::nullopt;
+    }
+
+    auto is_valid = true;
+    const auto read_register = [&] {
+        const auto reg = reader.integer(1);
+        is_valid = reg <= static_cast<uint64_t>(Register::H);
+        return static_cast<Register>(reg);
+    };
+    std::visit(overloaded{[&](Jump &jump) { jump.line = reader.integer(); },
+                          [&](Jpos &jpos) { jpos.line = reader.integer(); },
+                          [&](Jzero &jzero) { jzero.line = reader.integer(); },
+                          [&](Strk &strk) { strk.reg = read_register(); },
+                          [&](Jumpr &jumpr) { jumpr.reg = read_register(); },
+                          [&](Comment &comment) {
+                              comment.comment = reader.string();
+                              comment.indent = reader.integer();
+                          },
+                          [](instruction::Read &) {}, [](instruction::Write &) {}, [](Halt &) {},
+                          [&](auto &with_register) { with_register.address = read_register(); }},
+               *instruction);
+
+    return is_valid ? instruction : std::nullopt;
+}
+
+auto serialize(const Output &output) -> std::string {
+    auto writer = Writer{};
+    writer.data += entry_magic;
+    writer.integer(entry_format, 4);
+
+    writer.integer(output.lines.size());
+    for (const auto &line : output.lines) {
+        write_instruction(writer, line.instruction);
+        writer.string(line.comment);
+    }
+
+    writer.integer(output.statement_lines.size());
+    for (const auto &[position, line] : output.statement_lines) {
+        writer.integer(position.first, 4);
+        writer.integer(position.second, 4);
+        writer.integer(line);
+    }
+
+    writer.integer(output.warnings.size());
+    for (const auto &warning : output.warnings) {
+        writer.string(warning.source);
+        writer.string(warning.message);
+        writer.integer(warning.line, 4);
+        writer.integer(warning.column, 4);
+        writer.integer(warning.is_warning, 1);
+    }
+
+    writer.integer(checksum(writer.data));
+    return std::move(writer.data);
+}
+
+auto deserialize(std::string_view data) -> std::optional<Output> {
+    if (data.size() < entry_magic.size() + 8 || !data.starts_with(entry_magic)) {
+        return std::nullopt;
+    }
+    const auto body = data.substr(0, data.size() - 8);
+    if (Reader(data.substr(body.size())).integer() != checksum(body)) {
+        return std::nullopt;
+    }
+
+    auto reader = Reader(body.substr(entry_magic.size()));
+    if (reader.integer(4) != entry_format) {
+        return std::nullopt;
+    }
+
+    auto output = Output{};
+
+    // Every element takes at least a byte, so a damaged count cannot make the vectors huge
+    const auto line_count = reader.integer();
+    for (auto i = uint64_t{0}; i < line_count && !reader.failed; i++) {
+        const auto instruction = read_instruction(reader);
+        if (!instruction) {
+            return std::nullopt;
+        }
+        output.lines.push_back(instruction::Line{*instruction, reader.string()});
+    }
+
+    const auto statement_count = reader.integer();
+    for (auto i = uint64_t{0}; i < statement_count && !reader.failed; i++) {
+        const auto line = static_cast<unsigned>(reader.integer(4));
+        const auto column = static_cast<unsigned>(reader.integer(4));
+        output.statement_lines.emplace_back(SourcePosition{line, column}, reader.integer());
+    }
+
+    const auto warning_count = reader.integer();
+    for (auto i = uint64_t{0}; i < warning_count && !reader.failed; i++) {
+        auto source = reader.string();
+        auto message = reader.string();
+        const auto line = static_cast<unsigned>(reader.integer(4));
+        const auto column = static_cast<unsigned>(reader.integer(4));
+        output.warnings.push_back(Error{std::move(source), std::move(message), line, column, reader.integer(1) != 0});
+    }
+
+    if (reader.failed || !reader.at_end()) {
+        return std::nullopt;
+    }
+    return output;
+}
+
+auto random_suffix() -> std::string {
+    auto device = std::random_device{};
+    return std::format("{:08x}{:08x}", device(), device());
+}
+
+} // namespace
+
+auto version() -> const std::string & {
+    // The size and modification time of the executable tell builds of the same version apart
+    static const auto version = [] {
+        auto version = std::format("{} format {}", COMPILER_VERSION, entry_format);
+        auto error = std::error_code{};
+        const auto executable = fs::path("/proc/self/exe");
+        const auto size = fs::file_size(executable, error);
+        const auto modified = fs::last_write_time(executable, error);
+        if (!error) {
+            version += std::format(" {} {}", size, modified.time_since_epoch().count());
+        }
+        return version;
+    }();
+    return version;
+}
+
+Cache::Cache(std::filesystem::path directory, uint64_t max_size)
+    : directory(std::move(directory)), max_size(max_size) {}
+
+auto Cache::key(std::string_view source, const Options &options) const -> std::string {
+    auto key = Writer{};
+    key.string(version());
+    key.integer(static_cast<uint64_t>(options.optimization_level));
+    key.integer(options.pass_toggles.size());
+    for (const auto &[name, enabled] : options.pass_toggles) {
+        key.string(name);
+        key.integer(enabled, 1);
+    }
+    if (options.profile) {
+        auto profile = std::ostringstream{};
+        options.profile->write(profile);
+        key.string(profile.str());
+    } else {
+        key.string("");
+    }
+    key.string(source);
+
+    auto hash = Sha256{};
+    hash.update(key.data);
+    return hash.finish();
+}
+
+auto Cache::entry_path(const std::string &key) const -> std::filesystem::path {
+    // Two levels keep the directories small
+    return directory / key.substr(0, 2) / (key.substr(2) + entry_extension);
+}
+
+auto Cache::load(const std::string &key) const -> std::optional<Output> {
+    const auto path = entry_path(key);
+    auto file = std::ifstream(path, std::ios::binary);
+    if (!file) {
+        return std::nullopt;
+    }
+    const auto data = std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+    auto output = deserialize(data);
+    if (output) {
+        // Marks the entry as recently used
+        auto error = std::error_code{};
+        fs::last_write_time(path, fs::file_time_type::clock::now(), error);
+    }
+    return output;
+}
+
+void Cache::store(const std::string &key, const Output &output) const {
+    const auto path = entry_path(key);
+    auto error = std::error_code{};
+    fs::create_directories(path.parent_path(), error);
+    if (error) {
+        return;
+    }
+
+    // Written under a name no other writer uses, then renamed over the entry in one step
+    auto temporary = path;
+    temporary += ".tmp-" + random_suffix();
+    const auto data = serialize(output);
+    {
+        auto file = std::ofstream(temporary, std::ios::binary);
+        file.write(data.data(), static_cast<std::streamsize>(data.size()));
+        file.close();
+        if (!file) {
+            fs::remove(temporary, error);
+            return;
+        }
+    }
+
+    fs::rename(temporary, path, error);
+    if (error) {
+        fs::remove(temporary, error);
+        return;
+    }
+
+    const auto lock = std::scoped_lock(mutex);
+    if (estimated_size) {
+        *estimated_size += data.size();
+    }
+    if (!estimated_size || *estimated_size > max_size) {
+        evict();
+    }
+}
+
+auto Cache::size() const -> uint64_t {
+    auto size = uint64_t{0};
+    auto error = std::error_code{};
+    for (auto it = fs::recursive_directory_iterator(directory, error); !error && it != fs::end(it);
+         it.increment(error)) {
+        if (it->path().extension() == entry_extension) {
+            size += it->file_size(error);
+        }
+    }
+    return size;
+}
+
+/// Lists the directory, removes the least recently used entries if they take more than `max_size` and records what is
+/// left. Called with the mutex held.
+void Cache::evict() const {
+    struct Entry {
+        fs::path path;
+        uint64_t size;
+        fs::file_time_type used;
+    };
+
+    auto entries = std::vector<Entry>{};
+    auto size = uint64_t{0};
+    const auto now = fs::file_time_type::clock::now();
+
+    auto error = std::error_code{};
+    for (auto it = fs::recursive_directory_iterator(directory, error); !error && it != fs::end(it);
+         it.increment(error)) {
+        auto entry_error = std::error_code{};
+        if (!it->is_regular_file(entry_error)) {
+            continue;
+        }
+        const auto used = it->last_write_time(entry_error);
+        const auto file_size = it->file_size(entry_error);
+        // Another process may have removed the file since it was listed
+        if (entry_error) {
+            continue;
+        }
+
+        if (it->path().extension() == entry_extension) {
+            entries.push_back(Entry{it->path(), file_size, used});
+            size += file_size;
+        } else if (it->path().filename().string().find(".tmp-") != std::string::npos && now - used > abandoned_after) {
+            fs::remove(it->path(), entry_error);
+        }
+    }
+
+    if (size > max_size) {
+        const auto target = max_size / 100 * evicted_to_percent;
+        std::ranges::sort(entries, {}, &Entry::used);
+        for (const auto &entry : entries) {
+            if (size <= target) {
+                break;
+            }
+            // Removing an entry that another process has open is fine, it keeps reading the old file. An entry
+            // another process removed first is gone as well, one that could not be removed still takes its space.
+            auto remove_error = std::error_code{};
+            fs::remove(entry.path, remove_error);
+            if (!remove_error) {
+                size -= entry.size;
+            }
+        }
+    }
+
+    estimated_size = size;
+}
+
+auto compile(std::string_view source, const Options &options, const Cache &cache) -> tl::expected<Output, Errors> {
+    if (options.report) {
+        options.report->begin("cache lookup");
+    }
+    const auto key = cache.key(source, options);
+    auto output = cache.load(key);
+    if (options.report) {
+        options.report->end();
+        options.report->record("hit", output.has_value());
+    }
+
+    if (output) {
+        return std::move(*output);
+    }
+
+    auto compiled = compile(source, options);
+    if (compiled) {
+        cache.store(key, *compiled);
+    }
+    return compiled;
+}
+
+} // namespace compiler
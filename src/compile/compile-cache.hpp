@@ -0,0 +1,53 @@
+#pragma once
+#include "compile.hpp"
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace compiler {
+
+constexpr auto default_cache_size = uint64_t{256} << 20;
+
+/// Compiled programs on disk, keyed by a hash of the source, the compiler and the options that change the code. Any
+/// number of threads and processes may share a directory: entries are written to a temporary file and renamed into
+/// place, a reader sees either the whole entry or none. A cache that cannot be read or written behaves as if empty.
+class Cache {
+  public:
+    /// Once the entries take more than `max_size` bytes, the least recently used ones are removed until they take
+    /// `evicted_to_percent` percent of it, so the directory is only listed again once a good share of it is rewritten
+    explicit Cache(std::filesystem::path directory, uint64_t max_size = default_cache_size);
+
+    auto key(std::string_view source, const Options &options) const -> std::string;
+    /// Lines, statement lines and warnings of the entry, no pass stats
+    auto load(const std::string &key) const -> std::optional<Output>;
+    void store(const std::string &key, const Output &output) const;
+
+    /// Bytes taken by the entries, listed from the directory
+    auto size() const -> uint64_t;
+
+  private:
+    auto entry_path(const std::string &key) const -> std::filesystem::path;
+    void evict() const;
+
+    static constexpr auto evicted_to_percent = uint64_t{80};
+
+    std::filesystem::path directory;
+    uint64_t max_size;
+
+    mutable std::mutex mutex{};
+    // Bytes of the entries when the directory was last listed plus the bytes stored since, nullopt until the first
+    // store. Other processes and replaced entries make it drift, it is corrected whenever it asks for an eviction.
+    mutable std::optional<uint64_t> estimated_size{};
+};
+
+/// Identifies the build of the compiler, an entry written by another build is never used
+auto version() -> const std::string &;
+
+/// `compile` that returns the stored output without running any phase if the cache has the program. Only programs
+/// that compiled are stored.
+auto compile(std::string_view source, const Options &options, const Cache &cache) -> tl::expected<Output, Errors>;
+
+} // namespace compiler
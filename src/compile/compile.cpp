@@ -0,0 +1,151 @@
+#include "compile.hpp"
+#include "analyzer.hpp"
+#include "emitter.hpp"
+#include "flat-ast.hpp"
+#include "lexer.hpp"
+#include "mw.hpp"
+#include "parser.hpp"
+#include <algorithm>
+#include <exception>
+#include <memory>
+
+namespace compiler {
+
+namespace {
+
+auto make_error(std::string message) -> Error {
+    return Error{.source = "compiler", .message = std::move(message), .line = 0, .column = 0};
+}
+
+/// Thrown out of the machine by the first read past the last input, a program waiting for a given input must not run
+/// on forever reading zeros
+struct InputsExhausted {};
+
+/// Inputs of a run, reading past the last one stops the machine with an error
+class InputQueue : public ReadHandler {
+  public:
+    explicit InputQueue(std::deque<uint64_t> inputs) : inputs(std::move(inputs)) {}
+
+    auto get_next_input() -> uint64_t override {
+        if (inputs.empty()) {
+            throw InputsExhausted{};
+        }
+        const auto input = inputs.front();
+        inputs.pop_front();
+        return input;
+    }
+
+  private:
+    std::deque<uint64_t> inputs;
+};
+
+auto compile_unchecked(std::string_view source, const Options &options) -> tl::expected<Output, Errors> {
+    auto *report = options.report;
+    const auto run_phase = [&](const std::string &name, const auto &phase) {
+        if (report) {
+            report->begin(name);
+        }
+        phase();
+        if (report) {
+            report->end();
+        }
+    };
+
+    auto pass_manager = passes::PassManager(options.optimization_level);
+    for (const auto &[name, enabled] : options.pass_toggles) {
+        if (!(enabled ? pass_manager.enable(name) : pass_manager.disable(name))) {
+            return tl::unexpected(Errors{make_error("Unknown pass '" + name + "'")});
+        }
+    }
+
+    auto lexer = Lexer(source);
+    auto parser = parser::Parser(lexer);
+
+    auto program = std::optional<ast::Program>{};
+    run_phase("parse", [&] { program = parser.parse_program(); });
+
+    if (!program || !parser.get_errors().empty()) {
+        return tl::unexpected(parser.get_errors());
+    }
+
+    if (report) {
+        report->record("bytes", source.size());
+        report->record("tokens", parser.get_token_count());
+        // Counted outside of the time of the phase
+        report->record("ast_nodes", ast::flat::flatten(*program).node_count());
+    }
+
+    auto analyzer = analyzer::Analyzer(*program);
+    run_phase("analyze", [&] { analyzer.analyze(); });
+
+    const auto diagnostics = analyzer.get_errors();
+    if (report) {
+        report->record("diagnostics", diagnostics.size());
+    }
+    if (!std::ranges::all_of(diagnostics, &Error::is_warning)) {
+        return tl::unexpected(Errors(diagnostics.begin(), diagnostics.end()));
+    }
+
+    pass_manager.run_ast_passes(*program, options.profile, report);
+
+    auto emitter =
+        emitter::Emitter(std::move(*program), options.profile, options.jobs, pass_manager.get_emitter_features());
+    run_phase("emit", [&] { emitter.emit_program(); });
+
+    if (report) {
+        report->record("lines", emitter.get_lines().size());
+    }
+
+    if (!emitter.get_errors().empty()) {
+        return tl::unexpected(emitter.get_errors());
+    }
+
+    pass_manager.run_line_passes(emitter, report);
+
+    return Output{emitter.get_lines(), Errors(diagnostics.begin(), diagnostics.end()), emitter.get_statement_lines(),
+                  pass_manager.get_stats()};
+}
+
+} // namespace
+
+auto compile(std::string_view source, const Options &options) -> tl::expected<Output, Errors> {
+    // The passes look up what the analyzer accepted with `at`, a case it missed must not take the caller down
+    try {
+        return compile_unchecked(source, options);
+    } catch (const std::exception &exception) {
+        return tl::unexpected(Errors{make_error(std::string("Internal compiler error: ") + exception.what())});
+    }
+}
+
+auto compile_and_run(std::string_view source, std::deque<uint64_t> inputs, const Options &options)
+    -> tl::expected<Run, Errors> {
+    const auto output = compile(source, options);
+    if (!output) {
+        return tl::unexpected(output.error());
+    }
+
+    auto read_handler = std::make_unique<InputQueue>(std::move(inputs));
+    auto write_handler = std::make_unique<WriteHandlerVector<uint64_t>>();
+    auto run = Run{};
+
+    auto state = ProgramState<uint64_t>{};
+    try {
+        state =
+            run_machine(output->lines, read_handler.get(), write_handler.get(), &run.line_counts, options.max_steps);
+    } catch (const InputsExhausted &) {
+        return tl::unexpected(Errors{make_error("The program read more inputs than were given")});
+    }
+    if (state.out_of_steps) {
+        return tl::unexpected(
+            Errors{make_error("The program did not halt within " + std::to_string(options.max_steps) + " steps")});
+    }
+    if (state.error) {
+        return tl::unexpected(Errors{make_error("The program jumped outside of its code")});
+    }
+
+    run.outputs = write_handler->get_outputs();
+    run.cost = state.t + state.io;
+    return run;
+}
+
+} // namespace compiler
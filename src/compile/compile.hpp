@@ -0,0 +1,60 @@
+#pragma once
+#include "error.hpp"
+#include "expected.hpp"
+#include "instruction.hpp"
+#include "pass-manager.hpp"
+#include "phase-report.hpp"
+#include "profile.hpp"
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/// Compiler as a library. Nothing here exits the process, prints or keeps global state, the machine of
+/// compile_and_run included, so several threads may compile and run programs at the same time.
+namespace compiler {
+
+struct Options {
+    passes::OptimizationLevel optimization_level = passes::OptimizationLevel::O3;
+    // Passes enabled (true) and disabled (false) on top of the level, in order
+    std::vector<std::pair<std::string, bool>> pass_toggles{};
+    // Execution counts used instead of the estimates of how often the code runs
+    const Profile *profile = nullptr;
+    // Gets a phase for the front end, every pass and the emitter
+    PhaseReport *report = nullptr;
+    // Threads emitting the procedures, the code is the same for any number of them
+    unsigned jobs = 1;
+    // Instructions compile_and_run executes before it gives up on a program that does not halt
+    uint64_t max_steps = 1'000'000'000;
+};
+
+struct Output {
+    std::vector<instruction::Line> lines;
+    // Diagnostics of the analyzer that did not stop the compilation
+    std::vector<Error> warnings{};
+    // First line of every statement, needed to turn a run into a profile
+    std::vector<std::pair<SourcePosition, uint64_t>> statement_lines{};
+    std::vector<passes::PassStats> pass_stats{};
+};
+
+struct Run {
+    std::vector<uint64_t> outputs;
+    // Cycles of the machine, input and output included
+    long long cost;
+    // Line counts of the run, see Profile::from_line_counts
+    std::vector<uint64_t> line_counts{};
+};
+
+/// Errors of the first phase that failed, warnings of the analyzer included
+using Errors = std::vector<Error>;
+
+auto compile(std::string_view source, const Options &options = {}) -> tl::expected<Output, Errors>;
+
+/// Compiles the program and runs it on the inputs with 64-bit registers. Running out of inputs, jumping outside of the
+/// program or running for more than `max_steps` instructions is an error.
+auto compile_and_run(std::string_view source, std::deque<uint64_t> inputs, const Options &options = {})
+    -> tl::expected<Run, Errors>;
+
+} // namespace compiler
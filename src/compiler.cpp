@@ -1,18 +1,20 @@
-#include <concepts>
+#include <algorithm>
+#include <cstdlib>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <optional>
+#include <ranges>
+#include <thread>
 
-#include "analyzer.hpp"
-#include "ast-optimizer.hpp"
-#include "cfg_builder.hpp"
-#include "emitter.hpp"
+#include "compile-cache.hpp"
+#include "compile.hpp"
 #include "error.hpp"
-#include "lexer.hpp"
-#include "low_level_ir_builder.hpp"
 #include "mw-cln.hpp"
-#include "parser.hpp"
+#include "pass-manager.hpp"
+#include "phase-report.hpp"
+#include "profile.hpp"
 
 auto load_file(const std::string &filepath) -> std::string {
     const auto file = std::ifstream(filepath);
@@ -30,12 +32,29 @@ auto load_file(const std::string &filepath) -> std::string {
 struct CmdlineArgs {
     std::string input_file;
     std::optional<std::string> output_file;
+    // Runs the compiled program on the standard input and adds how often every statement ran to this file
+    std::optional<std::string> profile_generate;
+    // Profile written by --profile-generate, used instead of the estimates of how often the code runs
+    std::optional<std::string> profile_use;
+    // Prints the time, allocations and peak memory growth of every phase to the standard error
+    bool time_report = false;
+    // Writes the same report as JSON to this file
+    std::optional<std::string> time_report_json;
+    passes::OptimizationLevel optimization_level = passes::OptimizationLevel::O3;
+    // Passes enabled with -f<pass> (true) and disabled with -fno-<pass> (false) on top of the level, in order
+    std::vector<std::pair<std::string, bool>> pass_toggles{};
+    // Prints the instructions removed and the cost saved by every pass to the standard error
+    bool pass_stats = false;
+    // Threads emitting the procedures
+    unsigned jobs = std::max(1u, std::thread::hardware_concurrency());
+    // Directory of the compilation cache, a program compiled before with the same options is not compiled again
+    std::optional<std::string> cache{};
+    uint64_t cache_size = compiler::default_cache_size;
 };
 
-void display_errors(const ThrowsError auto &collection) {
-    std::cout << "size: " << collection.get_errors().size() << std::endl;
+void display_errors(const compiler::Errors &errors) {
+    std::cout << "size: " << errors.size() << std::endl;
     bool is_error = false;
-    const auto errors = collection.get_errors();
     for (auto &error : errors) {
         is_error = display_error(error) || is_error;
     }
@@ -44,136 +63,200 @@ void display_errors(const ThrowsError auto &collection) {
 }
 
 auto parse_cmdline_args(int argc, char **argv) -> CmdlineArgs {
-    if (argc < 2) {
-        std::cerr << "Usage: " + std::string{argv[0]} + " <input_file> [output_file]" << std::endl;
-        exit(1);
-    }
-
-    const auto input_file = std::string(argv[1]);
-
-    std::optional<std::string> output_file;
-
-    if (argc == 3) {
-        output_file = std::string(argv[2]);
-    }
-
-    return {input_file, output_file};
-}
+    const auto usage = "Usage: " + std::string{argv[0]} +
+                       " <input_file> [output_file] [--profile-generate <profile>] [--profile-use <profile>]"
+                       " [--time-report] [--time-report-json <report>] [-O0|-O1|-O2|-O3] [-f<pass>] [-fno-<pass>]"
+                       " [--pass-stats] [-j<threads>] [--cache <directory>] [--cache-size <MiB>]";
+
+    auto positional = std::vector<std::string>{};
+    auto args = CmdlineArgs{};
+    auto cache_size = std::optional<std::string>{};
+
+    for (auto i = 1; i < argc; i++) {
+        const auto arg = std::string(argv[i]);
+        if (arg == "--time-report" || arg == "--pass-stats") {
+            (arg == "--time-report" ? args.time_report : args.pass_stats) = true;
+            continue;
+        }
 
-auto main(int argc, char **argv) -> int {
-    const auto args = parse_cmdline_args(argc, argv);
+        if (arg.starts_with("-O")) {
+            const auto level = passes::parse_optimization_level(std::string_view(arg).substr(2));
+            if (!level) {
+                std::cerr << usage << std::endl;
+                exit(1);
+            }
+            args.optimization_level = *level;
+            continue;
+        }
 
-    const auto filepath = std::string(args.input_file);
+        if (arg.starts_with("-j")) {
+            const auto jobs = std::strtoul(arg.c_str() + 2, nullptr, 10);
+            if (jobs == 0 || arg.find_first_not_of("0123456789", 2) != std::string::npos) {
+                std::cerr << usage << std::endl;
+                exit(1);
+            }
+            args.jobs = static_cast<unsigned>(jobs);
+            continue;
+        }
 
-    const auto source = load_file(filepath);
+        if (arg.starts_with("-f") && arg.size() > 2) {
+            const auto disabled = arg.starts_with("-fno-");
+            args.pass_toggles.emplace_back(arg.substr(disabled ? 5 : 2), !disabled);
+            continue;
+        }
 
-    auto lexer = Lexer(source);
+        auto *option = arg == "--profile-generate"   ? &args.profile_generate
+                       : arg == "--profile-use"      ? &args.profile_use
+                       : arg == "--time-report-json" ? &args.time_report_json
+                       : arg == "--cache"            ? &args.cache
+                       : arg == "--cache-size"       ? &cache_size
+                                                     : nullptr;
+        if (!option) {
+            positional.push_back(arg);
+            continue;
+        }
 
-    auto tokens = std::vector<Token>{};
+        if (i + 1 == argc) {
+            std::cerr << usage << std::endl;
+            exit(1);
+        }
+        *option = std::string(argv[++i]);
+    }
 
-    bool error_occured = false;
+    if (positional.empty() || positional.size() > 2) {
+        std::cerr << usage << std::endl;
+        exit(1);
+    }
 
-    for (auto &token : lexer) {
-        if (token) {
-            // std::cout << to_string(*token) << std::endl;
-            tokens.push_back(*token);
-        } else {
-            error_occured = display_error(token.error());
+    if (cache_size) {
+        if (cache_size->empty() || cache_size->find_first_not_of("0123456789") != std::string::npos) {
+            std::cerr << usage << std::endl;
+            exit(1);
         }
+        args.cache_size = std::stoull(*cache_size) << 20;
     }
 
-    if (error_occured) {
-        return 1;
+    args.input_file = positional[0];
+
+    if (positional.size() == 2) {
+        args.output_file = positional[1];
     }
 
-    auto parser = parser::Parser(tokens);
+    return args;
+}
 
-    auto program = parser.parse_program();
+auto load_profile(const std::string &filepath) -> Profile {
+    auto file = std::ifstream(filepath);
 
-    if (!program) {
-        display_errors(parser);
+    if (!file) {
+        std::cerr << "Error: Profile " << std::quoted(filepath) << " not found." << std::endl;
+        exit(1);
     }
 
-    auto analyzer = analyzer::Analyzer(*program);
+    auto profile = Profile::read(file);
 
-    if (!analyzer.analyze()) {
-        display_errors(analyzer);
+    if (!profile) {
+        std::cerr << "Error: Profile " << std::quoted(filepath) << " is malformed." << std::endl;
+        exit(1);
     }
 
-    auto ast_optimizer = AstOptimizer(&*program);
+    return *profile;
+}
+
+/// Runs the program like the instrumented build of a profile-guided compilation would and adds the counts to the
+/// profile file, so that several training runs add up
+void generate_profile(const compiler::Output &output, const std::string &filepath) {
+    auto read_handler = std::make_unique<ReadHandlerStdin>();
+    auto write_handler = std::make_unique<WriteHandlerStdout<cln::cl_I>>();
+    auto line_counts = std::vector<uint64_t>{};
 
-    ast_optimizer.calculate_procedure_call_counts();
+    const auto state = run_machine(output.lines, read_handler.get(), write_handler.get(), &line_counts);
 
-    ast_optimizer.inline_procedures();
+    if (state.error) {
+        std::cerr << "Error: The training run failed, no profile written." << std::endl;
+        exit(1);
+    }
 
-    // for (const auto &[name, count] : ast_optimizer.procedure_call_counts) {
-    //     std::cout << name << ": " << count << std::endl;
-    // }
+    auto profile = Profile::from_line_counts(output.statement_lines, line_counts);
 
-    // auto lir_emitter = lir::LirEmitter(std::move(*program));
-    //
-    // lir_emitter.emit();
-    //
-    // auto instructions = lir_emitter.get_flattened_instructions();
+    if (auto previous_file = std::ifstream(filepath)) {
+        if (const auto previous = Profile::read(previous_file)) {
+            profile.merge(*previous);
+        }
+    }
 
-    // for (auto &instruction : instructions) {
-    //     std::cout << to_string(instruction) << std::endl;
-    // }
+    auto file = std::ofstream(filepath);
+    profile.write(file);
+}
 
-    // auto cfg_builder = lir::CfgBuilder(instructions);
-    //
-    // auto cfg = cfg_builder.build();
-    //
-    // lir_emitter.allocate_registers(&cfg);
-    //
-    // for (const auto &block : cfg.basic_blocks) {
-    //     std::cout << block.to_string() << std::endl;
-    // }
-    //
-    // auto dot = lir::generate_dot(cfg);
-    //
-    // auto graph_output = std::ofstream("graph.dot");
-    //
-    // graph_output << dot << std::endl;
-    //
-    // graph_output.close();
-    //
-    auto emitter = emitter::Emitter(std::move(*program));
+auto main(int argc, char **argv) -> int {
+    const auto args = parse_cmdline_args(argc, argv);
 
-    emitter.emit();
+    const auto filepath = std::string(args.input_file);
 
-    const auto lines = emitter.get_lines();
+    const auto source = load_file(filepath);
 
-    if (emitter.get_errors().size() > 0) {
-        display_errors(emitter);
+    auto report = args.time_report || args.time_report_json ? std::optional{PhaseReport{}} : std::nullopt;
+    const auto profile = args.profile_use ? std::optional{load_profile(*args.profile_use)} : std::nullopt;
+
+    for (const auto &name : args.pass_toggles | std::views::keys) {
+        if (std::ranges::find(passes::PassManager::get_passes(), name, &passes::Pass::name) ==
+            passes::PassManager::get_passes().end()) {
+            std::cerr << "Error: Unknown pass " << std::quoted(name) << ", the passes are:";
+            for (const auto &pass : passes::PassManager::get_passes()) {
+                std::cerr << " " << pass.name;
+            }
+            std::cerr << std::endl;
+            exit(1);
+        }
     }
 
-    // const auto lines = lir_emitter.emit_assembler();
+    const auto options = compiler::Options{
+        .optimization_level = args.optimization_level,
+        .pass_toggles = args.pass_toggles,
+        .profile = profile ? &*profile : nullptr,
+        .report = report ? &*report : nullptr,
+        .jobs = args.jobs,
+    };
+    const auto output = args.cache ? compiler::compile(source, options, compiler::Cache(*args.cache, args.cache_size))
+                                   : compiler::compile(source, options);
+
+    if (!output) {
+        display_errors(output.error());
+        return 1;
+    }
 
-    // for (const auto &line : lines) {
-    //     std::cout << to_string(line.instruction) << std::endl;
-    // }
+    const auto &lines = output->lines;
 
     if (args.output_file) {
-        std::ofstream output(*args.output_file);
+        std::ofstream file(*args.output_file);
         for (auto &line : lines) {
             const auto instruction = line.instruction;
             const auto comment = line.comment;
 
-            output << to_string(instruction);
+            file << to_string(instruction);
             if (!comment.empty())
-                output << "\t\t\t\t\t# " << comment;
-            output << std::endl;
+                file << "\t\t\t\t\t# " << comment;
+            file << std::endl;
         }
-        return 0;
     }
 
-    // auto read_handler = std::make_unique<ReadHandlerStdin>();
-    // auto write_handler = std::make_unique<WriteHandlerStdout<cln::cl_I>>();
-    //
-    // const auto state = run_machine(lines, read_handler.get(), write_handler.get());
-    //
-    // std::cout << "Cost: " << state.t + state.io << std::endl;
+    if (args.profile_generate) {
+        generate_profile(*output, *args.profile_generate);
+    }
+
+    if (args.time_report) {
+        report->write_table(std::cerr);
+    }
+
+    if (args.pass_stats) {
+        passes::write_stats(std::cerr, output->pass_stats);
+    }
+
+    if (args.time_report_json) {
+        auto file = std::ofstream(*args.time_report_json);
+        report->write_json(file);
+    }
 
     return 0;
 }
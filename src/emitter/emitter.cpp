@@ -1,9 +1,12 @@
 #include "emitter.hpp"
 #include "ast.hpp"
 #include "common.hpp"
+#include "simplifier.hpp"
 #include <format>
 #include <iostream>
 #include <limits>
+#include <ranges>
+#include <sstream>
 #include <string>
 
 using namespace emitter;
@@ -11,25 +14,336 @@ using namespace instruction;
 
 const auto error_source = "emitter";
 
-/// Before calling the procedure, register H must be set to the return address
-void Emitter::emit_procedure(const ast::Procedure &procedure) {
-    current_source = procedure.name.lexeme;
+auto contains_call(const std::span<const ast::Command> commands) -> bool {
+    return std::ranges::any_of(commands, [](const ast::Command &command) {
+        return std::visit(
+            overloaded{[](const ast::Call &) { return true; },
+                       [](const ast::If &if_statement) {
+                           return contains_call(if_statement.commands) ||
+                                  (if_statement.else_commands && contains_call(*if_statement.else_commands));
+                       },
+                       [](const ast::While &while_statement) { return contains_call(while_statement.commands); },
+                       [](const ast::Repeat &repeat) { return contains_call(repeat.commands); },
+                       [](const ast::InlinedProcedure &procedure) { return contains_call(procedure.commands); },
+                       [](const auto &) { return false; }},
+            command);
+    });
+}
 
-    const auto entrypoint = lines.size();
+// Adding or subtracting a constant up to this size is cheaper with a chain of INCs or DECs than with a register
+constexpr auto max_step_chain = uint64_t{5};
+
+// Loops are assumed to run this many times when weighing the uses of a variable
+constexpr auto loop_frequency = uint64_t{10};
+constexpr auto max_loop_depth = 4u;
+
+/// Nested InlinedProcedure blocks of a context and, for every variable, the innermost block containing all of its uses
+/// and the number of its uses weighted by the loops they are in, or by how often they ran when profiled
+struct VariableUses {
+    const Profile *profile = nullptr;
+    std::vector<uint64_t> parents{0};
+    std::vector<uint64_t> depths{0};
+    std::unordered_map<std::string, uint64_t> regions{};
+    std::unordered_map<std::string, uint64_t> weights{};
+
+    auto common_ancestor(uint64_t lhs, uint64_t rhs) const -> uint64_t {
+        while (lhs != rhs) {
+            if (depths[lhs] >= depths[rhs]) {
+                lhs = parents[lhs];
+            } else {
+                rhs = parents[rhs];
+            }
+        }
+        return lhs;
+    }
+
+    /// Whether the variables may be live at the same time, only locals of inlined procedures (`name@call`) are not live
+    /// for the whole context
+    auto overlap(const std::string &lhs, const std::string &rhs) const -> bool {
+        if (lhs.find('@') == std::string::npos || rhs.find('@') == std::string::npos) {
+            return true;
+        }
+        const auto lhs_region = regions.contains(lhs) ? regions.at(lhs) : 0;
+        const auto rhs_region = regions.contains(rhs) ? regions.at(rhs) : 0;
+        const auto ancestor = common_ancestor(lhs_region, rhs_region);
+        return ancestor == lhs_region || ancestor == rhs_region;
+    }
+
+    void use(const std::string &name, uint64_t block, uint64_t weight) {
+        const auto [it, inserted] = regions.emplace(name, block);
+        if (!inserted) {
+            it->second = common_ancestor(it->second, block);
+        }
+        weights[name] += weight;
+    }
+
+    void collect(const std::span<const ast::Command> commands, uint64_t block, unsigned loop_depth = 0) {
+        auto loop_weight = uint64_t{1};
+        for (auto i = 0u; i < std::min(loop_depth, max_loop_depth); i++) {
+            loop_weight *= loop_frequency;
+        }
+        auto weight = loop_weight;
+
+        auto use_identifier = [&](const ast::Identifier &identifier) {
+            use(identifier.name.lexeme, block, weight);
+            if (identifier.index && identifier.index->token_type == TokenType::Pidentifier) {
+                use(identifier.index->lexeme, block, weight);
+            }
+        };
+        auto use_value = [&](const ast::Value &value) {
+            if (std::holds_alternative<ast::Identifier>(value)) {
+                use_identifier(std::get<ast::Identifier>(value));
+            }
+        };
+        auto use_condition = [&](const ast::Condition &condition) {
+            use_value(condition.lhs);
+            use_value(condition.rhs);
+        };
+
+        for (const auto &command : commands) {
+            weight = (profile ? profile->get_count(command) : std::nullopt).value_or(loop_weight);
+            std::visit(overloaded{[&](const ast::Read &read) { use_identifier(read.identifier); },
+                                  [&](const ast::Write &write) { use_value(write.value); },
+                                  [&](const ast::If &if_statement) {
+                                      use_condition(if_statement.condition);
+                                      collect(if_statement.commands, block, loop_depth);
+                                      if (if_statement.else_commands) {
+                                          collect(*if_statement.else_commands, block, loop_depth);
+                                      }
+                                  },
+                                  [&](const ast::Repeat &repeat) {
+                                      use_condition(repeat.condition);
+                                      collect(repeat.commands, block, loop_depth + 1);
+                                  },
+                                  [&](const ast::Assignment &assignment) {
+                                      use_identifier(assignment.identifier);
+                                      std::visit(overloaded{[&](const ast::Value &value) { use_value(value); },
+                                                            [&](const ast::BinaryExpression &binary_expression) {
+                                                                use_value(binary_expression.lhs);
+                                                                use_value(binary_expression.rhs);
+                                                            }},
+                                                 assignment.expression);
+                                  },
+                                  [&](const ast::While &while_statement) {
+                                      use_condition(while_statement.condition);
+                                      collect(while_statement.commands, block, loop_depth + 1);
+                                  },
+                                  [&](const ast::Call &call) {
+                                      for (const auto &arg : call.args) {
+                                          use(arg.lexeme, block, weight);
+                                      }
+                                  },
+                                  [&](const ast::InlinedProcedure &procedure) {
+                                      const auto inner_block = parents.size();
+                                      parents.push_back(block);
+                                      depths.push_back(depths[block] + 1);
+                                      collect(procedure.commands, inner_block, loop_depth);
+                                  }},
+                       command);
+        }
+    }
+};
+
+/// Lays out the declarations of a context. Building an address costs about two instructions per bit, so the scalars
+/// used most often get the lowest offsets and arrays go on top, the largest last. The locals of an inlined procedure
+/// (named `name@call`) only live while its copy runs, just like the frame of a call, so locals whose copies never run
+/// at the same time share memory. Either can be switched off in `features`, which leaves the declaration order and one
+/// slot per variable.
+auto layout_declarations(const ast::Context &context, const Profile *profile, const Features &features)
+    -> FrameLayout {
+    auto uses = VariableUses{.profile = profile};
+    uses.collect(context.commands, 0);
+
+    auto declarations = std::vector<const ast::Declaration *>{};
+    for (const auto &declaration : context.declarations) {
+        declarations.push_back(&declaration);
+    }
+
+    const auto declaration_size = [](const ast::Declaration *declaration) -> uint64_t {
+        return declaration->array_size ? std::stoull(declaration->array_size->lexeme) : 1;
+    };
+    if (features.layout_hot_variables) {
+        std::ranges::stable_sort(declarations, [&](const ast::Declaration *lhs, const ast::Declaration *rhs) {
+            const auto lhs_is_array = lhs->array_size.has_value();
+            const auto rhs_is_array = rhs->array_size.has_value();
+            if (lhs_is_array != rhs_is_array) {
+                return rhs_is_array;
+            }
+            if (lhs_is_array) {
+                return declaration_size(lhs) < declaration_size(rhs);
+            }
+            return uses.weights[lhs->identifier.lexeme] > uses.weights[rhs->identifier.lexeme];
+        });
+    }
+
+    auto layout = FrameLayout{.offsets = {}, .size = 0};
+    auto placed = std::vector<std::tuple<std::string, uint64_t, uint64_t>>{};
+
+    for (const auto declaration : declarations) {
+        const auto &name = declaration->identifier.lexeme;
+        const auto size = declaration_size(declaration);
+
+        // First fit among the variables that may be live at the same time
+        auto offset = uint64_t{0};
+        for (auto moved = true; moved;) {
+            moved = false;
+            for (const auto &[other, other_offset, other_size] : placed) {
+                if (offset < other_offset + other_size && other_offset < offset + size &&
+                    (!features.overlap_frames || uses.overlap(name, other))) {
+                    offset = other_offset + other_size;
+                    moved = true;
+                }
+            }
+        }
+
+        placed.emplace_back(name, offset, size);
+        layout.offsets[name] = offset;
+        layout.size = std::max<uint64_t>(layout.size, offset + size);
+    }
+
+    return layout;
+}
+
+/// Calls of the commands in the order they are emitted
+void collect_calls(const std::span<const ast::Command> commands, std::vector<const ast::Call *> &calls) {
+    for (const auto &command : commands) {
+        std::visit(overloaded{[&](const ast::Call &call) { calls.push_back(&call); },
+                              [&](const ast::If &if_statement) {
+                                  collect_calls(if_statement.commands, calls);
+                                  if (if_statement.else_commands) {
+                                      collect_calls(*if_statement.else_commands, calls);
+                                  }
+                              },
+                              [&](const ast::While &while_statement) {
+                                  collect_calls(while_statement.commands, calls);
+                              },
+                              [&](const ast::Repeat &repeat) { collect_calls(repeat.commands, calls); },
+                              [&](const ast::InlinedProcedure &procedure) { collect_calls(procedure.commands, calls); },
+                              [](const auto &) {}},
+                   command);
+    }
+}
+
+auto written_register(const Instruction &instruction) -> std::optional<Register> {
+    return std::visit(overloaded{[](const Put &put) -> std::optional<Register> { return put.address; },
+                                 [](const Rst &rst) -> std::optional<Register> { return rst.address; },
+                                 [](const Inc &inc) -> std::optional<Register> { return inc.address; },
+                                 [](const Dec &dec) -> std::optional<Register> { return dec.address; },
+                                 [](const Shl &shl) -> std::optional<Register> { return shl.address; },
+                                 [](const Shr &shr) -> std::optional<Register> { return shr.address; },
+                                 [](const Strk &strk) -> std::optional<Register> { return strk.reg; },
+                                 [](const auto &) -> std::optional<Register> { return std::nullopt; }},
+                      instruction);
+}
 
-    procedures.emplace(procedure.name.lexeme, Procedure{entrypoint, stack_pointer, &procedure});
+/// Declares the arguments and the locals of the procedure, its body is emitted in a section of its own
+void Emitter::declare_procedure(const ast::Procedure &procedure) {
+    current_source = symbols.intern(procedure.name.lexeme);
+
+    stack_pointer = frame_bases.at(procedure.name.lexeme);
+
+    procedures.emplace(procedure.name.lexeme, Procedure{current_source, stack_pointer, &procedure});
+    procedures.at(procedure.name.lexeme).register_convention =
+        features.pass_arguments_in_registers && procedure.args.size() <= argument_registers.size() &&
+        !contains_call(procedure.context.commands);
 
     // we put the return address here
-    const auto return_address = stack_pointer;
     stack_pointer++;
 
     for (const auto &arg : procedure.args) {
-        variables[Variable{current_source, arg.identifier.lexeme}] = MemoryLocation{stack_pointer, 1, true};
+        declare_variable(current_source, arg.identifier.lexeme, MemoryLocation{stack_pointer, 1, true});
         stack_pointer++;
     }
 
-    assign_memory(procedure.context.declarations);
+    assign_memory(procedure.context);
+}
+
+/// Before calling the procedure, register H must be set to the return address
+void Emitter::emit_procedure_body(const ast::Procedure &procedure, uint64_t return_address) {
+    if (!procedures.at(procedure.name.lexeme).register_convention) {
+        emit_memory_convention_body(procedure, return_address);
+        return;
+    }
+
+    // Start by keeping the return address and every argument pointer where the caller put them and give up the
+    // registers the body overwrites until none of the kept ones is touched
+    auto kept_registers = std::unordered_set<Register>{Register::H};
+    for (auto i = 0u; i < procedure.args.size(); i++) {
+        if (find_variable(current_source, procedure.args[i].identifier.lexeme)->is_pointer) {
+            kept_registers.insert(argument_registers[i]);
+        }
+    }
+
+    const auto entrypoint = lines.size();
+    const auto errors_count = errors.size();
+    const auto calls_count = calls.size();
+    const auto saved_comments = comments;
+
+    while (true) {
+        push_comment(Comment{std::format("procedure {}", procedure.signature()), indent_level_main});
+
+        for (auto i = 0u; i < procedure.args.size(); i++) {
+            auto &location = *find_variable(current_source, procedure.args[i].identifier.lexeme);
+            if (!location.is_pointer) {
+                continue;
+            }
+
+            location.pointer_register = std::nullopt;
+            if (kept_registers.contains(argument_registers[i])) {
+                location.pointer_register = argument_registers[i];
+            } else {
+                emit_line(Get{argument_registers[i]});
+                set_memory(location.address);
+            }
+        }
+
+        if (!kept_registers.contains(Register::H)) {
+            emit_line(Inc{Register::H});
+            emit_line(Inc{Register::H});
+            emit_line(Get{Register::H});
+            set_memory(return_address);
+        }
+
+        const auto body_start = lines.size();
+
+        for (const auto &command : procedure.context.commands) {
+            emit_command(command);
+        }
+
+        auto overwritten = false;
+        for (auto i = body_start; i < lines.size(); i++) {
+            const auto reg = written_register(lines[i].instruction);
+            if (reg && kept_registers.erase(*reg)) {
+                overwritten = true;
+            }
+        }
+
+        if (!overwritten) {
+            break;
+        }
+
+        lines.resize(entrypoint);
+        errors.resize(errors_count);
+        calls.resize(calls_count);
+        comments = saved_comments;
+    }
+
+    if (kept_registers.contains(Register::H)) {
+        emit_line(Inc{Register::H});
+        emit_line(Inc{Register::H});
+        emit_line_with_comment(Jumpr{Register::H},
+                               Comment{std::format("return from procedure {}", procedure.signature()),
+                                       indent_level_middle});
+        return;
+    }
+
+    set_mar(return_address);
+    emit_line(Load{Register::B});
+    emit_line_with_comment(Jumpr{Register::A}, Comment{std::format("return from procedure {}", procedure.signature()),
+                                                       indent_level_middle});
+}
 
+void Emitter::emit_memory_convention_body(const ast::Procedure &procedure, uint64_t return_address) {
     // Set the return address
     emit_line_with_comment(Inc{Register::H},
                            Comment{std::format("procedure {}", procedure.signature()), indent_level_main});
@@ -48,12 +362,93 @@ void Emitter::emit_procedure(const ast::Procedure &procedure) {
                                                        indent_level_middle});
 }
 
+/// Finds or schedules the copy of the called procedure specialized for the arguments of the call. The copy shares the
+/// frame of the procedure, except that the arguments which are plain variables of the caller use their memory
+/// directly instead of going through a pointer.
+auto Emitter::specialize(const ast::Call &call, Symbol caller) -> std::optional<Symbol> {
+    const auto &procedure = procedures.at(call.name.lexeme);
+
+    auto name = call.name.lexeme + "(";
+    auto has_direct_args = false;
+    for (auto i = 0u; i < call.args.size(); i++) {
+        const auto &location = *find_variable(caller, call.args[i].lexeme);
+        name += i > 0 ? ", " : "";
+        name += location.is_pointer ? "*" : "@" + std::to_string(location.address);
+        has_direct_args |= !location.is_pointer;
+    }
+    name += ")";
+
+    if (!has_direct_args) {
+        return std::nullopt;
+    }
+
+    const auto source = symbols.intern(name);
+
+    if (specializations.contains(source)) {
+        return source;
+    }
+
+    if (procedure.size > specialization_budget) {
+        return std::nullopt;
+    }
+    specialization_budget -= procedure.size;
+
+    const auto callee = symbols.intern(call.name.lexeme);
+    for (auto i = 0u; i < call.args.size(); i++) {
+        const auto &arg = procedure.procedure->args[i].identifier.lexeme;
+        const auto location = *find_variable(caller, call.args[i].lexeme);
+        declare_variable(source, arg, location.is_pointer ? *find_variable(callee, arg) : location);
+    }
+
+    for (const auto &declaration : procedure.procedure->context.declarations) {
+        const auto &local = declaration.identifier.lexeme;
+        declare_variable(source, local, *find_variable(callee, local));
+    }
+
+    specializations.emplace(source, Specialization{procedure.procedure});
+    pending_specializations.push_back(source);
+
+    return source;
+}
+
+/// Decides for every call of the commands whether it jumps to a specialized copy. The calls of a section are planned
+/// in the order they are emitted before the section is, so the decisions and the specialization budget do not depend
+/// on the order in which the threads finish.
+void Emitter::plan_calls(Symbol caller, std::span<const ast::Command> commands) {
+    auto calls = std::vector<const ast::Call *>{};
+    collect_calls(commands, calls);
+
+    for (const auto *call : calls) {
+        const auto callee = procedures.find(call->name.lexeme);
+        const auto is_valid =
+            callee != procedures.end() && call->args.size() == callee->second.procedure->args.size() &&
+            std::ranges::all_of(call->args, [&](const Token &arg) { return find_variable(caller, arg.lexeme); });
+        // Specializing a procedure with invalid arguments would only repeat the errors
+        call_targets[{caller, call}] =
+            features.specialize_calls && is_valid && errors.empty() ? specialize(*call, caller) : std::nullopt;
+    }
+}
+
 auto Emitter::get_variable(const Token &variable) -> Location * {
-    if (!variables.contains({current_source, variable.lexeme})) {
+    const auto location = find_variable(current_source, variable.lexeme);
+    if (!location) {
         push_error("Unknown variable " + variable.lexeme, variable.line, variable.column);
-        return nullptr;
     }
-    return &variables.at({current_source, variable.lexeme});
+    return location;
+}
+
+auto Emitter::find_variable(Symbol source, std::string_view name) -> Location * {
+    const auto id = symbols.find(source, name);
+    return id ? &variables[*id] : nullptr;
+}
+
+void Emitter::declare_variable(Symbol source, std::string_view name, const Location &location) {
+    const auto id = symbols.declare(source, name);
+    if (id == variables.size()) {
+        variables.push_back(location);
+    } else {
+        variables[id] = location;
+    }
 }
 
 bool Emitter::is_pointer(const Token &variable) {
@@ -67,8 +462,35 @@ bool Emitter::is_pointer(const Token &variable) {
 
 void Emitter::set_mar(uint64_t value) { set_register(Register::B, value); }
 
+/// Whether the lines emitted since `from` leave register B and the memory as they were
+auto preserves_mar(const std::vector<instruction::Line> &lines, uint64_t from) -> bool {
+    if (from > lines.size()) {
+        return false;
+    }
+    return std::ranges::none_of(lines.begin() + static_cast<std::ptrdiff_t>(from), lines.end(), [](const auto &line) {
+        return written_register(line.instruction) == Register::B || std::holds_alternative<Store>(line.instruction) ||
+               std::holds_alternative<Jumpr>(line.instruction);
+    });
+}
+
 /// Sets the value of register B (B <- id)
 void Emitter::set_mar(const ast::Identifier &identifier) {
+    // Addresses computed from an index variable or a pointer cost a LOAD, the last one is reused while it is intact
+    const auto key = identifier.get_str();
+    if (mar_address && mar_address->first == key && preserves_mar(lines, mar_address->second)) {
+        return;
+    }
+    mar_address.reset();
+
+    emit_address(identifier);
+
+    if (features.reuse_mar &&
+        ((identifier.index && identifier.index->token_type == Pidentifier) || is_pointer(identifier.name))) {
+        mar_address = {key, lines.size()};
+    }
+}
+
+void Emitter::emit_address(const ast::Identifier &identifier) {
     const auto location = get_variable(identifier.name);
     if (!location) {
         return;
@@ -92,10 +514,11 @@ void Emitter::set_mar(const ast::Identifier &identifier) {
             return;
         }
         push_comment(Comment{"Indexing by " + identifier.index->lexeme, indent_level_sub});
-        set_mar(variable->address);
         if (is_pointer(*identifier.index)) {
-            emit_line(Load{Register::B});
+            load_pointer(*variable, Register::B);
             emit_line(Put{Register::B});
+        } else {
+            set_mar(variable->address);
         }
         emit_line(Load{Register::B});
         set_register(Register::E, location->address);
@@ -126,9 +549,8 @@ void Emitter::handle_pointer(const ast::Identifier &identifier) {
     if (!location) {
         return;
     }
-    set_register(Register::B, location->address);
     emit_line_with_comment(Put{Register::G}, Comment{" <- pointer", indent_level_sub});
-    emit_line(Load{Register::B});
+    load_pointer(*location, Register::B);
 
     if (!identifier.index.has_value()) {
         emit_line(Put{Register::B});
@@ -147,10 +569,11 @@ void Emitter::handle_pointer(const ast::Identifier &identifier) {
             return;
         }
         emit_line(Put{Register::H});
-        set_register(Register::F, variable->address);
         if (is_pointer(*identifier.index)) {
-            emit_line(Load{Register::F});
+            load_pointer(*variable, Register::F);
             emit_line(Put{Register::F});
+        } else {
+            set_register(Register::F, variable->address);
         }
         emit_line(Load{Register::F});
         emit_line(Add{Register::H});
@@ -167,6 +590,16 @@ void Emitter::handle_pointer(const ast::Identifier &identifier) {
     emit_line(Get{Register::G});
 }
 
+/// Loads the pointer kept in the location into the accumulator (A <- pointer)
+void Emitter::load_pointer(const Location &location, Register scratch) {
+    if (location.pointer_register) {
+        emit_line(Get{*location.pointer_register});
+        return;
+    }
+    set_register(scratch, location.address);
+    emit_line(Load{scratch});
+}
+
 void Emitter::set_jump_location(Instruction &instruction, uint64_t location) {
     std::visit(overloaded{[&](Jump &jump) { jump.line = location; }, [&](Jpos &jpos) { jpos.line = location; },
                           [&](Jzero &jzero) { jzero.line = location; }, [&](auto) { assert(false); }},
@@ -249,69 +682,26 @@ void Emitter::emit_assignment(const ast::Assignment &assignment) {
             Comment{lhs_comment + get_str(binary.lhs) + " " + op + " " + get_str(binary.rhs), indent_level_main});
     };
 
+    if (const auto simplified = features.simplify_expressions ? simplify(binary) : std::nullopt) {
+        gen_comment(binary.op.lexeme.front());
+        push_comment(Comment{simplified->rule, indent_level_sub});
+        set_accumulator(simplified->operand);
+        for (const auto &instruction : simplified->instructions) {
+            emit_line(instruction);
+        }
+        set_memory(assignment.identifier);
+        return;
+    }
+
     switch (binary.op.token_type) {
     case TokenType::Plus: {
         gen_comment('+');
-        if (std::holds_alternative<ast::Num>(binary.rhs)) {
-            const auto number = std::get<ast::Num>(binary.rhs);
-            auto value = std::stoull(number.lexeme);
-
-            set_accumulator(binary.lhs);
-            if (value <= 5) {
-                for (auto i = 0u; i < value; i++) {
-                    emit_line(Inc{Register::A});
-                }
-            }
-            set_memory(assignment.identifier);
-            return;
-        }
-
-        if (std::holds_alternative<ast::Num>(binary.lhs)) {
-            const auto number = std::get<ast::Num>(binary.lhs);
-            auto value = std::stoull(number.lexeme);
-
-            set_accumulator(binary.rhs);
-            if (value <= 5) {
-                for (auto i = 0u; i < value; i++) {
-                    emit_line(Inc{Register::A});
-                }
-            }
-            set_memory(assignment.identifier);
-            return;
-        }
         set_register(Register::C, binary.rhs);
         set_accumulator(binary.lhs);
         emit_line(Add{Register::C});
     } break;
     case TokenType::Minus:
         gen_comment('-');
-        if (std::holds_alternative<ast::Num>(binary.rhs)) {
-            const auto number = std::get<ast::Num>(binary.rhs);
-            auto value = std::stoull(number.lexeme);
-
-            set_accumulator(binary.lhs);
-            if (value <= 5) {
-                for (auto i = 0u; i < value; i++) {
-                    emit_line(Dec{Register::A});
-                }
-            }
-            set_memory(assignment.identifier);
-            return;
-        }
-
-        if (std::holds_alternative<ast::Num>(binary.lhs)) {
-            const auto number = std::get<ast::Num>(binary.lhs);
-            auto value = std::stoull(number.lexeme);
-
-            set_accumulator(binary.rhs);
-            if (value <= 5) {
-                for (auto i = 0u; i < value; i++) {
-                    emit_line(Dec{Register::A});
-                }
-            }
-            set_memory(assignment.identifier);
-            return;
-        }
         set_register(Register::C, binary.rhs);
         set_accumulator(binary.lhs);
         emit_line(Sub{Register::C});
@@ -321,34 +711,6 @@ void Emitter::emit_assignment(const ast::Assignment &assignment) {
         // Register C <- a
         // Register D <- b
         // Register F <- acc
-        if (std::holds_alternative<ast::Num>(binary.rhs)) {
-            const auto number = std::get<ast::Num>(binary.rhs);
-            auto value = std::stoull(number.lexeme);
-
-            set_accumulator(binary.lhs);
-            if (value % 2 == 0) {
-                while (value >>= 1) {
-                    emit_line(Shl{Register::A});
-                }
-            }
-            set_memory(assignment.identifier);
-            return;
-        }
-
-        if (std::holds_alternative<ast::Num>(binary.lhs)) {
-            const auto number = std::get<ast::Num>(binary.lhs);
-            auto value = std::stoull(number.lexeme);
-
-            set_accumulator(binary.rhs);
-            if (value % 2 == 0) {
-                while (value >>= 1) {
-                    emit_line(Shl{Register::A});
-                }
-            }
-            set_memory(assignment.identifier);
-            return;
-        }
-
         set_register(Register::C, binary.lhs);
         set_register(Register::D, binary.rhs);
 
@@ -378,33 +740,6 @@ void Emitter::emit_assignment(const ast::Assignment &assignment) {
     } break;
     case TokenType::Slash: {
         gen_comment('/');
-        if (std::holds_alternative<ast::Num>(binary.rhs)) {
-            const auto number = std::get<ast::Num>(binary.rhs);
-            auto value = std::stoull(number.lexeme);
-
-            set_accumulator(binary.lhs);
-            if (value % 2 == 0) {
-                while (value >>= 1) {
-                    emit_line(Shr{Register::A});
-                }
-            }
-            set_memory(assignment.identifier);
-            return;
-        }
-
-        if (std::holds_alternative<ast::Num>(binary.lhs)) {
-            const auto number = std::get<ast::Num>(binary.lhs);
-            auto value = std::stoull(number.lexeme);
-
-            set_accumulator(binary.rhs);
-            if (value % 2 == 0) {
-                while (value >>= 1) {
-                    emit_line(Shr{Register::A});
-                }
-            }
-            set_memory(assignment.identifier);
-            return;
-        }
 
         // Register C <- a
         // Register D <- b
@@ -530,7 +865,13 @@ void Emitter::emit_assignment(const ast::Assignment &assignment) {
     set_memory(assignment.identifier);
 }
 
+/// Every comparison is lowered to saturated differences: a <= b holds when a - b is zero and a < b when b - a is not,
+/// so only = and != need two of them. Those keep both operands in registers instead of loading them twice.
+/// Comparisons with small constants subtract with DECs.
 auto Emitter::emit_condition(const ast::Condition &condition, const std::string &comment_when_false) -> Jumps {
+    // Conditions of loops are jumped to
+    mar_address.reset();
+
     auto jumps_if_false = std::vector<uint64_t>{};
     auto jumps_if_true = std::vector<uint64_t>{};
 
@@ -544,83 +885,107 @@ auto Emitter::emit_condition(const ast::Condition &condition, const std::string
         jumps_if_true.push_back(lines.size() - 1);
     };
 
-    auto subtract = [&](Register lhs, Register rhs) {
-        if (lhs == Register::A) {
-            set_register(rhs, condition.rhs);
-            set_register(lhs, condition.lhs);
-        } else {
-            set_register(lhs, condition.lhs);
-            set_register(rhs, condition.rhs);
+    auto small_constant = [](const ast::Value &value) -> std::optional<uint64_t> {
+        if (!std::holds_alternative<ast::Num>(value)) {
+            return std::nullopt;
+        }
+        const auto constant = std::stoull(std::get<ast::Num>(value).lexeme);
+        return constant <= max_step_chain ? std::optional{constant} : std::nullopt;
+    };
+
+    auto decrement = [&](uint64_t count) {
+        for (auto i = 0u; i < count; i++) {
+            emit_line(Dec{Register::A});
+        }
+    };
+
+    // A <- max(lhs - rhs, 0)
+    auto subtract = [&](const ast::Value &lhs, const ast::Value &rhs) {
+        if (const auto constant = small_constant(rhs)) {
+            set_accumulator(lhs);
+            decrement(*constant);
+            return;
         }
+        set_register(Register::C, rhs);
+        set_accumulator(lhs);
         emit_line(Sub{Register::C});
     };
 
     push_comment(Comment{"Condition:", indent_level_middle});
 
-    switch (condition.op.token_type) {
+    const auto op = condition.op.token_type;
+
+    switch (op) {
     case TokenType::LessEquals:
-        subtract(Register::A, Register::C);
-        jump_if_false(Jpos{0}, comment_when_false + " if >=");
+        subtract(condition.lhs, condition.rhs);
+        jump_if_false(Jpos{0}, comment_when_false + " if >");
         break;
 
     case TokenType::GreaterEquals:
-        subtract(Register::C, Register::A);
-        jump_if_false(Jpos{0}, comment_when_false + " if <=");
+        subtract(condition.rhs, condition.lhs);
+        jump_if_false(Jpos{0}, comment_when_false + " if <");
         break;
 
-    case TokenType::Equals:
-        // We have to check a >= b and a <= b
-
-        // a >= b
-        subtract(Register::A, Register::C);
-        jump_if_false(Jpos{1}, comment_when_false + " if > (1)");
-
-        // a <= b
-        subtract(Register::C, Register::A);
-        jump_if_false(Jpos{1}, comment_when_false + " if < (2)");
-
+    case TokenType::Less:
+        subtract(condition.rhs, condition.lhs);
+        jump_if_false(Jzero{0}, comment_when_false + " if >=");
         break;
-    case TokenType::BangEquals:
-        // We also check a >= b and a <= b but we only jump to the body
-        // at least one is false
-
-        // a >= b
-        subtract(Register::A, Register::C);
-        jump_if_true(Jpos{1}, comment_when_false + " if > (1)");
-
-        // a <= b
-        subtract(Register::C, Register::A);
-        jump_if_true(Jpos{1}, comment_when_false + " if < (2)");
-
-        jump_if_false(Jump{0}, comment_when_false + " if ==");
 
+    case TokenType::Greater:
+        subtract(condition.lhs, condition.rhs);
+        jump_if_false(Jzero{0}, comment_when_false + " if <=");
         break;
-    case TokenType::Less:
-        // We check that a <= b but not that a >= b
 
-        // a >= b
-        subtract(Register::A, Register::C);
-        jump_if_false(Jpos{0}, comment_when_false + " if >=");
-
-        // a <= b
-        subtract(Register::C, Register::A);
-        jump_if_true(Jpos{0}, "Jump to body if <");
+    case TokenType::Equals:
+    case TokenType::BangEquals: {
+        const auto is_equals = op == TokenType::Equals;
+        const auto lhs_constant = small_constant(condition.lhs);
+        const auto rhs_constant = small_constant(condition.rhs);
+
+        if (lhs_constant || rhs_constant) {
+            // x = c holds when x - (c - 1) is positive and x - c is not
+            const auto constant = rhs_constant ? *rhs_constant : *lhs_constant;
+            set_accumulator(rhs_constant ? condition.lhs : condition.rhs);
+
+            if (constant > 0) {
+                decrement(constant - 1);
+                if (is_equals) {
+                    jump_if_false(Jzero{0}, comment_when_false + " if <");
+                } else {
+                    jump_if_true(Jzero{0}, "Jump to body if <");
+                }
+                emit_line(Dec{Register::A});
+            }
 
-        jump_if_false(Jump{0}, comment_when_false + " if ==");
-        break;
-    case TokenType::Greater:
-        // We check that a >= b but not that a <= b
+            if (is_equals) {
+                jump_if_false(Jpos{0}, comment_when_false + " if >");
+            } else {
+                jump_if_false(Jzero{0}, comment_when_false + " if ==");
+            }
+            break;
+        }
 
-        // a <= b
-        subtract(Register::C, Register::A);
-        jump_if_false(Jpos{0}, comment_when_false + " if <=");
+        set_register(Register::D, condition.rhs);
+        set_register(Register::C, condition.lhs);
 
-        // a >= b
-        subtract(Register::A, Register::C);
-        jump_if_true(Jpos{0}, "Jump to body if >");
+        // a - b
+        emit_line(Get{Register::C});
+        emit_line(Sub{Register::D});
+        if (is_equals) {
+            jump_if_false(Jpos{0}, comment_when_false + " if >");
+        } else {
+            jump_if_true(Jpos{0}, "Jump to body if >");
+        }
 
-        jump_if_false(Jump{0}, comment_when_false + " if ==");
-        break;
+        // b - a
+        emit_line(Get{Register::D});
+        emit_line(Sub{Register::C});
+        if (is_equals) {
+            jump_if_false(Jpos{0}, comment_when_false + " if <");
+        } else {
+            jump_if_false(Jzero{0}, comment_when_false + " if ==");
+        }
+    } break;
     default:
         push_error("Operator " + condition.op.lexeme + " not implemented", condition.op.line, condition.op.column);
     }
@@ -703,6 +1068,42 @@ void Emitter::emit_repeat(const ast::Repeat &repeat) {
     }
 }
 
+/// Opposite comparison, used to leave a loop when the condition is true instead of entering it
+auto negate(const ast::Condition &condition) -> ast::Condition {
+    auto negated = condition;
+    switch (condition.op.token_type) {
+    case TokenType::Less:
+        negated.op.token_type = TokenType::GreaterEquals;
+        negated.op.lexeme = ">=";
+        break;
+    case TokenType::Greater:
+        negated.op.token_type = TokenType::LessEquals;
+        negated.op.lexeme = "<=";
+        break;
+    case TokenType::LessEquals:
+        negated.op.token_type = TokenType::Greater;
+        negated.op.lexeme = ">";
+        break;
+    case TokenType::GreaterEquals:
+        negated.op.token_type = TokenType::Less;
+        negated.op.lexeme = "<";
+        break;
+    case TokenType::Equals:
+        negated.op.token_type = TokenType::BangEquals;
+        negated.op.lexeme = "!=";
+        break;
+    case TokenType::BangEquals:
+        negated.op.token_type = TokenType::Equals;
+        negated.op.lexeme = "=";
+        break;
+    default:
+        break;
+    }
+    return negated;
+}
+
+/// The loop is rotated into a guard followed by a do-while, so an iteration only evaluates the condition at the
+/// bottom and jumps back to the body without going through the guard
 void Emitter::emit_while(const ast::While &while_statement) {
     const auto condition_str = std::format("while {} {} {}", get_str(while_statement.condition.lhs),
                                            while_statement.condition.op.lexeme, get_str(while_statement.condition.rhs));
@@ -712,8 +1113,7 @@ void Emitter::emit_while(const ast::While &while_statement) {
     const std::string if_false_comment = "Jump to while end";
 
     const auto condition_start = lines.size();
-
-    const auto [jumps_if_false, jumps_if_true] = emit_condition(while_statement.condition, if_false_comment);
+    const auto guard = emit_condition(while_statement.condition, if_false_comment);
 
     const auto body_start = lines.size();
 
@@ -721,15 +1121,39 @@ void Emitter::emit_while(const ast::While &while_statement) {
         emit_command(command);
     }
 
-    emit_line_with_comment(Jump{condition_start}, Comment{"Jump to condition", indent_level_sub});
+    if (!features.rotate_loops) {
+        // Every iteration jumps back to the condition at the top
+        emit_line_with_comment(Jump{condition_start}, Comment{"Jump to while condition", indent_level_middle});
+
+        for (auto i : guard.jumps_if_true) {
+            set_jump_location(lines[i].instruction, body_start);
+        }
+
+        for (auto i : guard.jumps_if_false) {
+            set_jump_location(lines[i].instruction, lines.size());
+        }
+        return;
+    }
+
+    // The bottom test checks the negated condition, so the loop falls through to its end when it holds and jumps back
+    // to the body otherwise
+    const auto [back_jumps, exit_jumps] = emit_condition(negate(while_statement.condition), "Jump to while body");
 
     const auto body_end = lines.size();
 
-    for (auto i : jumps_if_true) {
+    for (auto i : guard.jumps_if_true) {
         set_jump_location(lines[i].instruction, body_start);
     }
 
-    for (auto i : jumps_if_false) {
+    for (auto i : back_jumps) {
+        set_jump_location(lines[i].instruction, body_start);
+    }
+
+    for (auto i : guard.jumps_if_false) {
+        set_jump_location(lines[i].instruction, body_end);
+    }
+
+    for (auto i : exit_jumps) {
         set_jump_location(lines[i].instruction, body_end);
     }
 }
@@ -739,34 +1163,35 @@ void Emitter::emit_call(const ast::Call &call) {
 
     push_comment(Comment{"Call " + call.name.lexeme});
 
-    if (!procedures.contains(call.name.lexeme)) {
+    // Sections are emitted in parallel, so the procedures are only looked up, never added
+    const auto callee = procedures.find(call.name.lexeme);
+    if (callee == procedures.end()) {
         push_error("Procedure " + call.name.lexeme + " not found", call.name.line, call.name.column);
+        return;
     }
 
-    if (num_args != procedures[call.name.lexeme].procedure->args.size()) {
+    if (num_args != callee->second.procedure->args.size()) {
         push_error("Procedure " + call.name.lexeme + " expected " +
-                       std::to_string(procedures[call.name.lexeme].procedure->args.size()) + " arguments but got " +
+                       std::to_string(callee->second.procedure->args.size()) + " arguments but got " +
                        std::to_string(num_args),
                    call.name.line, call.name.column);
+        return;
     }
 
-    const auto previous_source = current_source;
+    const auto caller = current_source;
 
-    current_source = call.name.lexeme;
+    const auto &procedure = callee->second.procedure;
 
-    const auto &procedure = procedures[call.name.lexeme].procedure;
-
-    const auto procedure_memory_entry = procedures[call.name.lexeme].memory_loc;
-
-    set_register(Register::G, procedure_memory_entry + 1);
+    const auto procedure_memory_entry = callee->second.memory_loc;
 
     for (auto i = 0u; i < num_args; i++) {
-        // Check if variable exists
-        if (!variables.contains({previous_source, call.args[i].lexeme})) {
+        const auto *location = find_variable(caller, call.args[i].lexeme);
+        if (!location) {
             push_error("Variable " + call.args[i].lexeme + " not found", call.name.line, call.name.column);
+            continue;
         }
 
-        const auto variable_mem_location = variables.at({previous_source, call.args[i].lexeme});
+        const auto &variable_mem_location = *location;
 
         if (!variable_mem_location.is_pointer && variable_mem_location.size == 1 && procedure->args[i].is_array) {
             push_error(std::format("Procedure {} expected argument '{}' to be an "
@@ -781,10 +1206,47 @@ void Emitter::emit_call(const ast::Call &call) {
                                    procedure->signature(), procedure->args[i].identifier.lexeme, call.args[i].lexeme),
                        call.args[i].line, call.args[i].column);
         }
+    }
+
+    auto specialization = std::optional<Symbol>{};
+    if (const auto target = call_targets.find({caller, &call}); target != call_targets.end()) {
+        specialization = target->second;
+    }
+
+    const auto register_convention = callee->second.register_convention;
+
+    // Register G points to the next argument slot of the frame, a specialized copy only needs the pointers of the
+    // arguments that are themselves pointers
+    auto next_slot = std::optional<uint64_t>{};
+
+    for (auto i = 0u; i < num_args; i++) {
+        const auto *location = find_variable(caller, call.args[i].lexeme);
+        if (!location) {
+            continue;
+        }
+        const auto variable_mem_location = *location;
+
+        if (specialization && !variable_mem_location.is_pointer) {
+            continue;
+        }
 
-        if (variables.at({previous_source, call.args[i].lexeme}).is_pointer) {
-            set_register(Register::B, variable_mem_location.address);
-            emit_line(Load{Register::B});
+        if (register_convention) {
+            if (variable_mem_location.is_pointer) {
+                load_pointer(variable_mem_location, Register::B);
+                emit_line(Put{argument_registers[i]});
+            } else {
+                set_register(argument_registers[i], variable_mem_location.address);
+            }
+            continue;
+        }
+
+        if (next_slot != procedure_memory_entry + 1 + i) {
+            set_register(Register::G, procedure_memory_entry + 1 + i);
+        }
+        next_slot = procedure_memory_entry + 2 + i;
+
+        if (variable_mem_location.is_pointer) {
+            load_pointer(variable_mem_location, Register::B);
         } else {
             set_accumulator(variable_mem_location.address);
         }
@@ -794,10 +1256,11 @@ void Emitter::emit_call(const ast::Call &call) {
     }
 
     emit_line_with_comment(Strk{Register::H}, Comment{"Save return address", indent_level_middle});
-    emit_line_with_comment(Jump{procedures[call.name.lexeme].entrypoint},
-                           Comment{"Jump to procedure " + call.name.lexeme, indent_level_sub});
 
-    current_source = previous_source;
+    // The jump is pointed at the procedure when the sections are linked
+    calls.emplace_back(lines.size(), specialization.value_or(callee->second.source));
+    emit_line_with_comment(Jump{0}, Comment{"Jump to procedure " + symbols.name(calls.back().second),
+                                            indent_level_sub});
 }
 
 void Emitter::set_register(Register reg, uint64_t value) {
@@ -855,15 +1318,65 @@ void Emitter::backup_register(Register reg) {
     emit_line(Store{Register::B});
 }
 
-void Emitter::assign_memory(const std::vector<ast::Declaration> &declarations) {
-    for (const auto &declaration : declarations) {
+/// Places the frames so that a procedure never shares memory with a procedure that may be active while it runs. Without
+/// recursion the call graph is acyclic and callees are declared before their callers, so every frame can start right
+/// where the frames of its callees end. Procedures that never run at the same time end up sharing memory. Without
+/// `overlap_frames` every frame starts where the one declared before it ends. Main is active the whole time, so with
+/// `layout_hot_variables` its frame takes the lowest addresses, the cheapest to build, and the procedures go above it.
+void Emitter::layout_frames() {
+    const auto main_first = features.layout_hot_variables;
+    const auto memory_start = main_first ? layout_declarations(program.main, profile, features).size : 0;
+
+    auto frame_ends = std::unordered_map<std::string, uint64_t>{};
+    auto memory_end = memory_start;
+
+    auto frame_base = [&](const ast::Context &context) {
+        if (!features.overlap_frames) {
+            return memory_end;
+        }
+
+        auto calls = std::vector<const ast::Call *>{};
+        collect_calls(context.commands, calls);
+
+        auto base = memory_start;
+        for (const auto *call : calls) {
+            if (frame_ends.contains(call->name.lexeme)) {
+                base = std::max(base, frame_ends.at(call->name.lexeme));
+            }
+        }
+        return base;
+    };
+
+    for (const auto &procedure : program.procedures) {
+        const auto &name = procedure.name.lexeme;
+        frame_bases[name] = frame_base(procedure.context);
+        // Return address and argument pointers come first
+        frame_ends[name] = frame_bases[name] + 1 + procedure.args.size() +
+                           layout_declarations(procedure.context, profile, features).size;
+        memory_end = std::max(memory_end, frame_ends[name]);
+    }
+
+    frame_bases["PROGRAM"] = main_first ? 0 : frame_base(program.main);
+}
+
+void Emitter::assign_memory(const ast::Context &context) {
+    const auto layout = layout_declarations(context, profile, features);
+    for (const auto &declaration : context.declarations) {
         const auto size = declaration.array_size.has_value() ? std::stoull(declaration.array_size->lexeme) : 1;
-        variables[{current_source, declaration.identifier.lexeme}] = MemoryLocation{stack_pointer, size};
-        stack_pointer += size;
+        const auto address = stack_pointer + layout.offsets.at(declaration.identifier.lexeme);
+        declare_variable(current_source, declaration.identifier.lexeme, MemoryLocation{address, size});
     }
+    stack_pointer += layout.size;
 }
 
 void Emitter::emit_command(const ast::Command &command) {
+    // Every statement may start at a jump target
+    mar_address.reset();
+
+    if (const auto position = statement_position(command)) {
+        statement_lines.emplace_back(*position, lines.size());
+    }
+
     std::visit(overloaded{[&](const ast::Read &read) { emit_read(read.identifier); },
                           [&](const ast::Write &write) { emit_write(write.value); },
                           [&](const ast::If &if_statement) { emit_if(if_statement); },
@@ -880,22 +1393,407 @@ void Emitter::emit_command(const ast::Command &command) {
 }
 
 void Emitter::emit() {
+    emit_program();
+
+    apply_peephole_rules();
+
+    remove_redundant_jumps();
+}
+
+/// Emits every procedure, main and every specialized copy as a section of its own and links them. The calls are
+/// planned in declaration order, so the specialization budget goes to the same calls however the work is split. A
+/// source can only be planned once its callees are emitted, whose sizes the budget needs: the sources planned since
+/// the last batch are emitted in parallel as one batch whenever the next source calls one of them.
+void Emitter::emit_program() {
+    layout_frames();
+
     for (const auto &procedure : program.procedures) {
-        emit_procedure(procedure);
+        declare_procedure(procedure);
     }
 
-    current_source = "PROGRAM";
+    const auto main = symbols.intern("PROGRAM");
+    current_source = main;
+    stack_pointer = frame_bases.at("PROGRAM");
 
-    assign_memory(program.main.declarations);
+    assign_memory(program.main);
 
-    // Jump to main
-    std::get<Jump>(lines[0].instruction).line = lines.size();
+    auto pool = ThreadPool(jobs);
+    auto sections = std::unordered_map<Symbol, Section>{};
 
-    for (const auto &command : program.main.commands) {
-        emit_command(command);
+    auto batch = std::vector<Symbol>{};
+    const auto emit_batch = [&] {
+        for (auto &section : emit_sections(pool, batch)) {
+            if (section.source != main) {
+                procedures.at(symbols.name(section.source)).size = section.lines.size();
+            }
+            sections.emplace(section.source, std::move(section));
+        }
+        batch.clear();
+    };
+    const auto add_to_batch = [&](Symbol source, std::span<const ast::Command> commands) {
+        auto calls = std::vector<const ast::Call *>{};
+        collect_calls(commands, calls);
+        if (std::ranges::any_of(calls, [&](const ast::Call *call) {
+                const auto callee = procedures.find(call->name.lexeme);
+                return callee != procedures.end() && std::ranges::find(batch, callee->second.source) != batch.end();
+            })) {
+            emit_batch();
+        }
+        plan_calls(source, commands);
+        batch.push_back(source);
+    };
+
+    for (const auto &procedure : program.procedures) {
+        add_to_batch(procedures.at(procedure.name.lexeme).source, procedure.context.commands);
+    }
+    add_to_batch(main, program.main.commands);
+    emit_batch();
+
+    // The copies are emitted after main in the order they were asked for, each round plans the calls of the copies
+    // asked for in the round before
+    auto order = std::vector<Symbol>{};
+    for (const auto &procedure : program.procedures) {
+        order.push_back(procedures.at(procedure.name.lexeme).source);
+    }
+    order.push_back(main);
+
+    while (!pending_specializations.empty()) {
+        const auto round = std::vector<Symbol>(pending_specializations.begin(), pending_specializations.end());
+        pending_specializations.clear();
+
+        for (const auto source : round) {
+            plan_calls(source, specializations.at(source).procedure->context.commands);
+        }
+        for (auto &section : emit_sections(pool, round)) {
+            order.push_back(section.source);
+            sections.emplace(section.source, std::move(section));
+        }
+    }
+
+    auto linked = std::vector<Section>{};
+    for (const auto source : order) {
+        linked.push_back(std::move(sections.at(source)));
+    }
+    link(std::move(linked));
+}
+
+auto Emitter::emit_sections(ThreadPool &pool, const std::vector<Symbol> &sources) -> std::vector<Section> {
+    auto sections = std::vector<Section>(sources.size());
+    pool.for_each(sources.size(), [&](size_t i) { sections[i] = emit_section(sources[i]); });
+
+    for (const auto &section : sections) {
+        errors.insert(errors.end(), section.errors.begin(), section.errors.end());
+    }
+    return sections;
+}
+
+auto Emitter::emit_section(Symbol source) const -> Section {
+    auto emitter = Emitter(module, profile, features);
+    emitter.current_source = source;
+
+    const auto &name = symbols.name(source);
+    if (name == "PROGRAM") {
+        for (const auto &command : program.main.commands) {
+            emitter.emit_command(command);
+        }
+        emitter.emit_line_with_comment(Halt{}, Comment{"Halt", indent_level_main});
+    } else {
+        const auto procedure = procedures.find(name);
+        const auto &body = procedure != procedures.end() ? *procedure->second.procedure
+                                                         : *specializations.at(source).procedure;
+        emitter.emit_procedure_body(body, procedures.at(body.name.lexeme).memory_loc);
+    }
+
+    return Section{source, std::move(emitter.lines), std::move(emitter.statement_lines), std::move(emitter.errors),
+                   std::move(emitter.calls)};
+}
+
+auto jump_target(Instruction &instruction) -> uint64_t * {
+    return std::visit(overloaded{[](Jump &jump) -> uint64_t * { return &jump.line; },
+                                 [](Jpos &jpos) -> uint64_t * { return &jpos.line; },
+                                 [](Jzero &jzero) -> uint64_t * { return &jzero.line; },
+                                 [](auto &) -> uint64_t * { return nullptr; }},
+                      instruction);
+}
+
+/// Lays the sections out one after another behind the jump to main, which comes first in the section of main, and
+/// moves their jumps to the lines they end up on
+void Emitter::link(std::vector<Section> sections) {
+    lines = {Line{Jump{0}, "Jump to main"}};
+    statement_lines.clear();
+
+    auto entrypoints = std::unordered_map<Symbol, uint64_t>{};
+    auto size = lines.size();
+    for (const auto &section : sections) {
+        entrypoints.emplace(section.source, size);
+        size += section.lines.size();
+    }
+    lines.reserve(size);
+
+    for (auto &section : sections) {
+        const auto base = entrypoints.at(section.source);
+        for (auto &line : section.lines) {
+            if (const auto target = jump_target(line.instruction)) {
+                *target += base;
+            }
+        }
+        for (const auto &[line, callee] : section.calls) {
+            *jump_target(section.lines[line].instruction) = entrypoints.at(callee);
+        }
+        for (const auto &[position, line] : section.statement_lines) {
+            statement_lines.emplace_back(position, base + line);
+        }
+        lines.insert(lines.end(), std::make_move_iterator(section.lines.begin()),
+                     std::make_move_iterator(section.lines.end()));
+    }
+
+    std::get<Jump>(lines[0].instruction).line = entrypoints.at(symbols.intern("PROGRAM"));
+}
+
+auto operand_register(const Instruction &instruction) -> std::optional<Register> {
+    return std::visit(
+        [](const auto &operation) -> std::optional<Register> {
+            if constexpr (requires { operation.address; }) {
+                return operation.address;
+            } else {
+                return std::nullopt;
+            }
+        },
+        instruction);
+}
+
+struct PeepholeRule {
+    const char *pattern;
+    const char *replacement;
+};
+
+// Found by the superoptimizer (see superoptimizer/superoptimizer.cpp)
+constexpr PeepholeRule peephole_rules[] = {
+#include "peephole-rules.inc"
+};
+
+/// Instructions of a rule, operand 0 is register A and the others stand for distinct registers other than A
+struct PeepholeSequence {
+    std::vector<Instruction> instructions{};
+    std::vector<unsigned> operands{};
+    uint64_t cost = 0;
+};
+
+auto parse_peephole_sequence(const std::string &text) -> PeepholeSequence {
+    constexpr auto operand_names = std::string_view{"axyz"};
+
+    auto sequence = PeepholeSequence{};
+    auto stream = std::istringstream(text);
+    auto mnemonic = std::string{};
+    auto operand = std::string{};
+    while (stream >> mnemonic >> operand) {
+        if (operand.ends_with(';')) {
+            operand.pop_back();
+        }
+        auto instruction = *mnemonic_from_string(mnemonic);
+        sequence.cost += instruction::cost(instruction);
+        sequence.instructions.push_back(instruction);
+        sequence.operands.push_back(operand_names.find(operand));
     }
+    return sequence;
+}
+
+using PeepholeRules = std::unordered_map<size_t, std::vector<std::pair<PeepholeSequence, PeepholeSequence>>>;
+
+/// Rules by the kind of the first instruction they replace
+auto get_peephole_rules() -> const PeepholeRules & {
+    static const auto rules = [] {
+        auto result = PeepholeRules{};
+        for (const auto &rule : peephole_rules) {
+            auto pattern = parse_peephole_sequence(rule.pattern);
+            const auto kind = pattern.instructions.front().index();
+            result[kind].emplace_back(std::move(pattern), parse_peephole_sequence(rule.replacement));
+        }
+        return result;
+    }();
+    return rules;
+}
 
-    emit_line_with_comment(Halt{}, Comment{"Halt", indent_level_main});
+/// Replaces straight-line sequences by the cheapest equivalent the superoptimizer found, until none of the rules
+/// matches. Rules never span a line that is jumped to, the sequences they match contain no jumps themselves.
+void Emitter::apply_peephole_rules() {
+    const auto &rules = get_peephole_rules();
+
+    for (auto changed = true; changed;) {
+        changed = false;
+
+        auto is_target = std::vector<bool>(lines.size() + 1, false);
+        for (auto i = 0u; i < lines.size(); i++) {
+            if (const auto target = jump_target(lines[i].instruction); target && *target < lines.size()) {
+                is_target[*target] = true;
+            }
+            // Calls return to the line after the jump that follows STRK
+            if (i > 0 && std::holds_alternative<Strk>(lines[i - 1].instruction)) {
+                is_target[i + 1] = true;
+            }
+        }
+
+        auto new_index = std::vector<uint64_t>(lines.size() + 1);
+        auto result = std::vector<Line>{};
+        result.reserve(lines.size());
+        auto pending_comment = std::string{};
+
+        for (auto i = 0u; i < lines.size();) {
+            const auto match = [&](const PeepholeSequence &pattern) -> std::optional<std::array<Register, 4>> {
+                auto bindings = std::array<std::optional<Register>, 4>{Register::A};
+                if (i + pattern.instructions.size() > lines.size()) {
+                    return std::nullopt;
+                }
+                for (auto k = 0u; k < pattern.instructions.size(); k++) {
+                    const auto &instruction = lines[i + k].instruction;
+                    if ((k > 0 && is_target[i + k]) || instruction.index() != pattern.instructions[k].index()) {
+                        return std::nullopt;
+                    }
+                    const auto reg = *operand_register(instruction);
+                    auto &binding = bindings[pattern.operands[k]];
+                    if (!binding) {
+                        if (std::ranges::find(bindings, reg) != bindings.end()) {
+                            return std::nullopt;
+                        }
+                        binding = reg;
+                    } else if (*binding != reg) {
+                        return std::nullopt;
+                    }
+                }
+                auto registers = std::array<Register, 4>{};
+                for (auto k = 0u; k < bindings.size(); k++) {
+                    registers[k] = bindings[k].value_or(Register::A);
+                }
+                return registers;
+            };
+
+            // The rule saving the most wins
+            const auto *best = static_cast<const std::pair<PeepholeSequence, PeepholeSequence> *>(nullptr);
+            auto best_registers = std::array<Register, 4>{};
+            if (const auto it = rules.find(lines[i].instruction.index()); it != rules.end()) {
+                for (const auto &rule : it->second) {
+                    const auto savings = rule.first.cost - rule.second.cost;
+                    if (best && savings <= best->first.cost - best->second.cost) {
+                        continue;
+                    }
+                    if (const auto registers = match(rule.first)) {
+                        best = &rule;
+                        best_registers = *registers;
+                    }
+                }
+            }
+
+            if (!best) {
+                new_index[i] = result.size();
+                result.push_back(std::move(lines[i]));
+                if (result.back().comment.empty()) {
+                    result.back().comment = std::move(pending_comment);
+                }
+                pending_comment.clear();
+                i++;
+                continue;
+            }
+
+            const auto &[pattern, replacement] = *best;
+            auto comments = std::vector<std::string>{};
+            for (auto k = 0u; k < pattern.instructions.size(); k++) {
+                new_index[i + k] = result.size();
+                if (!lines[i + k].comment.empty()) {
+                    comments.push_back(std::move(lines[i + k].comment));
+                }
+            }
+            if (!pending_comment.empty()) {
+                comments.insert(comments.begin(), std::move(pending_comment));
+                pending_comment.clear();
+            }
+
+            for (auto k = 0u; k < replacement.instructions.size(); k++) {
+                auto instruction = replacement.instructions[k];
+                set_instruction_register(instruction, best_registers[replacement.operands[k]]);
+                auto comment = k < comments.size() ? std::move(comments[k]) : std::string{};
+                result.push_back(Line{instruction, std::move(comment)});
+            }
+            // Comments of the removed lines move on to the next line
+            if (comments.size() > replacement.instructions.size()) {
+                pending_comment = std::move(comments[replacement.instructions.size()]);
+            }
+
+            i += pattern.instructions.size();
+            changed = true;
+        }
+        new_index[lines.size()] = result.size();
+
+        for (auto &line : result) {
+            if (const auto target = jump_target(line.instruction); target && *target < new_index.size()) {
+                *target = new_index[*target];
+            }
+        }
+        for (auto &[position, line] : statement_lines) {
+            line = new_index[std::min<uint64_t>(line, new_index.size() - 1)];
+        }
+
+        lines = std::move(result);
+    }
+}
+
+/// Points jumps that land on another jump straight at its target and removes jumps to the next line. Return addresses
+/// are taken with STRK at runtime, so only the static targets have to be renumbered.
+void Emitter::remove_redundant_jumps() {
+    for (auto &line : lines) {
+        const auto target = jump_target(line.instruction);
+        if (!target) {
+            continue;
+        }
+        // Bounded so that a loop made only of jumps cannot stall the compiler
+        for (auto hops = 0u; hops < lines.size() && *target < lines.size(); hops++) {
+            const auto next = std::get_if<Jump>(&lines[*target].instruction);
+            if (!next || next->line == *target) {
+                break;
+            }
+            *target = next->line;
+        }
+    }
+
+    auto new_index = std::vector<uint64_t>(lines.size() + 1);
+    auto kept = std::vector<bool>(lines.size(), true);
+    auto count = uint64_t{0};
+    for (auto i = 0u; i < lines.size(); i++) {
+        new_index[i] = count;
+        const auto jump = std::get_if<Jump>(&lines[i].instruction);
+        // The jump after STRK is the call itself, its return address depends on it staying in place
+        const auto is_call = i > 0 && std::holds_alternative<Strk>(lines[i - 1].instruction);
+        kept[i] = !jump || jump->line != i + 1 || is_call;
+        count += kept[i];
+    }
+    new_index[lines.size()] = count;
+
+    auto result = std::vector<Line>{};
+    result.reserve(count);
+    auto pending_comment = std::string{};
+    for (auto i = 0u; i < lines.size(); i++) {
+        if (!kept[i]) {
+            if (pending_comment.empty()) {
+                pending_comment = lines[i].comment;
+            }
+            continue;
+        }
+
+        auto line = std::move(lines[i]);
+        if (const auto target = jump_target(line.instruction); target && *target <= lines.size()) {
+            *target = new_index[*target];
+        }
+        if (line.comment.empty()) {
+            line.comment = std::move(pending_comment);
+        }
+        pending_comment.clear();
+        result.push_back(std::move(line));
+    }
+
+    lines = std::move(result);
+
+    for (auto &[position, line] : statement_lines) {
+        line = new_index[std::min<uint64_t>(line, new_index.size() - 1)];
+    }
 }
 
 void Emitter::emit_line(const Instruction &instruction) {
@@ -3,29 +3,17 @@
 #include "error.hpp"
 #include "expected.hpp"
 #include "instruction.hpp"
+#include "profile.hpp"
+#include "symbol-table.hpp"
+#include "thread-pool.hpp"
 #include <algorithm>
+#include <array>
+#include <map>
+#include <memory>
+#include <span>
 #include <stack>
 #include <unordered_map>
-
-namespace emitter {
-
-struct Variable {
-    std::string source;
-    std::string name;
-
-    bool operator==(const Variable &other) const { return source == other.source && name == other.name; }
-};
-
-} // namespace emitter
-
-namespace std {
-template <> struct hash<emitter::Variable> {
-    size_t operator()(const emitter::Variable &v) const {
-        // Use std::hash for std::string and combine the hashes
-        return hash<string>()(v.source) ^ (hash<string>()(v.name) << 1);
-    }
-};
-} // namespace std
+#include <unordered_set>
 
 namespace emitter {
 
@@ -37,12 +25,67 @@ struct MemoryLocation {
     uint64_t address;
     uint64_t size;
     bool is_pointer = false;
+    // Register holding the pointer instead of the memory at address
+    std::optional<instruction::Register> pointer_register{};
+};
+
+// Upper bound on the lines emitted for specialized copies of procedures
+constexpr auto max_specialization_lines = 4096u;
+
+constexpr auto argument_registers = std::array{instruction::Register::C, instruction::Register::D,
+                                               instruction::Register::E, instruction::Register::F,
+                                               instruction::Register::G};
+
+/// Optimizations made while emitting, each is switched by a pass of the pass manager. Without them every procedure
+/// gets a frame of its own with the variables in declaration order, arguments are passed in memory and every
+/// statement is translated on its own.
+struct Features {
+    // Calls whose arguments are plain variables of the caller jump to a copy addressing them directly
+    bool specialize_calls = true;
+    // Leaf procedures get their argument pointers in registers and the return address in H
+    bool pass_arguments_in_registers = true;
+    // Procedures that are never active at the same time, and locals of inlined procedures that never run at the same
+    // time, share memory
+    bool overlap_frames = true;
+    // The most used scalars get the lowest addresses, which are the cheapest to build
+    bool layout_hot_variables = true;
+    // Loops test their condition at the bottom
+    bool rotate_loops = true;
+    // Arithmetic with a constant operand becomes shifts and additions, see simplify
+    bool simplify_expressions = true;
+    // An address computed from an index variable or a pointer is reused while register B holds it
+    bool reuse_mar = true;
 };
 
 struct Procedure {
-    uint64_t entrypoint;
+    Symbol source;
     uint64_t memory_loc;
     const ast::Procedure *procedure;
+    uint64_t size = 0;
+    // Leaf procedures get their argument pointers in registers and the return address in H
+    bool register_convention = false;
+};
+
+/// Offsets of the variables declared in a context, relative to the start of its memory
+struct FrameLayout {
+    std::unordered_map<std::string, uint64_t> offsets;
+    uint64_t size;
+};
+
+/// Copy of a procedure in which the arguments that are plain variables of the caller are addressed directly
+struct Specialization {
+    const ast::Procedure *procedure;
+};
+
+/// Code of a procedure, of a specialized copy or of main, emitted on its own. Its jumps are relative to its first line
+/// until the sections are linked.
+struct Section {
+    Symbol source;
+    std::vector<instruction::Line> lines{};
+    std::vector<std::pair<SourcePosition, uint64_t>> statement_lines{};
+    std::vector<Error> errors{};
+    // Lines jumping to a procedure or a specialized copy and the source of the one they call
+    std::vector<std::pair<uint64_t, Symbol>> calls{};
 };
 
 // REGISTER A - Accumulator
@@ -58,21 +101,17 @@ struct Jumps {
 class Emitter {
   public:
     Emitter() = delete;
-    Emitter(ast::Program &&program) : program(std::move(program)) {
-        // The first jump jumps to the main procedure but we don't know where
-        // that is yet so we just put a placeholder address here (0)
-        lines.push_back(instruction::Line{instruction::Jump{0}, "Jump to main"});
-
-        registers.push(instruction::Register::C);
-        registers.push(instruction::Register::D);
-        registers.push(instruction::Register::E);
-        registers.push(instruction::Register::F);
-        registers.push(instruction::Register::G);
-        registers.push(instruction::Register::H);
-    };
+    /// The procedures are emitted on `jobs` threads, the code is the same for any number of them
+    Emitter(ast::Program &&program, const Profile *profile = nullptr, unsigned jobs = 1, Features features = {})
+        : module(std::make_shared<Module>(std::move(program))), profile(profile), jobs(jobs), features(features) {}
 
     void emit();
-    void emit_procedure(const ast::Procedure &procedure);
+    /// Code of the program without the passes over the emitted lines (peephole rules, redundant jumps)
+    void emit_program();
+    void declare_procedure(const ast::Procedure &procedure);
+    void plan_calls(Symbol caller, std::span<const ast::Command> commands);
+    auto emit_sections(ThreadPool &pool, const std::vector<Symbol> &sources) -> std::vector<Section>;
+    void link(std::vector<Section> sections);
 
     void emit_comment(const instruction::Comment &comment);
     auto emit_condition(const ast::Condition &condition, const std::string &comment_when_false) -> Jumps;
@@ -85,10 +124,18 @@ class Emitter {
     void emit_repeat(const ast::Repeat &repeat);
     void emit_while(const ast::While &while_statement);
     void emit_call(const ast::Call &call);
+    void emit_procedure_body(const ast::Procedure &procedure, uint64_t return_address);
+    void emit_memory_convention_body(const ast::Procedure &procedure, uint64_t return_address);
+    auto specialize(const ast::Call &call, Symbol caller) -> std::optional<Symbol>;
+    void apply_peephole_rules();
+    void remove_redundant_jumps();
 
     auto get_variable(const Token &variable) -> Location *;
+    auto find_variable(Symbol source, std::string_view name) -> Location *;
+    void declare_variable(Symbol source, std::string_view name, const Location &location);
 
-    void assign_memory(const std::vector<ast::Declaration> &declarations);
+    void layout_frames();
+    void assign_memory(const ast::Context &context);
 
     void backup_register(instruction::Register reg);
     void set_register(instruction::Register reg, uint64_t value);
@@ -97,7 +144,9 @@ class Emitter {
     void set_accumulator(uint64_t value);
     void set_mar(uint64_t value);
     void set_mar(const ast::Identifier &identifier);
+    void emit_address(const ast::Identifier &identifier);
     void handle_pointer(const ast::Identifier &identifier);
+    void load_pointer(const Location &location, instruction::Register scratch);
     void set_memory(uint64_t value);
     void set_memory(const ast::Identifier &identifier);
     void set_jump_location(instruction::Instruction &instruction, uint64_t location);
@@ -111,20 +160,67 @@ class Emitter {
 
     auto get_lines() const -> const std::vector<instruction::Line> & { return lines; }
     auto get_errors() const -> const std::vector<Error> & { return errors; }
+    /// First line emitted for every statement, see Profile::from_line_counts
+    auto get_statement_lines() const -> const std::vector<std::pair<SourcePosition, uint64_t>> & {
+        return statement_lines;
+    }
 
   private:
-    ast::Program program;
-    std::unordered_map<std::string, Procedure> procedures{};
+    /// What the emitters of the sections share. It is only written between the batches of sections emitted in parallel,
+    /// except for the registers of the pointers a section keeps for its own arguments.
+    struct Module {
+        explicit Module(ast::Program &&program) : program(std::move(program)) {}
+
+        ast::Program program;
+        std::unordered_map<std::string, Procedure> procedures{};
+        // Procedures, their specialized copies and main are the sources variables are declared in
+        SymbolTable symbols{};
+        // Indexed by the ids of `symbols`
+        std::vector<Location> variables{};
+        // Start of the memory of every procedure and of main (PROGRAM)
+        std::unordered_map<std::string, uint64_t> frame_bases{};
+        std::unordered_map<Symbol, Specialization> specializations{};
+        // Specialized copy every call of a source jumps to, decided before the source is emitted
+        std::map<std::pair<Symbol, const ast::Call *>, std::optional<Symbol>> call_targets{};
+    };
+
+    /// Emitter of a single section
+    Emitter(std::shared_ptr<Module> module, const Profile *profile, Features features)
+        : module(std::move(module)), profile(profile), jobs(1), features(features) {}
+
+    auto emit_section(Symbol source) const -> Section;
+
+    std::shared_ptr<Module> module;
+    ast::Program &program = module->program;
+    std::unordered_map<std::string, Procedure> &procedures = module->procedures;
+    SymbolTable &symbols = module->symbols;
+    std::vector<Location> &variables = module->variables;
+    std::unordered_map<std::string, uint64_t> &frame_bases = module->frame_bases;
+    std::unordered_map<Symbol, Specialization> &specializations = module->specializations;
+    std::map<std::pair<Symbol, const ast::Call *>, std::optional<Symbol>> &call_targets = module->call_targets;
+
+    const Profile *profile;
+    unsigned jobs;
+    Features features;
     std::vector<instruction::Line> lines{};
+    std::vector<std::pair<SourcePosition, uint64_t>> statement_lines{};
     std::vector<Error> errors{};
+    // Calls of the section being emitted, see Section::calls
+    std::vector<std::pair<uint64_t, Symbol>> calls{};
 
     std::deque<instruction::Comment> comments{};
 
-    std::string current_source = "";
+    Symbol current_source = 0;
 
     uint64_t stack_pointer = 0;
-    std::stack<instruction::Register> registers{};
-    std::unordered_map<Variable, Location> variables{};
+    std::stack<instruction::Register> registers{
+        std::deque{instruction::Register::C, instruction::Register::D, instruction::Register::E,
+                   instruction::Register::F, instruction::Register::G, instruction::Register::H}};
+    // Array element or pointer whose address is in register B and the line at which it was computed
+    std::optional<std::pair<std::string, uint64_t>> mar_address{};
+
+    std::deque<Symbol> pending_specializations{};
+    uint64_t specialization_budget = max_specialization_lines;
 };
 
 } // namespace emitter
@@ -0,0 +1,244 @@
+#include "simplifier.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <functional>
+
+namespace emitter {
+
+using namespace instruction;
+
+namespace {
+
+// Iterations of the multiplication, division and modulo loops per bit of their operand
+constexpr auto loop_step_cost = 20u;
+// Bits the loops run over when the operand is not known
+constexpr auto unknown_bits = 64u;
+
+auto number(const ast::Value &value) -> std::optional<uint64_t> {
+    if (!std::holds_alternative<ast::Num>(value)) {
+        return std::nullopt;
+    }
+    return std::stoull(std::get<ast::Num>(value).lexeme);
+}
+
+/// Cycles of setting a register to the value, see Emitter::set_register
+auto constant_cost(uint64_t value) -> uint64_t {
+    if (value == 0) {
+        return 1;
+    }
+    return std::bit_width(value) + std::popcount(value);
+}
+
+auto repeat(Instruction instruction, uint64_t count) -> std::vector<Instruction> {
+    return std::vector<Instruction>(count, instruction);
+}
+
+/// The operand that is not the number `constant`, for rules matching `x op c` and `c op x`
+auto other_operand(const ast::BinaryExpression &expression, uint64_t constant, bool commutative)
+    -> std::optional<ast::Value> {
+    if (number(expression.rhs) == constant) {
+        return expression.lhs;
+    }
+    if (commutative && number(expression.lhs) == constant) {
+        return expression.rhs;
+    }
+    return std::nullopt;
+}
+
+/// Operand and number of `x op c`, or of `c op x` when the operator is commutative
+auto split(const ast::BinaryExpression &expression, bool commutative)
+    -> std::optional<std::pair<ast::Value, uint64_t>> {
+    if (const auto constant = number(expression.rhs)) {
+        return std::pair{expression.lhs, *constant};
+    }
+    if (const auto constant = number(expression.lhs); constant && commutative) {
+        return std::pair{expression.rhs, *constant};
+    }
+    return std::nullopt;
+}
+
+auto is(const ast::BinaryExpression &expression, TokenType op) -> bool { return expression.op.token_type == op; }
+
+using Rewrite = std::optional<std::pair<ast::Value, std::vector<Instruction>>>;
+
+struct SimplificationRule {
+    const char *name;
+    std::function<Rewrite(const ast::BinaryExpression &)> rewrite;
+};
+
+const auto rules = std::array{
+    SimplificationRule{"x + 0, x - 0, x * 1 and x / 1 are x",
+                       [](const ast::BinaryExpression &expression) -> Rewrite {
+                           auto operand = std::optional<ast::Value>{};
+                           if (is(expression, TokenType::Plus)) {
+                               operand = other_operand(expression, 0, true);
+                           } else if (is(expression, TokenType::Minus)) {
+                               operand = other_operand(expression, 0, false);
+                           } else if (is(expression, TokenType::Star)) {
+                               operand = other_operand(expression, 1, true);
+                           } else if (is(expression, TokenType::Slash)) {
+                               operand = other_operand(expression, 1, false);
+                           }
+                           if (!operand) {
+                               return std::nullopt;
+                           }
+                           return std::pair{*operand, std::vector<Instruction>{}};
+                       }},
+    SimplificationRule{"x - x, 0 - x, x * 0, x / 0, 0 / x, x % 0, x % 1 and 0 % x are 0",
+                       [](const ast::BinaryExpression &expression) -> Rewrite {
+                           const auto lhs = number(expression.lhs);
+                           const auto rhs = number(expression.rhs);
+                           auto zero = false;
+                           switch (expression.op.token_type) {
+                           case TokenType::Minus:
+                               zero = lhs == 0 || ast::get_str(expression.lhs) == ast::get_str(expression.rhs);
+                               break;
+                           case TokenType::Star:
+                           case TokenType::Slash:
+                               zero = lhs == 0 || rhs == 0;
+                               break;
+                           case TokenType::Percent:
+                               zero = lhs == 0 || rhs == 0 || rhs == 1;
+                               break;
+                           default:
+                               break;
+                           }
+                           if (!zero) {
+                               return std::nullopt;
+                           }
+                           auto constant = expression.op;
+                           constant.token_type = TokenType::Num;
+                           constant.lexeme = "0";
+                           return std::pair{ast::Value{constant}, std::vector<Instruction>{}};
+                       }},
+    SimplificationRule{"x + c is c INCs",
+                       [](const ast::BinaryExpression &expression) -> Rewrite {
+                           const auto split_expression = split(expression, true);
+                           if (!is(expression, TokenType::Plus) || !split_expression) {
+                               return std::nullopt;
+                           }
+                           const auto &[operand, constant] = *split_expression;
+                           // Never cheaper once there are as many INCs as cycles of the general lowering, which
+                           // also keeps a large constant from building a vector of that many instructions
+                           if (constant >= general_cost(expression)) {
+                               return std::nullopt;
+                           }
+                           return std::pair{operand, repeat(Inc{Register::A}, constant)};
+                       }},
+    SimplificationRule{"x - c is c DECs, both saturate at 0",
+                       [](const ast::BinaryExpression &expression) -> Rewrite {
+                           const auto split_expression = split(expression, false);
+                           if (!is(expression, TokenType::Minus) || !split_expression) {
+                               return std::nullopt;
+                           }
+                           const auto &[operand, constant] = *split_expression;
+                           // Never cheaper once there are as many DECs as cycles of the general lowering, which
+                           // also keeps a large constant from building a vector of that many instructions
+                           if (constant >= general_cost(expression)) {
+                               return std::nullopt;
+                           }
+                           return std::pair{operand, repeat(Dec{Register::A}, constant)};
+                       }},
+    SimplificationRule{"x + x is SHL",
+                       [](const ast::BinaryExpression &expression) -> Rewrite {
+                           if (!is(expression, TokenType::Plus) ||
+                               ast::get_str(expression.lhs) != ast::get_str(expression.rhs)) {
+                               return std::nullopt;
+                           }
+                           return std::pair{expression.lhs, std::vector<Instruction>{Shl{Register::A}}};
+                       }},
+    SimplificationRule{"x * c is shifts and adds of x",
+                       [](const ast::BinaryExpression &expression) -> Rewrite {
+                           const auto split_expression = split(expression, true);
+                           if (!is(expression, TokenType::Star) || !split_expression || split_expression->second < 2) {
+                               return std::nullopt;
+                           }
+                           const auto &[operand, constant] = *split_expression;
+                           // Horner's scheme over the bits of c below the highest one
+                           auto instructions = std::vector<Instruction>{};
+                           if (std::popcount(constant) > 1) {
+                               instructions.push_back(Put{Register::C});
+                           }
+                           for (auto bit = std::bit_width(constant) - 1; bit-- > 0;) {
+                               instructions.push_back(Shl{Register::A});
+                               if ((constant >> bit) & 1) {
+                                   instructions.push_back(Add{Register::C});
+                               }
+                           }
+                           return std::pair{operand, instructions};
+                       }},
+    SimplificationRule{"x / 2^k is k SHRs",
+                       [](const ast::BinaryExpression &expression) -> Rewrite {
+                           const auto constant = number(expression.rhs);
+                           if (!is(expression, TokenType::Slash) || !constant || !std::has_single_bit(*constant)) {
+                               return std::nullopt;
+                           }
+                           return std::pair{expression.lhs,
+                                            repeat(Shr{Register::A}, std::bit_width(*constant) - 1)};
+                       }},
+    SimplificationRule{"x % 2^k is x without the bits above the lowest k",
+                       [](const ast::BinaryExpression &expression) -> Rewrite {
+                           const auto constant = number(expression.rhs);
+                           if (!is(expression, TokenType::Percent) || !constant || !std::has_single_bit(*constant)) {
+                               return std::nullopt;
+                           }
+                           const auto shift = std::bit_width(*constant) - 1;
+                           auto instructions = std::vector<Instruction>{Put{Register::C}};
+                           const auto shifts_right = repeat(Shr{Register::A}, shift);
+                           const auto shifts_left = repeat(Shl{Register::A}, shift);
+                           instructions.insert(instructions.end(), shifts_right.begin(), shifts_right.end());
+                           instructions.insert(instructions.end(), shifts_left.begin(), shifts_left.end());
+                           instructions.push_back(Put{Register::D});
+                           instructions.push_back(Get{Register::C});
+                           instructions.push_back(Sub{Register::D});
+                           return std::pair{expression.lhs, instructions};
+                       }},
+};
+
+} // namespace
+
+auto general_cost(const ast::BinaryExpression &expression) -> uint64_t {
+    const auto lhs = number(expression.lhs);
+    const auto rhs = number(expression.rhs);
+
+    switch (expression.op.token_type) {
+    case TokenType::Plus:
+    case TokenType::Minus: {
+        // A number operand is built in a register instead of being loaded
+        const auto constant = rhs ? rhs : lhs;
+        return (constant ? constant_cost(*constant) : 0) + cost(Add{Register::C});
+    }
+    default:
+        // The loops run over the bits of the right operand, at least once
+        return loop_step_cost * (rhs ? std::max<uint64_t>(std::bit_width(*rhs), 1) : unknown_bits);
+    }
+}
+
+auto simplify(const ast::BinaryExpression &expression) -> std::optional<Simplification> {
+    auto best = std::optional<Simplification>{};
+    auto best_cost = general_cost(expression);
+
+    for (const auto &rule : rules) {
+        auto rewrite = rule.rewrite(expression);
+        if (!rewrite) {
+            continue;
+        }
+
+        auto &[operand, instructions] = *rewrite;
+        auto rewrite_cost = uint64_t{0};
+        for (const auto &instruction : instructions) {
+            rewrite_cost += cost(instruction);
+        }
+        // Loading the operands is left out of both costs, the rewrite loads at most as many of them
+        if (rewrite_cost < best_cost) {
+            best_cost = rewrite_cost;
+            best = Simplification{
+                .rule = rule.name, .operand = std::move(operand), .instructions = std::move(instructions)};
+        }
+    }
+
+    return best;
+}
+
+} // namespace emitter
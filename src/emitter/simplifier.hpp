@@ -0,0 +1,27 @@
+#pragma once
+#include "ast.hpp"
+#include "instruction.hpp"
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace emitter {
+
+/// Instructions computing a binary expression from one of its operands, cheaper than the general lowering of the
+/// operator
+struct Simplification {
+    // Rule that produced it, shown in the comments of the output
+    std::string rule;
+    // Loaded into the accumulator before the instructions run, they leave the result there
+    ast::Value operand;
+    std::vector<instruction::Instruction> instructions;
+};
+
+/// Cycles of the general lowering of the expression, besides loading its operands
+auto general_cost(const ast::BinaryExpression &expression) -> uint64_t;
+
+/// Cheapest rewrite of the expression by the simplification rules, nullopt when none of them beats the general
+/// lowering
+auto simplify(const ast::BinaryExpression &expression) -> std::optional<Simplification>;
+
+} // namespace emitter
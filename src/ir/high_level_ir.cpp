@@ -14,11 +14,10 @@ AstToHir::AstToHir(const ast::Program &program) {
 }
 
 void AstToHir::emit_procedure(const ast::Procedure &procedure) {
-    current_source = procedure.signature();
+    current_source = symbols.intern(procedure.signature());
 
     for (const auto &variable : procedure.args) {
-        variables[get_variable_signature(variable.identifier)] =
-            VariableDeclaration{.id = get_next_variable_id(), .is_pointer = true};
+        declare_variable(variable.identifier, true);
     }
 
     push_instruction(Label{}, procedure.signature());
@@ -28,8 +27,7 @@ void AstToHir::emit_procedure(const ast::Procedure &procedure) {
 
 void AstToHir::emit_context(const ast::Context &context) {
     for (const auto &variable : context.declarations) {
-        variables[get_variable_signature(variable.identifier)] =
-            VariableDeclaration{.id = get_next_variable_id(), .is_pointer = false};
+        declare_variable(variable.identifier, false);
     }
 
     emit_commands(context.commands);
@@ -78,16 +76,18 @@ void AstToHir::push_instruction(HighLevelIRInstruction instruction, std::optiona
     ir.instructions.push_back(instruction);
 }
 
-auto AstToHir::get_variable_signature(const ast::Identifier &identifier) const -> std::string {
-    return current_source + "@" + identifier.name.lexeme;
-}
-
-auto AstToHir::get_variable_signature(const Token &identifier) const -> std::string {
-    return current_source + "@" + identifier.lexeme;
+void AstToHir::declare_variable(const Token &identifier, bool is_pointer) {
+    const auto id = symbols.declare(current_source, identifier.lexeme);
+    const auto declaration = VariableDeclaration{.id = get_next_variable_id(), .is_pointer = is_pointer};
+    if (id == variables.size()) {
+        variables.push_back(declaration);
+    } else {
+        variables[id] = declaration;
+    }
 }
 
 auto AstToHir::get_variable_declaration(const Token &pidentifier) const -> VariableDeclaration const * {
-    const auto declaration = &variables.at(get_variable_signature(pidentifier));
+    const auto declaration = &variables.at(symbols.find(current_source, pidentifier.lexeme).value());
     return declaration;
 }
 
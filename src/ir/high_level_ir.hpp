@@ -1,6 +1,7 @@
 #pragma once
 #include "ast.hpp"
 #include "error.hpp"
+#include "symbol-table.hpp"
 #include <cstdint>
 #include <optional>
 #include <string>
@@ -67,8 +68,6 @@ struct HighLevelIR {
     std::unordered_map<std::string, uint64_t> function_call_frequencies;
 };
 
-using VariableSignature = std::string;
-
 class AstToHir {
   public:
     AstToHir() = delete;
@@ -85,9 +84,7 @@ class AstToHir {
     auto get_ir() const -> HighLevelIR const & { return ir; }
     auto get_errors() const -> std::vector<Error> const & { return errors; }
 
-    auto get_variable_signature(const ast::Identifier &identifier) const -> std::string;
-    auto get_variable_signature(const Token &identifier) const -> std::string;
-
+    void declare_variable(const Token &identifier, bool is_pointer);
     auto get_variable_declaration(const Token &pidentifier) const -> VariableDeclaration const *;
     auto get_variable(const ast::Identifier &identifier) const -> Variable;
     auto get_constant(const ast::Num &num) -> uint64_t;
@@ -95,8 +92,10 @@ class AstToHir {
     auto get_next_variable_id() -> uint64_t;
 
   private:
-    std::string current_source = "";
-    std::unordered_map<VariableSignature, VariableDeclaration> variables;
+    SymbolTable symbols{};
+    Symbol current_source = 0;
+    // Indexed by the ids of `symbols`
+    std::vector<VariableDeclaration> variables;
     uint64_t next_variable_id = 0;
     uint64_t next_label_id = 0;
     HighLevelIR ir;
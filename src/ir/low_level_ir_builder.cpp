@@ -215,6 +215,7 @@ void LirEmitter::emit() {
     }
 
     current_source = main_label;
+    current_scope = symbols.intern(current_source);
     push_instruction(Label{main_label});
     emit_context(program.main);
     push_instruction(Halt{});
@@ -222,14 +223,14 @@ void LirEmitter::emit() {
 
 void LirEmitter::emit_procedure(const ast::Procedure &procedure) {
     current_source = procedure.name.lexeme;
+    current_scope = symbols.intern(current_source);
 
     const auto return_address_vreg = new_vregister();
     procedures[current_source] = Procedure{{return_address_vreg}};
 
     for (const auto &variable : procedure.args) {
         const auto vreg = new_vregister();
-        resolved_variables[current_source + "@" + variable.identifier.lexeme] =
-            ResolvedVariable{vreg, true, variable.is_array};
+        declare_variable(variable.identifier, ResolvedVariable{vreg, true, variable.is_array});
         procedures[current_source].args.push_back(vreg);
     }
 
@@ -240,9 +241,10 @@ void LirEmitter::emit_procedure(const ast::Procedure &procedure) {
 
 void LirEmitter::emit_context(const ast::Context &context) {
     for (const auto &variable : context.declarations) {
-        const auto signature = current_source + "@" + variable.identifier.lexeme;
-        resolved_variables[signature] = ResolvedVariable{new_vregister(), false, variable.array_size.has_value()};
-        allocate_memory(signature, variable.array_size.has_value() ? std::stoull(variable.array_size->lexeme) : 1);
+        const auto is_array = variable.array_size.has_value();
+        declare_variable(variable.identifier, ResolvedVariable{new_vregister(), false, is_array});
+        allocate_memory(current_source + "@" + variable.identifier.lexeme,
+                        is_array ? std::stoull(variable.array_size->lexeme) : 1);
     }
     emit_commands(context.commands);
 }
@@ -493,13 +495,20 @@ auto LirEmitter::set_to_vreg_or_store_to_mem(const Token &identifier) -> Virtual
 }
 
 auto LirEmitter::get_variable(const ast::Identifier &identifier) -> ResolvedVariable {
-    const auto signature = current_source + "@" + identifier.name.lexeme;
-    return resolved_variables.at(signature);
+    return get_variable(identifier.name);
 }
 
 auto LirEmitter::get_variable(const Token &identifier) -> ResolvedVariable {
-    const auto signature = current_source + "@" + identifier.lexeme;
-    return resolved_variables.at(signature);
+    return resolved_variables.at(symbols.find(current_scope, identifier.lexeme).value());
+}
+
+void LirEmitter::declare_variable(const Token &identifier, const ResolvedVariable &variable) {
+    const auto id = symbols.declare(current_scope, identifier.lexeme);
+    if (id == resolved_variables.size()) {
+        resolved_variables.push_back(variable);
+    } else {
+        resolved_variables[id] = variable;
+    }
 }
 
 auto LirEmitter::new_vregister() -> VirtualRegister { return VirtualRegister{next_vregister_id++}; }
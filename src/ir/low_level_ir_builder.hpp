@@ -2,6 +2,7 @@
 #include "ast.hpp"
 #include "cfg_builder.hpp"
 #include "low_level_ir.hpp"
+#include "symbol-table.hpp"
 
 namespace lir {
 struct ResolvedVariable {
@@ -46,6 +47,7 @@ class LirEmitter {
 
     auto get_variable(const ast::Identifier &identifier) -> ResolvedVariable;
     auto get_variable(const Token &identifier) -> ResolvedVariable;
+    void declare_variable(const Token &identifier, const ResolvedVariable &variable);
     void allocate_memory(const std::string &name, uint64_t size);
     auto new_vregister() -> VirtualRegister;
     auto get_label_str(const std::string &label) -> std::string;
@@ -75,7 +77,9 @@ class LirEmitter {
     ast::Program program;
 
     std::unordered_map<std::string, Procedure> procedures;
-    std::unordered_map<std::string, ResolvedVariable> resolved_variables{};
+    SymbolTable symbols{};
+    // Indexed by the ids of `symbols`
+    std::vector<ResolvedVariable> resolved_variables{};
     ProcedureCodes instructions;
 
     std::unordered_map<std::string, uint64_t> memory_locations;
@@ -83,6 +87,7 @@ class LirEmitter {
     uint64_t next_label_id = 0;
     uint64_t next_memory_location = 0;
     std::string current_source = "";
+    Symbol current_scope = 0;
 
     Cfg *cfg;
     RegisterInterferenceGraph interference_graph;
@@ -2,32 +2,60 @@
 #include "error.hpp"
 #include "expected.hpp"
 
-#include <exception>
+#include <algorithm>
+#include <array>
 #include <format>
-#include <iostream>
-#include <unordered_map>
-
-static const std::unordered_map<std::string, TokenType> keywords = {
-    {"PROGRAM", TokenType::Program},
-    {"PROCEDURE", TokenType::Procedure},
-    {"IS", TokenType::Is},
-    {"IN", TokenType::In},
-    {"WHILE", TokenType::While},
-    {"ENDWHILE", TokenType::EndWhile},
-    {"IF", TokenType::If},
-    {"ENDIF", TokenType::EndIf},
-    {"THEN", TokenType::Then},
-    {"ELSE", TokenType::Else},
-    {"DO", TokenType::Do},
-    {"READ", TokenType::Read},
-    {"WRITE", TokenType::Write},
-    {"END", TokenType::End},
-    {"T", TokenType::T},
-    {"REPEAT", TokenType::Repeat},
-    {"UNTIL", TokenType::Until},
+
+namespace {
+
+struct Keyword {
+    std::string_view lexeme;
+    TokenType token_type;
+};
+
+constexpr auto keywords = std::array{
+    Keyword{"PROGRAM", TokenType::Program}, Keyword{"PROCEDURE", TokenType::Procedure},
+    Keyword{"IS", TokenType::Is},           Keyword{"IN", TokenType::In},
+    Keyword{"WHILE", TokenType::While},     Keyword{"ENDWHILE", TokenType::EndWhile},
+    Keyword{"IF", TokenType::If},           Keyword{"ENDIF", TokenType::EndIf},
+    Keyword{"THEN", TokenType::Then},       Keyword{"ELSE", TokenType::Else},
+    Keyword{"DO", TokenType::Do},           Keyword{"READ", TokenType::Read},
+    Keyword{"WRITE", TokenType::Write},     Keyword{"END", TokenType::End},
+    Keyword{"T", TokenType::T},             Keyword{"REPEAT", TokenType::Repeat},
+    Keyword{"UNTIL", TokenType::Until},
 };
 
-Lexer::Lexer(const std::string &source) : source(source) {
+constexpr auto keyword_table_size = 32u;
+
+/// Perfect hash of the keywords: the length, the second and the last letter tell every keyword apart
+constexpr auto keyword_hash(std::string_view word) -> size_t {
+    return (word.size() + 5 * static_cast<size_t>(word[1 % word.size()]) + 17 * static_cast<size_t>(word.back())) %
+           keyword_table_size;
+}
+
+constexpr auto keyword_table = [] {
+    auto table = std::array<std::optional<Keyword>, keyword_table_size>{};
+    for (const auto &keyword : keywords) {
+        table[keyword_hash(keyword.lexeme)] = keyword;
+    }
+    return table;
+}();
+
+static_assert(std::ranges::count_if(keyword_table, [](const auto &entry) { return entry.has_value(); }) ==
+                  std::ssize(keywords),
+              "Two keywords have the same hash");
+
+auto find_keyword(std::string_view word) -> std::optional<TokenType> {
+    const auto &entry = keyword_table[keyword_hash(word)];
+    if (!entry || entry->lexeme != word) {
+        return std::nullopt;
+    }
+    return entry->token_type;
+}
+
+} // namespace
+
+Lexer::Lexer(std::string_view source) : source(source) {
     line_number = 1;
     column_number = 1;
     current_index = 0;
@@ -38,31 +66,29 @@ auto Lexer::newline() -> void {
     column_number = 1;
 }
 
-auto Lexer::make_token(TokenType token_type, std::string lexeme, unsigned int column) -> Token {
-    return Token{token_type, lexeme, line_number, column};
+auto Lexer::make_token(TokenType token_type, std::string_view lexeme, unsigned int column) -> SourceToken {
+    return SourceToken{token_type, lexeme, line_number, column};
 }
 
-auto Lexer::chop(int count) -> std::string {
+auto Lexer::chop(int count) -> std::string_view {
     auto result = source.substr(current_index, count);
     current_index += count;
     column_number += count;
     return result;
 }
 
-auto Lexer::chop_while(std::function<bool(char)> predicate) -> std::string {
-    std::string result;
+template <typename Predicate> auto Lexer::chop_while(Predicate predicate) -> std::string_view {
+    const auto start = current_index;
     while (current_index < source.size() && predicate(source[current_index])) {
-        char c = source[current_index];
-        result += c;
-        current_index++;
-        column_number++;
-
-        if (c == '\n') {
+        if (source[current_index] == '\n') {
             newline();
+        } else {
+            column_number++;
         }
+        current_index++;
     }
 
-    return result;
+    return source.substr(start, current_index - start);
 }
 
 auto Lexer::peek() -> std::optional<char> {
@@ -93,7 +119,7 @@ auto is_numeric(char c) -> bool { return c >= '0' && c <= '9'; }
 auto is_lowercase_alphabetic(char c) -> bool { return (c >= 'a' && c <= 'z'); }
 auto is_uppercase_alphabetic(char c) -> bool { return (c >= 'A' && c <= 'Z'); }
 
-auto Lexer::next_token() -> std::optional<tl::expected<Token, Error>> {
+auto Lexer::next_token() -> std::optional<tl::expected<SourceToken, Error>> {
     trim_whitespace();
 
     if (current_index >= source.size()) {
@@ -122,9 +148,8 @@ auto Lexer::next_token() -> std::optional<tl::expected<Token, Error>> {
     if (is_uppercase_alphabetic(c)) {
         auto lexeme = chop_while(is_uppercase_alphabetic);
 
-        auto keyword = keywords.find(lexeme);
-        if (keyword != keywords.end()) {
-            return make_token(keyword->second, lexeme, first_char_column);
+        if (const auto keyword = find_keyword(lexeme)) {
+            return make_token(*keyword, lexeme, first_char_column);
         } else {
             return tl::unexpected(
                 Error{"Lexer", std::format("Unknown keyword '{}'", lexeme), line_number, column_number});
@@ -3,21 +3,24 @@
 #include "error.hpp"
 #include "expected.hpp"
 #include "token.hpp"
-#include <functional>
 #include <optional>
+#include <string_view>
 
 class Lexer {
   public:
     Lexer() = delete;
-    Lexer(const std::string &source);
-    auto next_token() -> std::optional<tl::expected<Token, Error>>;
+    /// The lexer borrows the source, it has to outlive the lexer and the tokens, whose lexemes are views of it
+    Lexer(std::string_view source);
+    Lexer(const char *source) : Lexer(std::string_view(source)) {}
+    Lexer(std::string &&source) = delete;
+    auto next_token() -> std::optional<tl::expected<SourceToken, Error>>;
 
     class Iterator {
         using iterator_category = std::forward_iterator_tag;
-        using value_type = tl::expected<Token, Error>;
+        using value_type = tl::expected<SourceToken, Error>;
         using difference_type = std::ptrdiff_t;
-        using pointer = std::optional<tl::expected<Token, Error>>;
-        using reference = tl::expected<Token, Error> &;
+        using pointer = std::optional<tl::expected<SourceToken, Error>>;
+        using reference = tl::expected<SourceToken, Error> &;
 
       public:
         Iterator(Lexer *lexer = nullptr, pointer currentToken = std::nullopt)
@@ -50,23 +53,23 @@ class Lexer {
 
       private:
         Lexer *lexer;
-        std::optional<tl::expected<Token, Error>> currentToken;
+        std::optional<tl::expected<SourceToken, Error>> currentToken;
     };
 
     Iterator begin() { return Iterator(this, next_token()); }
     Iterator end() { return Iterator(); }
 
   private:
-    auto chop(int count) -> std::string;
-    auto chop_while(std::function<bool(char)>) -> std::string;
+    auto chop(int count) -> std::string_view;
+    template <typename Predicate> auto chop_while(Predicate predicate) -> std::string_view;
     auto peek() -> std::optional<char>;
     void trim_whitespace();
     void newline();
-    auto make_token(TokenType token_type, std::string lexeme, unsigned int column) -> Token;
+    auto make_token(TokenType token_type, std::string_view lexeme, unsigned int column) -> SourceToken;
 
   private:
     unsigned line_number;
     unsigned column_number;
     unsigned current_index;
-    const std::string source;
+    const std::string_view source;
 };
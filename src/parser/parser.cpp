@@ -1,4 +1,5 @@
 #include "parser.hpp"
+#include <cassert>
 #include <format>
 #include <iostream>
 #include <optional>
@@ -9,49 +10,81 @@ using namespace ast;
 
 constexpr std::string error_source = "parser";
 
-auto Parser::chop() -> std::optional<Token> {
-    if (tokens.empty())
-        return std::nullopt;
-    auto token = tokens.front();
-    tokens = tokens.subspan(1);
-    return token;
-}
+auto Parser::pull() -> std::optional<Token> {
+    if (!lexer) {
+        if (tokens.empty()) {
+            return std::nullopt;
+        }
+        auto token = tokens.front();
+        tokens = tokens.subspan(1);
+        token_count++;
+        return token;
+    }
 
-auto Parser::match_and_chop(TokenType type) -> std::optional<Token> {
-    if (tokens.empty())
-        return std::nullopt;
-    auto token = tokens.front();
-    if (token.token_type != type)
-        return std::nullopt;
-    tokens = tokens.subspan(1);
-    return token;
+    while (auto token = lexer->next_token()) {
+        if (*token) {
+            token_count++;
+            return (*token)->to_token();
+        }
+        errors.push_back(token->error());
+    }
+    return std::nullopt;
 }
 
-auto Parser::peek(uint64_t offset) -> std::optional<Token> {
-    if (tokens.size() <= offset)
-        return std::nullopt;
-    return tokens[offset];
+auto Parser::fill(uint64_t count) -> bool {
+    assert(count <= max_lookahead);
+    while (lookahead_size < count) {
+        auto token = pull();
+        if (!token) {
+            return false;
+        }
+        lookahead[(lookahead_start + lookahead_size) % max_lookahead] = std::move(*token);
+        lookahead_size++;
+    }
+    return true;
 }
 
 template <typename... TokenTypes> auto Parser::match_next(TokenTypes... expected) -> bool {
-    if (tokens.empty())
+    if (!fill(1))
         return false;
 
     std::initializer_list<TokenType> expected_types{expected...};
 
-    if (std::find(expected_types.begin(), expected_types.end(), tokens.front().token_type) == expected_types.end()) {
+    if (std::find(expected_types.begin(), expected_types.end(), lookahead[lookahead_start].token_type) ==
+        expected_types.end()) {
         return false;
     }
     return true;
 }
 
+auto Parser::chop() -> std::optional<Token> {
+    if (!fill(1))
+        return std::nullopt;
+    auto token = std::move(lookahead[lookahead_start]);
+    lookahead_start = (lookahead_start + 1) % max_lookahead;
+    lookahead_size--;
+    return token;
+}
+
+auto Parser::match_and_chop(TokenType type) -> std::optional<Token> {
+    if (!match_next(type))
+        return std::nullopt;
+    return chop();
+}
+
+auto Parser::peek(uint64_t offset) -> std::optional<Token> {
+    if (!fill(offset + 1))
+        return std::nullopt;
+    return lookahead[(lookahead_start + offset) % max_lookahead];
+}
+
 template <typename... TokenTypes> auto Parser::expect(TokenTypes... types) -> std::optional<Token> {
-    if (tokens.empty()) {
+    auto chopped = chop();
+    if (!chopped) {
         errors.push_back(Error{.source = error_source, .message = "Unexpected end of file", .line = 0, .column = 0});
         return std::nullopt;
     }
-    auto token = tokens.front();
-    tokens = tokens.subspan(1);
+    auto token = std::move(*chopped);
 
     std::initializer_list<TokenType> expected_types{types...};
 
@@ -3,7 +3,9 @@
 #include "ast.hpp"
 #include "error.hpp"
 #include "expected.hpp"
+#include "lexer.hpp"
 #include "token.hpp"
+#include <array>
 #include <span>
 #include <vector>
 
@@ -15,8 +17,12 @@ class Parser {
   public:
     Parser() = delete;
     Parser(const std::span<Token> &tokens) : tokens(tokens){};
+    /// Pulls the tokens from the lexer while parsing, errors of the lexer are reported as errors of the parser
+    Parser(Lexer &lexer) : lexer(&lexer){};
 
     auto get_errors() const -> const std::vector<Error> & { return errors; }
+    /// Tokens taken from the input so far
+    auto get_token_count() const -> uint64_t { return token_count; }
 
     auto parse_program() -> std::optional<program_type>;
     auto parse_procedure() -> std::optional<ast::Procedure>;
@@ -41,7 +47,20 @@ class Parser {
     auto parse_repeat() -> std::optional<ast::Command>;
 
   private:
-    std::span<Token> tokens;
+    /// Makes at least `count` tokens available to peek, fewer only at the end of the input
+    auto fill(uint64_t count) -> bool;
+    auto pull() -> std::optional<Token>;
+
+    // Longest lookahead of the grammar, peek(1) before an assignment or a call
+    static constexpr auto max_lookahead = 2u;
+
+    std::span<Token> tokens{};
+    Lexer *lexer = nullptr;
+    // Tokens pulled from the lexer but not chopped yet
+    std::array<Token, max_lookahead> lookahead{};
+    uint64_t lookahead_start = 0;
+    uint64_t lookahead_size = 0;
+    uint64_t token_count = 0;
 
     std::vector<Error> errors{};
     ast::Program program{};
@@ -0,0 +1,203 @@
+#include "pass-manager.hpp"
+#include "flat-ast.hpp"
+#include "instruction.hpp"
+#include <algorithm>
+#include <chrono>
+#include <format>
+
+namespace passes {
+
+namespace {
+
+using enum OptimizationLevel;
+
+auto make_passes() -> std::vector<Pass> {
+    auto passes = std::vector<Pass>{};
+    const auto ast_pass = [&](std::string name, OptimizationLevel level, std::vector<std::string> requirements,
+                              std::function<void(AstOptimizer &)> run) {
+        passes.push_back(Pass{std::move(name), level, std::move(requirements), std::move(run)});
+    };
+    const auto emitter_pass = [&](std::string name, OptimizationLevel level, bool emitter::Features::*feature) {
+        passes.push_back(Pass{std::move(name), level, {}, {}, feature});
+    };
+    const auto line_pass = [&](std::string name, OptimizationLevel level, std::function<void(emitter::Emitter &)> run) {
+        passes.push_back(Pass{std::move(name), level, {}, {}, nullptr, std::move(run)});
+    };
+
+    ast_pass("calculate-procedure-call-counts", O2, {},
+             [](AstOptimizer &optimizer) { optimizer.calculate_procedure_call_counts(); });
+    ast_pass("inline-procedures", O2, {"calculate-procedure-call-counts"},
+             [](AstOptimizer &optimizer) { optimizer.inline_procedures(); });
+    ast_pass("scalarize-arrays", O2, {}, [](AstOptimizer &optimizer) { optimizer.scalarize_arrays(); });
+    ast_pass("evaluate-constant-prefix", O3, {}, [](AstOptimizer &optimizer) { optimizer.evaluate_constant_prefix(); });
+    ast_pass("propagate-constants", O1, {}, [](AstOptimizer &optimizer) { optimizer.propagate_constants(); });
+    ast_pass("unroll-loops-fully", O3, {}, [](AstOptimizer &optimizer) { optimizer.unroll_loops_fully(); });
+    ast_pass("unroll-loops", O3, {}, [](AstOptimizer &optimizer) { optimizer.unroll_loops(); });
+    ast_pass("eliminate-common-subexpressions", O2, {},
+             [](AstOptimizer &optimizer) { optimizer.eliminate_common_subexpressions(); });
+    emitter_pass("specialize-calls", O2, &emitter::Features::specialize_calls);
+    emitter_pass("pass-arguments-in-registers", O1, &emitter::Features::pass_arguments_in_registers);
+    emitter_pass("overlap-frames", O1, &emitter::Features::overlap_frames);
+    emitter_pass("layout-hot-variables", O1, &emitter::Features::layout_hot_variables);
+    emitter_pass("rotate-loops", O1, &emitter::Features::rotate_loops);
+    emitter_pass("simplify-expressions", O1, &emitter::Features::simplify_expressions);
+    emitter_pass("reuse-mar", O1, &emitter::Features::reuse_mar);
+    line_pass("apply-peephole-rules", O1, [](emitter::Emitter &emitter) { emitter.apply_peephole_rules(); });
+    line_pass("remove-redundant-jumps", O1, [](emitter::Emitter &emitter) { emitter.remove_redundant_jumps(); });
+
+    return passes;
+}
+
+auto find_pass(std::string_view name) -> std::optional<size_t> {
+    const auto &passes = PassManager::get_passes();
+    const auto it = std::ranges::find(passes, name, &Pass::name);
+    return it == passes.end() ? std::nullopt : std::optional{static_cast<size_t>(it - passes.begin())};
+}
+
+/// Estimated instructions of the whole program
+auto program_size(AstOptimizer &optimizer, const ast::Program &program) -> int64_t {
+    auto size = int64_t{optimizer.calculate_commands_cost(program.main.commands)};
+    for (const auto &procedure : program.procedures) {
+        size += optimizer.calculate_commands_cost(procedure.context.commands);
+    }
+    return size;
+}
+
+auto lines_cost(const std::vector<instruction::Line> &lines) -> int64_t {
+    auto cost = int64_t{0};
+    for (const auto &line : lines) {
+        cost += static_cast<int64_t>(instruction::cost(line.instruction));
+    }
+    return cost;
+}
+
+auto seconds_since(std::chrono::steady_clock::time_point start) -> double {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+auto parse_optimization_level(std::string_view level) -> std::optional<OptimizationLevel> {
+    if (level.size() != 1 || level[0] < '0' || level[0] > '3') {
+        return std::nullopt;
+    }
+    return static_cast<OptimizationLevel>(level[0] - '0');
+}
+
+auto PassManager::get_passes() -> const std::vector<Pass> & {
+    static const auto passes = make_passes();
+    return passes;
+}
+
+PassManager::PassManager(OptimizationLevel level) {
+    for (const auto &pass : get_passes()) {
+        enabled.push_back(pass.level <= level);
+    }
+}
+
+auto PassManager::enable(std::string_view name) -> bool {
+    const auto index = find_pass(name);
+    if (!index) {
+        return false;
+    }
+    enabled[*index] = true;
+    for (const auto &requirement : get_passes()[*index].requirements) {
+        enable(requirement);
+    }
+    return true;
+}
+
+auto PassManager::disable(std::string_view name) -> bool {
+    const auto index = find_pass(name);
+    if (!index) {
+        return false;
+    }
+    enabled[*index] = false;
+    for (auto i = 0u; i < enabled.size(); i++) {
+        if (enabled[i] && std::ranges::find(get_passes()[i].requirements, name) != get_passes()[i].requirements.end()) {
+            disable(get_passes()[i].name);
+        }
+    }
+    return true;
+}
+
+auto PassManager::is_enabled(std::string_view name) const -> bool {
+    const auto index = find_pass(name);
+    return index && enabled[*index];
+}
+
+void PassManager::run_ast_passes(ast::Program &program, const Profile *profile, PhaseReport *report) {
+    auto optimizer = AstOptimizer(&program, profile);
+
+    for (auto i = 0u; i < enabled.size(); i++) {
+        const auto &pass = get_passes()[i];
+        if (!enabled[i] || !pass.run_on_ast) {
+            continue;
+        }
+
+        const auto size = program_size(optimizer, program);
+        if (report) {
+            report->begin(pass.name);
+        }
+        const auto start = std::chrono::steady_clock::now();
+
+        pass.run_on_ast(optimizer);
+
+        const auto seconds = seconds_since(start);
+        if (report) {
+            report->end();
+            // Counted outside of the time of the pass
+            report->record("ast_nodes", ast::flat::flatten(program).node_count());
+        }
+        stats.push_back(PassStats{pass.name, seconds, size - program_size(optimizer, program)});
+    }
+}
+
+auto PassManager::get_emitter_features() const -> emitter::Features {
+    auto features = emitter::Features{};
+    for (auto i = 0u; i < enabled.size(); i++) {
+        if (const auto feature = get_passes()[i].emitter_feature) {
+            features.*feature = enabled[i];
+        }
+    }
+    return features;
+}
+
+void PassManager::run_line_passes(emitter::Emitter &emitter, PhaseReport *report) {
+    for (auto i = 0u; i < enabled.size(); i++) {
+        const auto &pass = get_passes()[i];
+        if (!enabled[i] || !pass.run_on_lines) {
+            continue;
+        }
+
+        const auto lines = static_cast<int64_t>(emitter.get_lines().size());
+        const auto cost = lines_cost(emitter.get_lines());
+        if (report) {
+            report->begin(pass.name);
+        }
+        const auto start = std::chrono::steady_clock::now();
+
+        pass.run_on_lines(emitter);
+
+        const auto seconds = seconds_since(start);
+        if (report) {
+            report->end();
+            report->record("lines", emitter.get_lines().size());
+        }
+        stats.push_back(PassStats{pass.name, seconds, lines - static_cast<int64_t>(emitter.get_lines().size()),
+                                  cost - lines_cost(emitter.get_lines())});
+    }
+}
+
+void write_stats(std::ostream &output, const std::vector<PassStats> &stats) {
+    output << std::format("{:<34} {:>10} {:>22} {:>12}\n", "pass", "wall ms", "instructions removed", "cost saved");
+    for (const auto &pass : stats) {
+        const auto cost_saved = pass.cost_saved ? std::to_string(*pass.cost_saved) : "-";
+        output << std::format("{:<34} {:>10.3f} {:>22} {:>12}\n", pass.name, pass.seconds * 1000.0,
+                              pass.instructions_removed, cost_saved);
+    }
+}
+
+void PassManager::write_stats(std::ostream &output) const { passes::write_stats(output, stats); }
+
+} // namespace passes
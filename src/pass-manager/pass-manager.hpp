@@ -0,0 +1,75 @@
+#pragma once
+#include "ast-optimizer.hpp"
+#include "ast.hpp"
+#include "emitter.hpp"
+#include "phase-report.hpp"
+#include "profile.hpp"
+#include <functional>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace passes {
+
+enum class OptimizationLevel { O0, O1, O2, O3 };
+
+/// Parses the digit of -O0 .. -O3, nullopt for anything else
+auto parse_optimization_level(std::string_view level) -> std::optional<OptimizationLevel>;
+
+/// A pass runs on the AST before it is emitted, switches an optimization of the emitter or runs on the lines the
+/// emitter produced, exactly one of `run_on_ast`, `emitter_feature` and `run_on_lines` is set
+struct Pass {
+    std::string name;
+    // Lowest level the pass runs at
+    OptimizationLevel level;
+    // Passes that have to run before this one, they are enabled and disabled together with it
+    std::vector<std::string> requirements{};
+    std::function<void(AstOptimizer &)> run_on_ast{};
+    bool emitter::Features::*emitter_feature = nullptr;
+    std::function<void(emitter::Emitter &)> run_on_lines{};
+};
+
+struct PassStats {
+    std::string name;
+    double seconds = 0;
+    // Estimated by AstOptimizer::calculate_commands_cost for AST passes, counted for passes over the lines
+    int64_t instructions_removed = 0;
+    // Cycles of the instructions removed if each ran once, only known for passes over the lines
+    std::optional<int64_t> cost_saved{};
+};
+
+/// Table of the stats, one row per pass
+void write_stats(std::ostream &output, const std::vector<PassStats> &stats);
+
+/// Runs the passes of an optimization level in the order they are registered, passes can be enabled or disabled one by
+/// one on top of the level
+class PassManager {
+  public:
+    explicit PassManager(OptimizationLevel level = OptimizationLevel::O3);
+
+    /// All passes in the order they run
+    static auto get_passes() -> const std::vector<Pass> &;
+
+    /// Enables the pass and the passes it requires, false if there is no pass with that name
+    auto enable(std::string_view name) -> bool;
+    /// Disables the pass and the passes requiring it, false if there is no pass with that name
+    auto disable(std::string_view name) -> bool;
+    auto is_enabled(std::string_view name) const -> bool;
+
+    /// The report, if given, gets a phase for every pass that runs
+    void run_ast_passes(ast::Program &program, const Profile *profile, PhaseReport *report = nullptr);
+    /// What the emitter optimizes while emitting, these passes run as part of it and have no stats of their own
+    auto get_emitter_features() const -> emitter::Features;
+    void run_line_passes(emitter::Emitter &emitter, PhaseReport *report = nullptr);
+
+    auto get_stats() const -> const std::vector<PassStats> & { return stats; }
+    void write_stats(std::ostream &output) const;
+
+  private:
+    std::vector<bool> enabled{};
+    std::vector<PassStats> stats{};
+};
+
+} // namespace passes
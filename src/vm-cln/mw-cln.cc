@@ -24,7 +24,7 @@
 #include <stack>
 
 ProgramState<cln::cl_I> run_machine(const std::vector<instruction::Line> &lines, ReadHandler *read_handler,
-                                    WriteHandler<cln::cl_I> *write_handler) {
+                                    WriteHandler<cln::cl_I> *write_handler, std::vector<uint64_t> *line_counts) {
     std::map<long long, cln::cl_I> pam;
 
     std::vector<cln::cl_I> outputs;
@@ -42,8 +42,15 @@ ProgramState<cln::cl_I> run_machine(const std::vector<instruction::Line> &lines,
     t = 0;
     io = 0;
 
+    if (line_counts) {
+        line_counts->assign(lines.size(), 0);
+    }
+
     while (!std::holds_alternative<instruction::Halt>(lines[lr].instruction)) // HALT
     {
+        if (line_counts) {
+            (*line_counts)[lr]++;
+        }
         std::visit(overloaded{[&](const instruction::Read &) {
                                   r[0] = read_handler->get_next_input();
                                   io += 100;
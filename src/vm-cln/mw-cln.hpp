@@ -8,5 +8,7 @@
 #include <emitter.hpp>
 #include <map>
 
+// `line_counts`, when given, receives how many times every line ran
 ProgramState<cln::cl_I> run_machine(const std::vector<instruction::Line> &lines, ReadHandler *read_handler,
-                                    WriteHandler<cln::cl_I> *write_handler);
+                                    WriteHandler<cln::cl_I> *write_handler,
+                                    std::vector<uint64_t> *line_counts = nullptr);
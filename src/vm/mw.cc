@@ -13,8 +13,8 @@
 #include <utility>
 #include <vector>
 
-#include <cstdlib> // rand()
 #include <ctime>
+#include <random>
 
 #include "common.hpp"
 #include "mw.hpp"
@@ -34,27 +34,40 @@ auto ReadHandlerDeque::get_next_input() -> uint64_t {
     return input;
 }
 
-ProgramState<long long> run_machine(const std::vector<instruction::Line> &lines, ReadHandler *read_handler,
-                                    WriteHandler<uint64_t> *write_handler) {
-    std::map<long long, long long> pam;
+ProgramState<uint64_t> run_machine(const std::vector<instruction::Line> &lines, ReadHandler *read_handler,
+                                   WriteHandler<uint64_t> *write_handler, std::vector<uint64_t> *line_counts,
+                                   uint64_t max_steps) {
+    std::map<long long, uint64_t> pam;
 
     std::vector<uint64_t> outputs;
 
-    std::array<long long, 8> r;
+    std::array<uint64_t, 8> r;
     // long long tmp;
     long long lr;
 
     long long t, io;
 
     lr = 0;
-    srand((unsigned int)time(NULL));
+    // A generator of its own, rand() would share its state with the machines running on other threads
+    std::minstd_rand random((unsigned int)time(NULL));
     for (int i = 0; i < 8; i++)
-        r[i] = rand();
+        r[i] = random();
+    uint64_t steps = 0;
     t = 0;
     io = 0;
 
+    if (line_counts) {
+        line_counts->assign(lines.size(), 0);
+    }
+
     while (!std::holds_alternative<instruction::Halt>(lines[lr].instruction)) // HALT
     {
+        if (++steps > max_steps) {
+            return ProgramState<uint64_t>{.r = r, .pam = pam, .t =t, .io=io, .error=true, .out_of_steps=true};
+        }
+        if (line_counts) {
+            (*line_counts)[lr]++;
+        }
         std::visit(overloaded{[&](const instruction::Read &) {
                                   r[0] = read_handler->get_next_input();
                                   io += 100;
@@ -153,7 +166,7 @@ ProgramState<long long> run_machine(const std::vector<instruction::Line> &lines,
                    lines[lr].instruction);
 
         if (lr < 0 || lr >= (int)lines.size()) {
-            return ProgramState<long long>{.r = r, .pam = pam, .t =t, .io=io, .error=true};
+            return ProgramState<uint64_t>{.r = r, .pam = pam, .t =t, .io=io, .error=true};
             // cerr << cRed << "Błąd: Wywołanie nieistniejącej instrukcji nr "
             // << lr << "." << cReset << endl;
             // exit(-1);
@@ -167,5 +180,5 @@ ProgramState<long long> run_machine(const std::vector<instruction::Line> &lines,
         //     std::cout << "p[" << p.first << "] = " << p.second << std::endl;
     }
 
-    return ProgramState<long long>{.r = r, .pam = pam, .t =t, .io=io, .error=false};
+    return ProgramState<uint64_t>{.r = r, .pam = pam, .t =t, .io=io, .error=false};
 }
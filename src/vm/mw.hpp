@@ -5,6 +5,7 @@
 #include <cstdint>
 #include <deque>
 #include <iostream>
+#include <limits>
 #include <map>
 #include <vector>
 
@@ -14,6 +15,8 @@ template <typename T> struct ProgramState {
     long long t;
     long long io;
     bool error;
+    // The machine was stopped after `max_steps` instructions, `error` is set as well
+    bool out_of_steps = false;
 };
 
 class ReadHandler {
@@ -56,5 +59,7 @@ template <typename T> class WriteHandlerVector : public WriteHandler<T> {
     std::vector<T> outputs;
 };
 
-ProgramState<long long> run_machine(const std::vector<instruction::Line> &lines, ReadHandler *read_handler,
-                                    WriteHandler<uint64_t> *write_handler);
+// The registers are 64-bit and wrap around. `line_counts`, when given, receives how many times every line ran
+ProgramState<uint64_t> run_machine(const std::vector<instruction::Line> &lines, ReadHandler *read_handler,
+                                   WriteHandler<uint64_t> *write_handler, std::vector<uint64_t> *line_counts = nullptr,
+                                   uint64_t max_steps = std::numeric_limits<uint64_t>::max());
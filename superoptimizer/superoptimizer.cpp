@@ -0,0 +1,415 @@
+// Enumerates the straight-line sequences of up to N instructions and looks for a cheaper sequence that leaves every
+// register and the memory in the same state. The rules found are printed as the table the emitter applies as its
+// peephole pass, regenerate it with
+//
+//     superoptimizer 3 > src/emitter/peephole-rules.inc
+//
+// Sequences are first grouped by their results from a fixed set of random states. Every rule is then verified by
+// running both sides on the virtual machine from all states with values 0..3 in the registers involved (which covers
+// aliased memory addresses and the saturation of SUB and DEC) and from random states. The machine the code runs on
+// may have 64-bit registers, so the rules must also hold where ADD and SHL wrap around: both sides are executed from
+// the states with the values 0, 1, 2^63 and 2^64 - 1 in the registers involved as well.
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <format>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "common.hpp"
+#include "instruction.hpp"
+#include "mw.hpp"
+
+using namespace instruction;
+
+namespace {
+
+enum class Opcode : uint8_t { Load, Store, Add, Sub, Get, Put, Rst, Inc, Dec, Shl, Shr };
+
+constexpr auto opcodes =
+    std::array{Opcode::Load, Opcode::Store, Opcode::Add, Opcode::Sub, Opcode::Get, Opcode::Put,
+               Opcode::Rst,  Opcode::Inc,   Opcode::Dec, Opcode::Shl, Opcode::Shr};
+
+constexpr auto mnemonics = std::array{"LOAD", "STORE", "ADD", "SUB", "GET", "PUT", "RST", "INC", "DEC", "SHL", "SHR"};
+
+// Operand 0 is the accumulator, the others are distinct registers other than A named x, y and z in the rules
+constexpr auto operand_count = 4u;
+constexpr auto operand_names = std::array{"a", "x", "y", "z"};
+// Registers the operands run on in the machine, H holds an address while the memory is set up
+constexpr auto operand_registers = std::array{Register::A, Register::C, Register::D, Register::E};
+
+// Keeps the values of random states far from overflowing a long long after a few additions and shifts
+constexpr auto random_value_bits = 40u;
+constexpr auto fingerprint_states = 24u;
+constexpr auto random_verification_states = 64u;
+
+struct Operation {
+    Opcode opcode;
+    uint8_t operand;
+
+    auto operator==(const Operation &other) const -> bool = default;
+};
+
+using Sequence = std::vector<Operation>;
+
+auto cost(const Operation &operation) -> uint64_t {
+    switch (operation.opcode) {
+    case Opcode::Load:
+    case Opcode::Store:
+        return 50;
+    case Opcode::Add:
+    case Opcode::Sub:
+        return 5;
+    default:
+        return 1;
+    }
+}
+
+auto cost(const Sequence &sequence) -> uint64_t {
+    auto total = uint64_t{0};
+    for (const auto &operation : sequence) {
+        total += cost(operation);
+    }
+    return total;
+}
+
+auto to_string(const Sequence &sequence) -> std::string {
+    auto result = std::string{};
+    for (const auto &operation : sequence) {
+        if (!result.empty()) {
+            result += "; ";
+        }
+        result += std::format("{} {}", mnemonics[static_cast<size_t>(operation.opcode)],
+                              operand_names[operation.operand]);
+    }
+    return result;
+}
+
+auto used_operands(const Sequence &sequence) -> unsigned {
+    auto used = 0u;
+    for (const auto &operation : sequence) {
+        used |= 1u << operation.operand;
+    }
+    return used;
+}
+
+/// Renames the registers other than A in the order they first appear, so that sequences equal up to the choice of
+/// registers share one form
+auto canonicalize(const Sequence &sequence) -> Sequence {
+    auto names = std::array<uint8_t, operand_count>{0, 0, 0, 0};
+    auto next = uint8_t{1};
+    auto result = sequence;
+    for (auto &operation : result) {
+        if (operation.operand == 0) {
+            continue;
+        }
+        if (names[operation.operand] == 0) {
+            names[operation.operand] = next++;
+        }
+        operation.operand = names[operation.operand];
+    }
+    return result;
+}
+
+auto key(const Sequence &sequence) -> uint64_t {
+    auto result = uint64_t{1};
+    for (const auto &operation : sequence) {
+        result = result * 64 + static_cast<uint64_t>(operation.opcode) * operand_count + operation.operand;
+    }
+    return result;
+}
+
+struct State {
+    std::array<uint64_t, operand_count> registers;
+    // Cells not listed hold 0, like in the machine
+    std::map<uint64_t, uint64_t> memory;
+};
+
+/// Executes the sequence with the semantics of the machine
+void execute(const Sequence &sequence, State &state) {
+    auto &a = state.registers[0];
+    for (const auto &operation : sequence) {
+        auto &operand = state.registers[operation.operand];
+        switch (operation.opcode) {
+        case Opcode::Load: {
+            const auto it = state.memory.find(operand);
+            a = it == state.memory.end() ? 0 : it->second;
+        } break;
+        case Opcode::Store:
+            state.memory[operand] = a;
+            break;
+        case Opcode::Add:
+            a += operand;
+            break;
+        case Opcode::Sub:
+            a = a > operand ? a - operand : 0;
+            break;
+        case Opcode::Get:
+            a = operand;
+            break;
+        case Opcode::Put:
+            operand = a;
+            break;
+        case Opcode::Rst:
+            operand = 0;
+            break;
+        case Opcode::Inc:
+            operand++;
+            break;
+        case Opcode::Dec:
+            operand = operand > 0 ? operand - 1 : 0;
+            break;
+        case Opcode::Shl:
+            operand <<= 1;
+            break;
+        case Opcode::Shr:
+            operand >>= 1;
+            break;
+        }
+    }
+}
+
+auto normalized_memory(const std::map<uint64_t, uint64_t> &memory) -> std::map<uint64_t, uint64_t> {
+    auto result = memory;
+    std::erase_if(result, [](const auto &cell) { return cell.second == 0; });
+    return result;
+}
+
+auto random_state(std::mt19937_64 &random) -> State {
+    auto state = State{};
+    for (auto &value : state.registers) {
+        value = random() >> (64 - random_value_bits);
+    }
+    for (const auto value : state.registers) {
+        state.memory[value] = random() >> (64 - random_value_bits);
+    }
+    return state;
+}
+
+/// Every state with the registers holding 0..3 and the memory at those addresses holding one of two patterns
+auto small_states() -> std::vector<State> {
+    auto states = std::vector<State>{};
+    for (auto values = 0u; values < 256; values++) {
+        for (auto pattern = 0u; pattern < 2; pattern++) {
+            auto state = State{};
+            for (auto i = 0u; i < operand_count; i++) {
+                state.registers[i] = (values >> (2 * i)) & 3;
+            }
+            for (auto address = 0u; address < 4; address++) {
+                state.memory[address] = pattern == 0 ? address + 1 : 7 - address;
+            }
+            states.push_back(state);
+        }
+    }
+    return states;
+}
+
+/// Every state with the registers holding 0, 1, 2^63 or 2^64 - 1, where adding or shifting wraps around
+auto wraparound_states() -> std::vector<State> {
+    constexpr auto values = std::array{uint64_t{0}, uint64_t{1}, uint64_t{1} << 63, ~uint64_t{0}};
+
+    auto states = std::vector<State>{};
+    for (auto combination = 0u; combination < 256; combination++) {
+        auto state = State{};
+        for (auto i = 0u; i < operand_count; i++) {
+            state.registers[i] = values[(combination >> (2 * i)) & 3];
+        }
+        for (auto i = 0u; i < values.size(); i++) {
+            state.memory[values[i]] = ~uint64_t{0} - i;
+        }
+        states.push_back(state);
+    }
+    return states;
+}
+
+/// Machine code setting a register to the value with RST, INC and SHL
+void set_register(std::vector<Line> &lines, Register reg, uint64_t value) {
+    lines.push_back({Rst{reg}});
+    auto started = false;
+    for (auto bit = 63; bit >= 0; bit--) {
+        if (started) {
+            lines.push_back({Shl{reg}});
+        }
+        if ((value >> bit) & 1) {
+            lines.push_back({Inc{reg}});
+            started = true;
+        }
+    }
+}
+
+auto to_instruction(const Operation &operation) -> Instruction {
+    auto instruction = *mnemonic_from_string(mnemonics[static_cast<size_t>(operation.opcode)]);
+    set_instruction_register(instruction, operand_registers[operation.operand]);
+    return instruction;
+}
+
+/// Runs the sequence on the virtual machine from the state and reads the state back
+auto run_on_machine(const Sequence &sequence, const State &state) -> State {
+    auto lines = std::vector<Line>{};
+    for (auto i = 1u; i < operand_count; i++) {
+        set_register(lines, operand_registers[i], state.registers[i]);
+    }
+    for (const auto &[address, value] : state.memory) {
+        set_register(lines, Register::H, address);
+        set_register(lines, Register::A, value);
+        lines.push_back({Store{Register::H}});
+    }
+    set_register(lines, Register::A, state.registers[0]);
+
+    for (const auto &operation : sequence) {
+        lines.push_back({to_instruction(operation)});
+    }
+    lines.push_back({Halt{}});
+
+    auto read_handler = ReadHandlerDeque({});
+    auto write_handler = WriteHandlerVector<uint64_t>();
+    const auto machine = run_machine(lines, &read_handler, &write_handler);
+
+    auto result = State{};
+    for (auto i = 0u; i < operand_count; i++) {
+        result.registers[i] = machine.r[static_cast<size_t>(operand_registers[i])];
+    }
+    for (const auto &[address, value] : machine.pam) {
+        result.memory[address] = value;
+    }
+    return result;
+}
+
+auto equivalent_on_machine(const Sequence &lhs, const Sequence &rhs, const std::vector<State> &states) -> bool {
+    return std::ranges::all_of(states, [&](const State &state) {
+        const auto lhs_result = run_on_machine(lhs, state);
+        const auto rhs_result = run_on_machine(rhs, state);
+        return lhs_result.registers == rhs_result.registers &&
+               normalized_memory(lhs_result.memory) == normalized_memory(rhs_result.memory);
+    });
+}
+
+/// These states are only executed on the model, setting up values near 2^64 on the machine takes long sequences
+auto equivalent_with_wraparound(const Sequence &lhs, const Sequence &rhs, const std::vector<State> &states) -> bool {
+    return std::ranges::all_of(states, [&](const State &state) {
+        auto lhs_result = state;
+        auto rhs_result = state;
+        execute(lhs, lhs_result);
+        execute(rhs, rhs_result);
+        return lhs_result.registers == rhs_result.registers &&
+               normalized_memory(lhs_result.memory) == normalized_memory(rhs_result.memory);
+    });
+}
+
+auto fingerprint(const Sequence &sequence, const std::vector<State> &states) -> uint64_t {
+    auto hash = uint64_t{14695981039346656037u};
+    auto mix = [&](uint64_t value) { hash = (hash ^ value) * 1099511628211u; };
+    for (auto state : states) {
+        execute(sequence, state);
+        for (const auto value : state.registers) {
+            mix(value);
+        }
+        for (const auto &[address, value] : state.memory) {
+            if (value != 0) {
+                mix(address);
+                mix(value);
+            }
+        }
+    }
+    return hash;
+}
+
+/// All sequences of exactly `length` operations
+void enumerate(Sequence &prefix, unsigned length, std::vector<Sequence> &result) {
+    if (prefix.size() == length) {
+        result.push_back(prefix);
+        return;
+    }
+    for (const auto opcode : opcodes) {
+        for (auto operand = uint8_t{0}; operand < operand_count; operand++) {
+            prefix.push_back({opcode, operand});
+            enumerate(prefix, length, result);
+            prefix.pop_back();
+        }
+    }
+}
+
+} // namespace
+
+auto main(int argc, char **argv) -> int {
+    const auto max_length = argc > 1 ? std::stoul(argv[1]) : 3ul;
+
+    auto random = std::mt19937_64{2023};
+    auto fingerprint_set = std::vector<State>{};
+    for (auto i = 0u; i < fingerprint_states; i++) {
+        fingerprint_set.push_back(random_state(random));
+    }
+    auto verification_set = small_states();
+    for (auto i = 0u; i < random_verification_states; i++) {
+        verification_set.push_back(random_state(random));
+    }
+    const auto wraparound_set = wraparound_states();
+
+    auto sequences = std::vector<Sequence>{};
+    for (auto length = 0u; length <= max_length; length++) {
+        auto prefix = Sequence{};
+        enumerate(prefix, length, sequences);
+    }
+
+    // Cheapest sequence for every fingerprint, shorter and then earlier ones win ties
+    auto fingerprints = std::vector<uint64_t>(sequences.size());
+    auto cheapest = std::unordered_map<uint64_t, size_t>{};
+    for (auto i = 0u; i < sequences.size(); i++) {
+        fingerprints[i] = fingerprint(sequences[i], fingerprint_set);
+        const auto [it, inserted] = cheapest.emplace(fingerprints[i], i);
+        if (!inserted && cost(sequences[i]) < cost(sequences[it->second])) {
+            it->second = i;
+        }
+    }
+
+    std::cout << std::format(
+        "// Generated by superoptimizer/superoptimizer.cpp from sequences of up to {} instructions, do not edit.\n",
+        max_length);
+    std::cout << "// Each rule leaves all registers and the memory as the sequence it replaces does. x, y and z stand\n"
+                 "// for distinct registers other than a.\n";
+
+    auto reducible = std::unordered_set<uint64_t>{};
+    auto rules = 0u;
+    for (auto i = 0u; i < sequences.size(); i++) {
+        // Rules are written for the canonical form of the sequences they replace, the replacement may use the
+        // registers in any order
+        const auto &sequence = sequences[i];
+        const auto &replacement = sequences[cheapest.at(fingerprints[i])];
+        if (sequence.empty() || canonicalize(sequence) != sequence || cost(replacement) >= cost(sequence)) {
+            continue;
+        }
+        if ((used_operands(replacement) & ~used_operands(sequence)) != 0) {
+            continue;
+        }
+
+        // Rules whose part is already covered by a shorter rule never match once that one is applied
+        auto covered = false;
+        for (auto start = 0u; start < sequence.size() && !covered; start++) {
+            for (auto end = start + 1; end <= sequence.size() && !covered; end++) {
+                if (end - start == sequence.size()) {
+                    continue;
+                }
+                const auto part = Sequence(sequence.begin() + start, sequence.begin() + end);
+                covered = reducible.contains(key(canonicalize(part)));
+            }
+        }
+        if (covered || !equivalent_on_machine(sequence, replacement, verification_set) ||
+            !equivalent_with_wraparound(sequence, replacement, wraparound_set)) {
+            continue;
+        }
+
+        reducible.insert(key(sequence));
+        std::cout << std::format("{{\"{}\", \"{}\"}},\n", to_string(sequence), to_string(replacement));
+        rules++;
+    }
+
+    std::cerr << std::format("{} sequences, {} rules", sequences.size(), rules) << std::endl;
+    return 0;
+}
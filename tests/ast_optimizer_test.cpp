@@ -0,0 +1,814 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "analyzer.hpp"
+#include "ast-optimizer.hpp"
+#include "emitter.hpp"
+#include "lexer.hpp"
+#include "mw.hpp"
+#include "parser.hpp"
+#include "simplifier.hpp"
+#include "tests_shared.hpp"
+#include <array>
+#include <format>
+#include <memory>
+#include <sstream>
+
+auto emit_optimized(const std::string &source, const Profile *profile) -> emitter::Emitter {
+    auto lexer = Lexer(source);
+
+    auto parser = parser::Parser(lexer);
+
+    auto program = parser.parse_program();
+
+    REQUIRE(program.has_value());
+    REQUIRE(parser.get_errors().empty());
+
+    auto analyzer = analyzer::Analyzer(*program);
+
+    analyzer.analyze();
+
+    // Warnings (e.g. unused variables) are fine
+    for (const auto &error : analyzer.get_errors()) {
+        REQUIRE(error.is_warning);
+    }
+
+    auto ast_optimizer = AstOptimizer(&*program, profile);
+
+    ast_optimizer.calculate_procedure_call_counts();
+    ast_optimizer.inline_procedures();
+    ast_optimizer.scalarize_arrays();
+    ast_optimizer.evaluate_constant_prefix();
+    ast_optimizer.propagate_constants();
+    ast_optimizer.unroll_loops_fully();
+    ast_optimizer.unroll_loops();
+    ast_optimizer.eliminate_common_subexpressions();
+
+    auto emitter = emitter::Emitter(std::move(*program), profile);
+
+    emitter.emit();
+
+    REQUIRE(emitter.get_errors().empty());
+
+    return emitter;
+}
+
+auto compile_optimized(const std::string &source, const Profile *profile = nullptr) -> std::vector<instruction::Line> {
+    return emit_optimized(source, profile).get_lines();
+}
+
+auto run_program(const std::vector<instruction::Line> &lines, std::deque<uint64_t> inputs = {})
+    -> std::vector<uint64_t> {
+    auto read_handler = std::make_unique<ReadHandlerDeque>(std::move(inputs));
+    auto write_handler = std::make_unique<WriteHandlerVector<uint64_t>>();
+
+    const auto program_state = run_machine(lines, read_handler.get(), write_handler.get());
+
+    CHECK(!program_state.error);
+
+    return write_handler->get_outputs();
+}
+
+/// Profile of a run of the program on the inputs
+auto train(const std::string &source, std::deque<uint64_t> inputs) -> Profile {
+    const auto emitter = emit_optimized(source, nullptr);
+
+    auto read_handler = std::make_unique<ReadHandlerDeque>(std::move(inputs));
+    auto write_handler = std::make_unique<WriteHandlerVector<uint64_t>>();
+    auto line_counts = std::vector<uint64_t>{};
+
+    const auto program_state = run_machine(emitter.get_lines(), read_handler.get(), write_handler.get(), &line_counts);
+
+    CHECK(!program_state.error);
+
+    return Profile::from_line_counts(emitter.get_statement_lines(), line_counts);
+}
+
+template <typename Instruction> auto count_instructions(const std::vector<instruction::Line> &lines) -> size_t {
+    return std::ranges::count_if(
+        lines, [](const auto &line) { return std::holds_alternative<Instruction>(line.instruction); });
+}
+
+TEST_CASE("Constant propagation - folds arithmetic") {
+    const auto lines = compile_optimized(R"(
+        PROGRAM IS
+          a, b, c
+        IN
+          a := 3;
+          b := a * 4;
+          c := a - 5;
+          WRITE b;
+          WRITE c;
+        END
+    )");
+
+    CHECK(run_program(lines) == std::vector<uint64_t>{12, 0});
+    CHECK(count_instructions<instruction::Load>(lines) == 0);
+}
+
+TEST_CASE("Constant propagation - removes dead branches") {
+    const auto lines = compile_optimized(R"(
+        PROGRAM IS
+          a
+        IN
+          a := 1;
+          IF a > 2 THEN
+            WRITE 1;
+          ELSE
+            WRITE 2;
+          ENDIF
+          WHILE a = 0 DO
+            WRITE 3;
+          ENDWHILE
+        END
+    )");
+
+    CHECK(run_program(lines) == std::vector<uint64_t>{2});
+    // Not even the jump to main is left, main starts right after it
+    CHECK(count_instructions<instruction::Jump>(lines) == 0);
+    CHECK(count_instructions<instruction::Jpos>(lines) == 0);
+}
+
+TEST_CASE("Constant propagation - loops") {
+    SUBCASE("Loop counters are not constant") {
+        const auto lines = compile_optimized(R"(
+            PROGRAM IS
+              i, n, t[4]
+            IN
+              n := 3;
+              i := 0;
+              WHILE i < n DO
+                t[i] := i;
+                i := i + 1;
+              ENDWHILE
+              WRITE i;
+              i := 2;
+              WRITE t[i];
+            END
+        )");
+
+        CHECK(run_program(lines) == std::vector<uint64_t>{3, 2});
+    }
+
+    SUBCASE("Values overwritten after a read") {
+        const auto lines = compile_optimized(R"(
+            PROGRAM IS
+              a, b
+            IN
+              a := 1;
+              b := 2;
+              READ a;
+              REPEAT
+                a := a + 1;
+                b := 7;
+              UNTIL a > 10;
+              WRITE a;
+              WRITE b;
+            END
+        )");
+
+        CHECK(run_program(lines, {4}) == std::vector<uint64_t>{11, 7});
+        CHECK(run_program(lines, {20}) == std::vector<uint64_t>{21, 7});
+    }
+}
+
+TEST_CASE("Constant propagation - arguments passed to procedures are not constant") {
+    const auto lines = compile_optimized(R"(
+        PROCEDURE set(a, b) IS
+        IN
+          a := b;
+        END
+
+        PROGRAM IS
+          a, b, c
+        IN
+          a := 1;
+          b := 5;
+          c := 3;
+          set(a, b);
+          WRITE a;
+          IF a = c THEN
+            WRITE 1;
+          ENDIF
+        END
+    )");
+
+    CHECK(run_program(lines) == std::vector<uint64_t>{5});
+}
+
+TEST_CASE("Compile-time evaluation - programs without input") {
+    const auto lines = compile_optimized(R"(
+        PROCEDURE fill(T t, n) IS
+          i
+        IN
+          i := 0;
+          WHILE i < n DO
+            t[i] := i * i;
+            i := i + 1;
+          ENDWHILE
+        END
+
+        PROGRAM IS
+          t[10], n, i
+        IN
+          n := 10;
+          fill(t, n);
+          i := 0;
+          REPEAT
+            WRITE t[i];
+            i := i + 3;
+          UNTIL i >= n;
+        END
+    )");
+
+    CHECK(run_program(lines) == std::vector<uint64_t>{0, 9, 36, 81});
+    // fill is never called at runtime
+    CHECK(count_instructions<instruction::Strk>(lines) == 0);
+}
+
+TEST_CASE("Compile-time evaluation - stops at the first READ") {
+    const auto lines = compile_optimized(R"(
+        PROGRAM IS
+          t[3], a, b
+        IN
+          t[0] := 4;
+          t[1] := 5;
+          t[2] := t[0] * t[1];
+          WRITE t[2];
+          READ a;
+          b := a % 3;
+          WRITE t[b];
+        END
+    )");
+
+    CHECK(run_program(lines, {3}) == std::vector<uint64_t>{20, 4});
+    CHECK(run_program(lines, {4}) == std::vector<uint64_t>{20, 5});
+    CHECK(run_program(lines, {5}) == std::vector<uint64_t>{20, 20});
+}
+
+TEST_CASE("Compile-time evaluation - large memory") {
+    // Every command of the prefix is run on a checkpoint of the cells it writes instead of a copy of the memory
+    auto source = std::string{R"(
+        PROCEDURE bump(T t) IS
+          x
+        IN
+          t[0] := t[0] + 1;
+          READ x;
+          t[x] := t[0];
+        END
+
+        PROGRAM IS
+          t[1000000]
+        IN
+    )"};
+    for (auto i = 0u; i < 3000; i++) {
+        source += std::format("t[{}] := {};\n", i * 300, 2 * i + 10);
+    }
+    // bump stops at its READ after it has written t[0], the write is undone and bump runs in full at runtime
+    source += "bump(t); WRITE t[0]; WRITE t[300]; END";
+
+    const auto lines = compile_optimized(source);
+
+    CHECK(run_program(lines, {600}) == std::vector<uint64_t>{11, 12});
+    CHECK(run_program(lines, {300}) == std::vector<uint64_t>{11, 11});
+}
+
+TEST_CASE("Inlining - nested procedures") {
+    const auto lines = compile_optimized(R"(
+        PROCEDURE factorial(T s, n) IS
+          i, j
+        IN
+          s[0] := 1;
+          i := 1;
+          j := 0;
+          WHILE i <= n DO
+            s[i] := s[j] * i;
+            i := i + 1;
+            j := j + 1;
+          ENDWHILE
+        END
+
+        PROCEDURE bc(n, k, m) IS
+          s[100], p
+        IN
+          factorial(s, n);
+          p := n - k;
+          m := s[n] / s[k];
+          m := m / s[p];
+        END
+
+        PROGRAM IS
+          n, k, w
+        IN
+          READ n;
+          READ k;
+          bc(n, k, w);
+          WRITE w;
+        END
+    )");
+
+    CHECK(run_program(lines, {20, 9}) == std::vector<uint64_t>{167960});
+    CHECK(run_program(lines, {5, 2}) == std::vector<uint64_t>{10});
+    CHECK(count_instructions<instruction::Strk>(lines) == 0);
+}
+
+TEST_CASE("Inlining - calls in loops") {
+    const auto lines = compile_optimized(R"(
+        PROCEDURE swap(a, b) IS
+          t
+        IN
+          t := a;
+          a := b;
+          b := t;
+        END
+
+        PROGRAM IS
+          n, x, y
+        IN
+          READ n;
+          x := 1;
+          y := 2;
+          WHILE n > 0 DO
+            swap(x, y);
+            swap(y, x);
+            swap(x, y);
+            n := n - 1;
+          ENDWHILE
+          WRITE x;
+          WRITE y;
+        END
+    )");
+
+    CHECK(run_program(lines, {3}) == std::vector<uint64_t>{2, 1});
+    CHECK(run_program(lines, {4}) == std::vector<uint64_t>{1, 2});
+    CHECK(count_instructions<instruction::Strk>(lines) == 0);
+}
+
+TEST_CASE("Inlining - large procedures called outside of loops stay calls") {
+    const auto lines = compile_optimized(R"(
+        PROCEDURE mix(a) IS
+          b, c, d
+        IN
+          b := a * 3;
+          c := b * b;
+          d := c / 7;
+          b := d % 11;
+          c := b * d;
+          d := c / 5;
+          b := d * 13;
+          c := b % 17;
+          d := c * c;
+          b := d / 3;
+          c := b * 19;
+          d := c % 23;
+          a := d * 2;
+        END
+
+        PROGRAM IS
+          x, y
+        IN
+          READ x;
+          READ y;
+          mix(x);
+          mix(y);
+          WRITE x;
+          WRITE y;
+        END
+    )");
+
+    const auto mix = [](uint64_t a) {
+        auto b = a * 3;
+        auto c = b * b;
+        auto d = c / 7;
+        b = d % 11;
+        c = b * d;
+        d = c / 5;
+        b = d * 13;
+        c = b % 17;
+        d = c * c;
+        b = d / 3;
+        c = b * 19;
+        d = c % 23;
+        return d * 2;
+    };
+
+    CHECK(run_program(lines, {100, 12345}) == std::vector<uint64_t>{mix(100), mix(12345)});
+    CHECK(count_instructions<instruction::Strk>(lines) == 2);
+}
+
+TEST_CASE("Scalar replacement - arrays indexed by numbers") {
+    SUBCASE("Elements are folded like scalars") {
+        const auto lines = compile_optimized(R"(
+            PROGRAM IS
+              t[3], a
+            IN
+              READ a;
+              t[0] := 5;
+              t[1] := a;
+              t[2] := t[0] + t[1];
+              WRITE t[2];
+              WRITE t[0];
+            END
+        )");
+
+        CHECK(run_program(lines, {7}) == std::vector<uint64_t>{12, 5});
+        CHECK(run_program(lines, {0}) == std::vector<uint64_t>{5, 5});
+        // Only a and t[2] are loaded, t[0] is known to be 5 and t[1] is still in the accumulator after it is stored
+        CHECK(count_instructions<instruction::Load>(lines) == 2);
+    }
+
+    SUBCASE("Indices with leading zeros name the same element") {
+        const auto lines = compile_optimized(R"(
+            PROGRAM IS
+              t[4], a
+            IN
+              READ a;
+              t[01] := a;
+              t[003] := a + 1;
+              WRITE t[1];
+              WRITE t[3];
+            END
+        )");
+
+        CHECK(run_program(lines, {7}) == std::vector<uint64_t>{7, 8});
+    }
+
+    SUBCASE("Arrays indexed by variables stay in memory") {
+        const auto lines = compile_optimized(R"(
+            PROGRAM IS
+              t[3], u[4], a, i
+            IN
+              READ a;
+              t[0] := 5;
+              t[1] := a;
+              t[2] := t[0] + t[1];
+              i := 0;
+              WHILE i < 4 DO
+                u[i] := t[2] + i;
+                i := i + 1;
+              ENDWHILE
+              WRITE u[3];
+            END
+        )");
+
+        CHECK(run_program(lines, {7}) == std::vector<uint64_t>{15});
+        CHECK(run_program(lines, {0}) == std::vector<uint64_t>{8});
+    }
+}
+
+TEST_CASE("Loop rotation") {
+    struct LoopParams {
+        std::string init;
+        std::string condition;
+        std::string step;
+        std::vector<uint64_t> expected_iterations;
+    };
+
+    // Iteration counts for n = 0, 1, 5
+    const auto params = std::array{
+        LoopParams{"0", "i < n", "i + 1", {0, 1, 5}},  LoopParams{"0", "i <= n", "i + 1", {1, 2, 6}},
+        LoopParams{"n", "i > 0", "i - 1", {0, 1, 5}},  LoopParams{"n", "i >= 1", "i - 1", {0, 1, 5}},
+        LoopParams{"n", "i = n", "i + 1", {1, 1, 1}},  LoopParams{"0", "i != n", "i + 1", {0, 1, 5}},
+    };
+
+    for (const auto &[init, condition, step, expected_iterations] : params) {
+        SUBCASE(condition.c_str()) {
+            const auto lines = compile_optimized(std::format(R"(
+                PROGRAM IS
+                  n, i, s
+                IN
+                  READ n;
+                  i := {};
+                  s := 0;
+                  WHILE {} DO
+                    s := s + 1;
+                    i := {};
+                  ENDWHILE
+                  WRITE s;
+                END
+            )",
+                                                             init, condition, step));
+
+            const auto inputs = std::array<uint64_t, 3>{0, 1, 5};
+            for (auto i = 0u; i < inputs.size(); i++) {
+                CHECK(run_program(lines, {inputs[i]}) == std::vector<uint64_t>{expected_iterations[i]});
+            }
+        }
+    }
+}
+
+TEST_CASE("Conditions - comparisons with constants") {
+    const auto operators = std::array<std::string, 6>{"=", "!=", "<", ">", "<=", ">="};
+    const auto holds = [](const std::string &op, uint64_t lhs, uint64_t rhs) {
+        return op == "=" ? lhs == rhs
+               : op == "!=" ? lhs != rhs
+               : op == "<"  ? lhs < rhs
+               : op == ">"  ? lhs > rhs
+               : op == "<=" ? lhs <= rhs
+                            : lhs >= rhs;
+    };
+
+    // 0, a constant subtracted with DECs and one loaded into a register
+    for (const auto constant : std::array<uint64_t, 3>{0, 2, 7}) {
+        for (const auto &op : operators) {
+            for (const auto constant_on_left : {false, true}) {
+                const auto condition = constant_on_left ? std::format("{} {} x", constant, op)
+                                                        : std::format("x {} {}", op, constant);
+                SUBCASE(condition.c_str()) {
+                    const auto lines = compile_optimized(std::format(R"(
+                        PROGRAM IS
+                          x
+                        IN
+                          READ x;
+                          IF {} THEN
+                            WRITE 1;
+                          ELSE
+                            WRITE 0;
+                          ENDIF
+                        END
+                    )",
+                                                                     condition));
+
+                    for (auto x = uint64_t{0}; x <= 9; x++) {
+                        const auto expected = constant_on_left ? holds(op, constant, x) : holds(op, x, constant);
+                        CHECK(run_program(lines, {x}) == std::vector<uint64_t>{expected ? 1u : 0u});
+                    }
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("Loop unrolling - known trip counts") {
+    const auto lines = compile_optimized(R"(
+        PROGRAM IS
+          n, i, s, t[4]
+        IN
+          READ n;
+          i := 0;
+          WHILE i < 4 DO
+            t[i] := n + i;
+            i := i + 1;
+          ENDWHILE
+          s := 0;
+          i := 0;
+          WHILE i < 4 DO
+            s := s + t[i];
+            i := i + 1;
+          ENDWHILE
+          WRITE s;
+        END
+    )");
+
+    CHECK(run_program(lines, {0}) == std::vector<uint64_t>{6});
+    CHECK(run_program(lines, {10}) == std::vector<uint64_t>{46});
+    CHECK(count_instructions<instruction::Jump>(lines) == 0);
+    CHECK(count_instructions<instruction::Jpos>(lines) + count_instructions<instruction::Jzero>(lines) == 0);
+}
+
+TEST_CASE("Loop unrolling - deeply nested loops") {
+    // Each loop is tried once, so the nest compiles quickly and only the innermost loops are unrolled
+    auto source = std::string{"PROGRAM IS s, a, b, c, d, e, f, g, h, i, j, k, l, m IN READ s; "};
+    for (const auto *variable : {"a", "b", "c", "d", "e", "f", "g", "h", "i", "j", "k", "l", "m"}) {
+        source += std::format("{0} := 0; WHILE {0} < 2 DO ", variable);
+    }
+    source += "s := s + 1; ";
+    for (const auto *variable : {"m", "l", "k", "j", "i", "h", "g", "f", "e", "d", "c", "b", "a"}) {
+        source += std::format("{0} := {0} + 1; ENDWHILE ", variable);
+    }
+    source += "WRITE s; END";
+
+    const auto lines = compile_optimized(source);
+
+    CHECK(run_program(lines, {5}) == std::vector<uint64_t>{8197});
+}
+
+TEST_CASE("Loop unrolling - counted loops") {
+    struct LoopParams {
+        uint64_t init;
+        std::string condition;
+        std::string step;
+    };
+
+    const auto params = std::array{
+        LoopParams{0, "i < n", "i + 1"},   LoopParams{0, "i <= n", "i + 1"}, LoopParams{1, "n > i", "i + 2"},
+        LoopParams{0, "n >= i", "i + 3"},  LoopParams{20, "i > n", "i - 1"}, LoopParams{20, "i >= n", "i - 3"},
+        LoopParams{20, "n <= i", "i - 2"}, LoopParams{0, "i < 7", "i + 1"},  LoopParams{0, "i <= 2", "i + 1"},
+    };
+
+    for (const auto &[init, condition, step] : params) {
+        SUBCASE(condition.c_str()) {
+            const auto lines = compile_optimized(std::format(R"(
+                PROGRAM IS
+                  n, i, s
+                IN
+                  READ n;
+                  READ i;
+                  s := 0;
+                  WHILE {} DO
+                    s := s + i;
+                    i := {};
+                  ENDWHILE
+                  WRITE s;
+                  WRITE i;
+                END
+            )",
+                                                             condition, step));
+
+            // i >= 0 never ends
+            for (auto n = uint64_t{1}; n <= 9; n++) {
+                // The same loop run directly, conditions holding for saturated subtraction as in the language
+                const auto last_char = step.back() - '0';
+                const auto increasing = step.find('+') != std::string::npos;
+                auto i = init;
+                auto s = uint64_t{0};
+                auto holds = [&] {
+                    const auto bound = std::isdigit(condition.back()) ? uint64_t(condition.back() - '0') : n;
+                    if (condition.starts_with("i <=") || condition.starts_with("n >=")) {
+                        return i <= bound;
+                    }
+                    if (condition.starts_with("i <") || condition.starts_with("n >")) {
+                        return i < bound;
+                    }
+                    if (condition.starts_with("i >=") || condition.starts_with("n <=")) {
+                        return i >= bound;
+                    }
+                    return i > bound;
+                };
+                while (holds()) {
+                    s += i;
+                    i = increasing ? i + last_char : (i > uint64_t(last_char) ? i - last_char : 0);
+                }
+
+                CHECK(run_program(lines, {n, init}) == std::vector<uint64_t>{s, i});
+            }
+        }
+    }
+}
+
+TEST_CASE("Common subexpressions - expressions and array elements") {
+    const auto lines = compile_optimized(R"(
+        PROGRAM IS
+          t[8], a, b, i, j, x, y
+        IN
+          READ a;
+          READ b;
+          READ i;
+          READ j;
+          t[i] := a;
+          x := a * b;
+          y := t[i] * b;
+          WRITE y;
+          t[j] := b;
+          WRITE t[i];
+          t[i] := t[i] + x;
+          WRITE t[i];
+        END
+    )");
+
+    for (const auto &[a, b, i, j] : std::array{std::array<uint64_t, 4>{3, 4, 1, 2}, std::array<uint64_t, 4>{3, 4, 5, 5},
+                                               std::array<uint64_t, 4>{0, 7, 0, 7}}) {
+        const auto after_store = i == j ? b : a;
+        CHECK(run_program(lines, {a, b, i, j}) == std::vector<uint64_t>{a * b, after_store, after_store + a * b});
+    }
+
+    // t[i] * b is the a * b computed before, so only one multiplication (two SHRs) is left
+    CHECK(count_instructions<instruction::Shr>(lines) == 2);
+}
+
+TEST_CASE("Algebraic simplification") {
+    struct SimplificationCase {
+        std::string expression;
+        // Part of the name of the rule expected to apply, empty for the general lowering
+        std::string rule;
+        uint64_t (*expected)(uint64_t);
+    };
+
+    const auto cases = std::array{
+        SimplificationCase{"x + 0", "are x", [](uint64_t x) { return x; }},
+        SimplificationCase{"x - 0", "are x", [](uint64_t x) { return x; }},
+        SimplificationCase{"1 * x", "are x", [](uint64_t x) { return x; }},
+        SimplificationCase{"x / 1", "are x", [](uint64_t x) { return x; }},
+        SimplificationCase{"x - x", "are 0", [](uint64_t) { return uint64_t{0}; }},
+        SimplificationCase{"0 - x", "are 0", [](uint64_t) { return uint64_t{0}; }},
+        SimplificationCase{"x * 0", "are 0", [](uint64_t) { return uint64_t{0}; }},
+        SimplificationCase{"0 / x", "are 0", [](uint64_t) { return uint64_t{0}; }},
+        SimplificationCase{"x / 0", "are 0", [](uint64_t) { return uint64_t{0}; }},
+        SimplificationCase{"x % 0", "are 0", [](uint64_t) { return uint64_t{0}; }},
+        SimplificationCase{"x % 1", "are 0", [](uint64_t) { return uint64_t{0}; }},
+        SimplificationCase{"3 + x", "INCs", [](uint64_t x) { return x + 3; }},
+        SimplificationCase{"x - 4", "DECs", [](uint64_t x) { return x > 4 ? x - 4 : 0; }},
+        SimplificationCase{"x + x", "SHL", [](uint64_t x) { return x + x; }},
+        SimplificationCase{"x * 2", "shifts and adds", [](uint64_t x) { return x * 2; }},
+        SimplificationCase{"13 * x", "shifts and adds", [](uint64_t x) { return x * 13; }},
+        SimplificationCase{"x / 8", "SHRs", [](uint64_t x) { return x / 8; }},
+        SimplificationCase{"x % 2", "lowest k", [](uint64_t x) { return x % 2; }},
+        SimplificationCase{"x % 16", "lowest k", [](uint64_t x) { return x % 16; }},
+        SimplificationCase{"x + 1000", "", [](uint64_t x) { return x + 1000; }},
+        SimplificationCase{"x + 1000000000000", "", [](uint64_t x) { return x + 1000000000000; }},
+        SimplificationCase{"x - 100000000", "", [](uint64_t x) { return x > 100000000 ? x - 100000000 : 0; }},
+        SimplificationCase{"x % 10", "", [](uint64_t x) { return x % 10; }},
+    };
+
+    for (const auto &[expression, rule, expected] : cases) {
+        SUBCASE(expression.c_str()) {
+            const auto lines = compile_optimized(std::format(R"(
+                PROGRAM IS
+                  x, y
+                IN
+                  READ x;
+                  y := {};
+                  WRITE y;
+                END
+            )",
+                                                             expression));
+
+            for (const auto x : std::array<uint64_t, 7>{0, 1, 2, 5, 13, 100, 12345}) {
+                CHECK(run_program(lines, {x}) == std::vector<uint64_t>{expected(x)});
+            }
+
+            auto tokens = std::vector<Token>{};
+            for (auto &token : Lexer(expression)) {
+                REQUIRE(token.has_value());
+                tokens.push_back(token->to_token());
+            }
+            REQUIRE(tokens.size() == 3);
+            auto operand = [](const Token &token) -> ast::Value {
+                if (token.token_type == TokenType::Num) {
+                    return token;
+                }
+                return ast::Identifier{.name = token, .index = std::nullopt};
+            };
+
+            const auto simplified =
+                emitter::simplify(ast::BinaryExpression{operand(tokens[0]), tokens[1], operand(tokens[2])});
+            if (rule.empty()) {
+                CHECK(!simplified);
+            } else {
+                REQUIRE(simplified);
+                CHECK(simplified->rule.find(rule) != std::string::npos);
+            }
+        }
+    }
+}
+
+TEST_CASE("Profile-guided optimization") {
+    const auto source = std::string{R"(
+        PROCEDURE mix(a) IS
+          b, c, d
+        IN
+          b := a * 3;
+          c := b * b;
+          d := c / 7;
+          b := d % 11;
+          c := b * d;
+          d := c / 5;
+          b := d * 13;
+          c := b % 17;
+          d := c * c;
+          b := d / 3;
+          c := b * 19;
+          d := c % 23;
+          a := d * 2;
+        END
+
+        PROGRAM IS
+          n, x, y
+        IN
+          READ n;
+          READ x;
+          READ y;
+          WHILE n > 0 DO
+            mix(x);
+            mix(y);
+            n := n - 1;
+          ENDWHILE
+          WRITE x;
+          WRITE y;
+        END
+    )"};
+
+    SUBCASE("Counts are recorded per statement") {
+        const auto profile = train(source, {3, 1, 2});
+
+        auto stream = std::stringstream{};
+        profile.write(stream);
+        const auto read_back = Profile::read(stream);
+        REQUIRE(read_back.has_value());
+
+        // `n := n - 1` is on line 26 of the source
+        // `READ n;`, `mix(x);` and `n := n - 1;`
+        CHECK(read_back->get_count(SourcePosition{23, 16}) == 1);
+        CHECK(read_back->get_count(SourcePosition{27, 13}) == 3);
+        CHECK(read_back->get_count(SourcePosition{29, 13}) == 3);
+    }
+
+    SUBCASE("Calls in loops that did not run stay calls") {
+        CHECK(count_instructions<instruction::Strk>(compile_optimized(source)) == 0);
+
+        const auto profile = train(source, {0, 1, 2});
+        const auto lines = compile_optimized(source, &profile);
+
+        CHECK(count_instructions<instruction::Strk>(lines) == 2);
+        CHECK(run_program(lines, {0, 100, 12345}) == std::vector<uint64_t>{100, 12345});
+        CHECK(run_program(lines, {1, 5, 7}) == run_program(compile_optimized(source), {1, 5, 7}));
+    }
+}
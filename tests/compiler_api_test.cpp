@@ -0,0 +1,306 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "compile-cache.hpp"
+#include "compile.hpp"
+#include "sha256.hpp"
+#include "tests_shared.hpp"
+#include <filesystem>
+#include <limits>
+#include <random>
+#include <thread>
+
+auto read_example(const std::string &filename) -> std::string {
+    const auto source = read_file(std::string(TESTS_DIR) + "/" + filename);
+    REQUIRE(source.has_value());
+    return *source;
+}
+
+auto to_strings(const std::vector<instruction::Line> &lines) -> std::vector<std::string> {
+    auto strings = std::vector<std::string>{};
+    for (const auto &line : lines) {
+        strings.push_back(instruction::to_string(line.instruction) + line.comment);
+    }
+    return strings;
+}
+
+TEST_CASE("Compiler API - compiling on several threads gives the same code") {
+    auto sources = std::vector<std::string>{};
+    for (const auto *filename : {"example1.imp", "example2.imp", "example3.imp", "example4.imp", "example5.imp",
+                                 "example6.imp", "example7.imp", "example8.imp", "example9.imp"}) {
+        sources.push_back(read_example(filename));
+    }
+
+    auto expected = std::vector<std::vector<std::string>>{};
+    for (const auto &source : sources) {
+        const auto output = compiler::compile(source);
+        REQUIRE(output.has_value());
+        expected.push_back(to_strings(output->lines));
+    }
+
+    constexpr auto thread_count = 4u;
+    constexpr auto rounds = 3u;
+    // Written by one thread each, checked once all threads joined
+    auto results = std::vector<std::vector<std::vector<std::string>>>(thread_count);
+    auto threads = std::vector<std::thread>{};
+    for (auto thread = 0u; thread < thread_count; thread++) {
+        threads.emplace_back([&, thread] {
+            for (auto round = 0u; round < rounds; round++) {
+                for (auto i = 0u; i < sources.size(); i++) {
+                    const auto output = compiler::compile(sources[(i + thread) % sources.size()]);
+                    results[thread].push_back(output ? to_strings(output->lines) : std::vector<std::string>{});
+                }
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    for (auto thread = 0u; thread < thread_count; thread++) {
+        REQUIRE(results[thread].size() == rounds * sources.size());
+        for (auto i = 0u; i < results[thread].size(); i++) {
+            CHECK(results[thread][i] == expected[(i + thread) % sources.size()]);
+        }
+    }
+}
+
+TEST_CASE("Compiler API - the code does not depend on the number of threads emitting it") {
+    for (const auto *filename : {"example2.imp", "example4.imp", "example8.imp", "example9.imp", "gcd.imp"}) {
+        const auto source = read_example(filename);
+        for (const auto level : {passes::OptimizationLevel::O0, passes::OptimizationLevel::O3}) {
+            const auto sequential = compiler::compile(source, {.optimization_level = level});
+            const auto parallel = compiler::compile(source, {.optimization_level = level, .jobs = 4});
+            REQUIRE(sequential.has_value());
+            REQUIRE(parallel.has_value());
+            CHECK(to_strings(parallel->lines) == to_strings(sequential->lines));
+            CHECK(parallel->statement_lines == sequential->statement_lines);
+        }
+    }
+}
+
+TEST_CASE("Compiler API - the specialization budget goes to the calls in declaration order") {
+    // `first` waits for `deep` to be emitted while `second` could be emitted right away, but `first` is declared
+    // before it, so its call of `big` gets the only copy the budget allows
+    auto source = std::string{"PROCEDURE big(a, b) IS\nIN\n"};
+    for (auto i = 0u; i < 100; i++) {
+        source += "  a := a + b;\n";
+    }
+    source += R"(END
+        PROCEDURE deep(p, q) IS IN big(p, q); END
+        PROCEDURE first(p) IS x IN deep(p, p); x := p; big(x, p); END
+        PROCEDURE second(p) IS y IN y := p; big(p, y); END
+        PROGRAM IS m IN READ m; first(m); second(m); WRITE m; END
+    )";
+
+    for (const auto jobs : {1u, 4u}) {
+        const auto output = compiler::compile(
+            source, {.optimization_level = passes::OptimizationLevel::O0, .pass_toggles = {{"specialize-calls", true}},
+                     .jobs = jobs});
+        REQUIRE(output.has_value());
+
+        auto copies = std::vector<std::string>{};
+        for (const auto &line : output->lines) {
+            if (line.comment.find("Jump to procedure big(") != std::string::npos) {
+                copies.push_back(line.comment.substr(line.comment.find("big(")));
+            }
+        }
+        REQUIRE(copies.size() == 1);
+        CHECK(copies.front().starts_with("big(@"));
+    }
+}
+
+TEST_CASE("Compiler API - errors are returned") {
+    const auto parse_error = compiler::compile("PROGRAM IS IN x := ; END");
+    REQUIRE(!parse_error.has_value());
+    CHECK(!parse_error.error().empty());
+
+    const auto undeclared = compiler::compile("PROGRAM IS IN WRITE x; END");
+    REQUIRE(!undeclared.has_value());
+    CHECK(std::ranges::any_of(undeclared.error(), [](const Error &error) { return !error.is_warning; }));
+
+    const auto unknown_pass = compiler::compile(read_example("example1.imp"),
+                                                compiler::Options{.pass_toggles = {{"no-such-pass", true}}});
+    REQUIRE(!unknown_pass.has_value());
+    CHECK(unknown_pass.error().front().message.find("no-such-pass") != std::string::npos);
+
+    const auto too_few_inputs = compiler::compile_and_run(read_example("example4.imp"), {20});
+    REQUIRE(!too_few_inputs.has_value());
+
+    // Would loop forever if reading past the inputs went on with zeros
+    const auto waits_for_input =
+        compiler::compile_and_run("PROGRAM IS x IN READ x; WHILE x = 0 DO READ x; ENDWHILE END", {0, 0});
+    REQUIRE(!waits_for_input.has_value());
+    CHECK(waits_for_input.error().front().message.find("more inputs") != std::string::npos);
+
+    const auto never_halts =
+        compiler::compile_and_run("PROGRAM IS x IN READ x; WHILE x > 0 DO x := x + 1; ENDWHILE END", {1},
+                                  compiler::Options{.max_steps = 100000});
+    REQUIRE(!never_halts.has_value());
+    CHECK(never_halts.error().front().message.find("did not halt") != std::string::npos);
+}
+
+TEST_CASE("Compiler API - inputs use all 64 bits") {
+    constexpr auto max = std::numeric_limits<uint64_t>::max();
+    const auto source = "PROGRAM IS x, y IN READ x; READ y; WRITE x; IF x > y THEN WRITE 1; ENDIF "
+                        "y := x - y; WRITE y; END";
+
+    const auto run = compiler::compile_and_run(source, {max, uint64_t{1} << 63});
+    REQUIRE(run.has_value());
+    CHECK(run->outputs == std::vector<uint64_t>{max, 1, max - (uint64_t{1} << 63)});
+}
+
+TEST_CASE("Compiler API - compiling and running") {
+    using enum passes::OptimizationLevel;
+
+    const auto source = read_example("example4.imp");
+
+    auto costs = std::vector<long long>{};
+    for (const auto level : {O0, O3}) {
+        auto report = PhaseReport{};
+        const auto run = compiler::compile_and_run(source, {20, 9}, {.optimization_level = level, .report = &report});
+        REQUIRE(run.has_value());
+        CHECK(run->outputs == std::vector<uint64_t>{167960});
+        CHECK(!run->line_counts.empty());
+        costs.push_back(run->cost);
+
+        auto json = std::ostringstream{};
+        report.write_json(json);
+        CHECK(json.str().find("\"emit\"") != std::string::npos);
+    }
+
+    CHECK(costs.back() < costs.front());
+}
+
+/// Empty directory removed at the end of the test
+struct TemporaryDirectory {
+    TemporaryDirectory()
+        : path(std::filesystem::temp_directory_path() /
+               ("compile_cache_test-" + std::to_string(std::random_device{}()))) {
+        std::filesystem::create_directories(path);
+    }
+    ~TemporaryDirectory() { std::filesystem::remove_all(path); }
+
+    std::filesystem::path path;
+};
+
+TEST_CASE("Compiler API - SHA-256") {
+    CHECK(Sha256().finish() == "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+
+    auto hash = Sha256{};
+    hash.update("a");
+    hash.update("bc");
+    CHECK(hash.finish() == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+
+    auto long_hash = Sha256{};
+    long_hash.update("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq");
+    CHECK(long_hash.finish() == "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+}
+
+TEST_CASE("Compiler API - the cache returns what was compiled") {
+    const auto directory = TemporaryDirectory{};
+    const auto cache = compiler::Cache(directory.path);
+    const auto source = read_example("example4.imp");
+
+    const auto key = cache.key(source, {});
+    CHECK(key != cache.key(source, {.optimization_level = passes::OptimizationLevel::O1}));
+    CHECK(key != cache.key(source, {.pass_toggles = {{"unroll-loops", false}}}));
+    CHECK(key != cache.key(source + " ", {}));
+    // The number of threads does not change the code
+    CHECK(key == cache.key(source, {.jobs = 4}));
+
+    CHECK(!cache.load(key).has_value());
+
+    const auto compiled = compiler::compile(source, {}, cache);
+    REQUIRE(compiled.has_value());
+
+    auto report = PhaseReport{};
+    const auto cached = compiler::compile(source, {.report = &report}, cache);
+    REQUIRE(cached.has_value());
+    CHECK(to_strings(cached->lines) == to_strings(compiled->lines));
+    CHECK(cached->statement_lines == compiled->statement_lines);
+    CHECK(cached->pass_stats.empty());
+
+    // Nothing but the lookup ran
+    auto json = std::ostringstream{};
+    report.write_json(json);
+    CHECK(json.str().find("\"parse\"") == std::string::npos);
+
+    // A damaged entry is a miss and gets replaced
+    for (const auto &entry : std::filesystem::recursive_directory_iterator(directory.path)) {
+        if (entry.is_regular_file()) {
+            const auto size = entry.file_size();
+            std::filesystem::resize_file(entry.path(), size / 2);
+        }
+    }
+    CHECK(!cache.load(key).has_value());
+    CHECK(compiler::compile(source, {}, cache).has_value());
+    CHECK(cache.load(key).has_value());
+
+    // Failures are not stored
+    CHECK(!compiler::compile("PROGRAM IS IN WRITE x; END", {}, cache).has_value());
+    CHECK(!cache.load(cache.key("PROGRAM IS IN WRITE x; END", {})).has_value());
+}
+
+TEST_CASE("Compiler API - the cache evicts the least recently used entries") {
+    const auto directory = TemporaryDirectory{};
+    const auto source = read_example("example4.imp");
+
+    const auto unbounded = compiler::Cache(directory.path);
+    REQUIRE(compiler::compile(source, {}, unbounded).has_value());
+    const auto entry_size = unbounded.size();
+    REQUIRE(entry_size > 0);
+
+    // Trailing blanks change the key but not the code, so every entry has the same size
+    const auto cache = compiler::Cache(directory.path, 2 * entry_size + 3 * entry_size / 4);
+    for (const auto *blanks : {" ", "  "}) {
+        REQUIRE(compiler::compile(source + blanks, {}, cache).has_value());
+    }
+    CHECK(cache.size() == 2 * entry_size);
+    CHECK(!cache.load(cache.key(source, {})).has_value());
+    CHECK(cache.load(cache.key(source + "  ", {})).has_value());
+
+    // A full cache is emptied down to 80% of its size, not just below it
+    const auto larger = compiler::Cache(directory.path, 4 * entry_size + entry_size / 2);
+    for (const auto *blanks : {"   ", "    ", "     "}) {
+        REQUIRE(compiler::compile(source + blanks, {}, larger).has_value());
+    }
+    CHECK(larger.size() == 3 * entry_size);
+    CHECK(larger.load(larger.key(source + "     ", {})).has_value());
+}
+
+TEST_CASE("Compiler API - threads share a cache") {
+    const auto directory = TemporaryDirectory{};
+    const auto cache = compiler::Cache(directory.path);
+
+    auto sources = std::vector<std::string>{};
+    auto expected = std::vector<std::vector<std::string>>{};
+    for (const auto *filename : {"example1.imp", "example2.imp", "example4.imp", "example9.imp"}) {
+        sources.push_back(read_example(filename));
+        const auto output = compiler::compile(sources.back());
+        REQUIRE(output.has_value());
+        expected.push_back(to_strings(output->lines));
+    }
+
+    constexpr auto thread_count = 4u;
+    auto results = std::vector<std::vector<std::vector<std::string>>>(thread_count);
+    auto threads = std::vector<std::thread>{};
+    for (auto thread = 0u; thread < thread_count; thread++) {
+        threads.emplace_back([&, thread] {
+            for (auto round = 0u; round < 3; round++) {
+                for (const auto &source : sources) {
+                    const auto output = compiler::compile(source, {}, cache);
+                    results[thread].push_back(output ? to_strings(output->lines) : std::vector<std::string>{});
+                }
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    for (const auto &result : results) {
+        REQUIRE(result.size() == 3 * sources.size());
+        for (auto i = 0u; i < result.size(); i++) {
+            CHECK(result[i] == expected[i % sources.size()]);
+        }
+    }
+}
@@ -0,0 +1,442 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "ast-optimizer.hpp"
+#include "emitter.hpp"
+#include "lexer.hpp"
+#include "mw.hpp"
+#include "parser.hpp"
+#include "tests_shared.hpp"
+#include <map>
+#include <memory>
+#include <ranges>
+
+/// `inline_procedures` inlines the calls first, the locals of the inlined procedures become `name@call` locals of main
+auto emit(const std::string &source, emitter::Features features = {}, const Profile *profile = nullptr,
+          bool inline_procedures = false) -> std::vector<instruction::Line> {
+    auto lexer = Lexer(source);
+    auto parser = parser::Parser(lexer);
+    auto program = parser.parse_program();
+
+    REQUIRE(program.has_value());
+    REQUIRE(parser.get_errors().empty());
+
+    if (inline_procedures) {
+        auto ast_optimizer = AstOptimizer(&*program);
+        ast_optimizer.calculate_procedure_call_counts();
+        ast_optimizer.inline_procedures();
+    }
+
+    auto emitter = emitter::Emitter(std::move(*program), profile, 1, features);
+    emitter.emit();
+
+    REQUIRE(emitter.get_errors().empty());
+
+    return emitter.get_lines();
+}
+
+struct Run {
+    std::vector<uint64_t> outputs;
+    std::map<long long, uint64_t> memory;
+    // Highest address the program stored to
+    uint64_t highest_address;
+};
+
+auto run(const std::vector<instruction::Line> &lines, std::deque<uint64_t> inputs = {}) -> Run {
+    auto read_handler = std::make_unique<ReadHandlerDeque>(std::move(inputs));
+    auto write_handler = std::make_unique<WriteHandlerVector<uint64_t>>();
+
+    const auto program_state = run_machine(lines, read_handler.get(), write_handler.get());
+    CHECK(!program_state.error);
+
+    auto highest_address = uint64_t{0};
+    for (const auto &[address, value] : program_state.pam) {
+        highest_address = std::max(highest_address, static_cast<uint64_t>(address));
+    }
+    return {write_handler->get_outputs(), program_state.pam, highest_address};
+}
+
+/// STOREs through register G, which is how arguments are passed in memory
+auto count_argument_stores(const std::vector<instruction::Line> &lines) -> size_t {
+    return std::ranges::count_if(lines, [](const auto &line) {
+        const auto *store = std::get_if<instruction::Store>(&line.instruction);
+        return store && store->address == instruction::Register::G;
+    });
+}
+
+/// Procedures and specialized copies the calls jump to, in the order of the code
+auto call_targets(const std::vector<instruction::Line> &lines) -> std::vector<std::string> {
+    const auto prefix = std::string{"Jump to procedure "};
+    auto targets = std::vector<std::string>{};
+    for (const auto &line : lines) {
+        if (const auto position = line.comment.find(prefix); position != std::string::npos) {
+            targets.push_back(line.comment.substr(position + prefix.size()));
+        }
+    }
+    return targets;
+}
+
+TEST_CASE("Register arguments - leaf procedures overwriting the argument registers") {
+    // Comparisons use C and D, multiplication uses C, so the pointers are moved to memory where the body needs them
+    const auto source = std::string{R"(
+        PROCEDURE larger(a, b, m) IS
+        IN
+          IF a > b THEN
+            m := a;
+          ELSE
+            m := b;
+          ENDIF
+        END
+
+        PROCEDURE scale(x, c, r) IS
+        IN
+          r := x * c;
+        END
+
+        PROGRAM IS
+          a, b, m, r
+        IN
+          READ a;
+          READ b;
+          larger(a, b, m);
+          WRITE m;
+          scale(a, m, r);
+          WRITE r;
+        END
+    )"};
+    const auto features = emitter::Features{.specialize_calls = false};
+
+    const auto lines = emit(source, features);
+    CHECK(run(lines, {3, 7}).outputs == std::vector<uint64_t>{7, 21});
+    CHECK(run(lines, {9, 2}).outputs == std::vector<uint64_t>{9, 81});
+    CHECK(count_argument_stores(lines) == 0);
+
+    auto in_memory = features;
+    in_memory.pass_arguments_in_registers = false;
+    const auto memory_lines = emit(source, in_memory);
+    CHECK(run(memory_lines, {3, 7}).outputs == std::vector<uint64_t>{7, 21});
+    CHECK(count_argument_stores(memory_lines) == 6);
+}
+
+TEST_CASE("Register arguments - five arguments") {
+    const auto source = std::string{R"(
+        PROCEDURE sum(a, b, c, d, e) IS
+        IN
+          e := a + b;
+          e := e + c;
+          e := e + d;
+        END
+
+        PROGRAM IS
+          a, b, c, d, e
+        IN
+          READ a;
+          READ b;
+          READ c;
+          READ d;
+          sum(a, b, c, d, e);
+          WRITE e;
+          sum(e, d, c, b, a);
+          WRITE a;
+        END
+    )"};
+
+    const auto lines = emit(source, {.specialize_calls = false});
+    CHECK(run(lines, {1, 2, 3, 4}).outputs == std::vector<uint64_t>{10, 19});
+    CHECK(count_argument_stores(lines) == 0);
+}
+
+TEST_CASE("Register arguments - calls inside and outside of loops") {
+    const auto source = std::string{R"(
+        PROCEDURE add(a, b) IS
+        IN
+          a := a + b;
+        END
+
+        PROGRAM IS
+          x, n, i
+        IN
+          READ x;
+          READ n;
+          add(x, n);
+          i := 0;
+          WHILE i < n DO
+            add(x, i);
+            i := i + 1;
+          ENDWHILE
+          WRITE x;
+        END
+    )"};
+
+    const auto lines = emit(source, {.specialize_calls = false});
+    CHECK(run(lines, {5, 0}).outputs == std::vector<uint64_t>{5});
+    CHECK(run(lines, {5, 4}).outputs == std::vector<uint64_t>{15});
+    CHECK(count_argument_stores(lines) == 0);
+}
+
+TEST_CASE("Frame layout - procedures that are never active at the same time share memory") {
+    const auto source = std::string{R"(
+        PROCEDURE grow(a) IS
+          s, t
+        IN
+          s := a + 1;
+          t := s + s;
+          a := t;
+        END
+
+        PROCEDURE triple(a) IS
+          u, v
+        IN
+          u := a * 3;
+          v := u + 1;
+          a := v;
+        END
+
+        PROGRAM IS
+          x
+        IN
+          READ x;
+          grow(x);
+          triple(x);
+          WRITE x;
+        END
+    )"};
+
+    // Return address, argument pointer and two locals for either procedure, then main
+    const auto shared = run(emit(source), {5});
+    CHECK(shared.outputs == std::vector<uint64_t>{37});
+    CHECK(shared.highest_address == 4);
+
+    const auto separate = run(emit(source, {.overlap_frames = false}), {5});
+    CHECK(separate.outputs == std::vector<uint64_t>{37});
+    CHECK(separate.highest_address == 8);
+}
+
+TEST_CASE("Frame layout - locals of a caller survive a call into a frame shared with a sibling") {
+    // double and increment share memory, twice starts above double so k keeps its value across the call
+    const auto source = std::string{R"(
+        PROCEDURE increment(a) IS
+          s
+        IN
+          s := a + 1;
+          a := s;
+        END
+
+        PROCEDURE double(a) IS
+          t
+        IN
+          t := a + a;
+          a := t;
+        END
+
+        PROCEDURE twice(a) IS
+          k, m
+        IN
+          k := a;
+          double(a);
+          m := a + k;
+          a := m;
+        END
+
+        PROGRAM IS
+          x
+        IN
+          READ x;
+          increment(x);
+          twice(x);
+          WRITE x;
+        END
+    )"};
+
+    const auto shared = run(emit(source), {5});
+    CHECK(shared.outputs == std::vector<uint64_t>{18});
+    CHECK(shared.highest_address == 7);
+
+    const auto separate = run(emit(source, {.overlap_frames = false}), {5});
+    CHECK(separate.outputs == std::vector<uint64_t>{18});
+    CHECK(separate.highest_address == 10);
+}
+
+TEST_CASE("Frame layout - locals of inlined procedures are placed first fit") {
+    const auto source = std::string{R"(
+        PROCEDURE grow(a) IS
+          s, t
+        IN
+          s := a + 1;
+          t := s + s;
+          a := t;
+        END
+
+        PROCEDURE square(a) IS
+          u, v
+        IN
+          u := a * a;
+          v := u + 1;
+          a := v;
+        END
+
+        PROGRAM IS
+          x
+        IN
+          READ x;
+          grow(x);
+          square(x);
+          WRITE x;
+        END
+    )"};
+
+    // The locals of square take the slots of the locals of grow
+    const auto shared = run(emit(source, {}, nullptr, true), {5});
+    CHECK(shared.outputs == std::vector<uint64_t>{145});
+    CHECK(shared.highest_address == 2);
+
+    const auto separate = run(emit(source, {.overlap_frames = false}, nullptr, true), {5});
+    CHECK(separate.outputs == std::vector<uint64_t>{145});
+    CHECK(separate.highest_address == 4);
+}
+
+TEST_CASE("Specialization - arguments that are variables of the caller are addressed directly") {
+    const auto source = std::string{R"(
+        PROCEDURE add(a, b) IS
+        IN
+          a := a + b;
+        END
+
+        PROCEDURE add_twice(a, b) IS
+        IN
+          add(a, b);
+          add(a, b);
+        END
+
+        PROGRAM IS
+          x, y
+        IN
+          READ x;
+          READ y;
+          add_twice(x, y);
+          WRITE x;
+        END
+    )"};
+
+    // The copy of add_twice calls a copy of add, neither gets its arguments through memory
+    const auto lines = emit(source);
+    CHECK(run(lines, {5, 3}).outputs == std::vector<uint64_t>{11});
+    CHECK(count_argument_stores(lines) == 0);
+    const auto targets = call_targets(lines);
+    CHECK(std::ranges::count_if(targets, [](const auto &target) { return target.starts_with("add_twice(@"); }) == 1);
+    CHECK(std::ranges::count_if(targets, [](const auto &target) { return target.starts_with("add(@"); }) == 2);
+
+    const auto unspecialized = emit(source, {.specialize_calls = false});
+    CHECK(run(unspecialized, {5, 3}).outputs == std::vector<uint64_t>{11});
+    CHECK(count_argument_stores(unspecialized) == 2);
+}
+
+TEST_CASE("Specialization - a procedure called with pointers and with plain variables") {
+    // add_many is too large for the budget, so main calls it as it is and its call of add passes a pointer and a local
+    auto source = std::string{R"(
+        PROCEDURE add(a, b) IS
+        IN
+          a := a + b;
+        END
+
+        PROCEDURE add_many(a) IS
+          k
+        IN
+          k := 3;
+          add(a, k);
+    )"};
+    for (auto i = 0u; i < 1000; i++) {
+        source += "a := a + k;\n";
+    }
+    source += R"(
+        END
+
+        PROGRAM IS
+          x, y
+        IN
+          READ x;
+          READ y;
+          add(x, y);
+          add_many(x);
+          WRITE x;
+        END
+    )";
+
+    const auto lines = emit(source);
+    CHECK(run(lines, {1, 2}).outputs == std::vector<uint64_t>{3006});
+    const auto targets = call_targets(lines);
+    CHECK(std::ranges::find(targets, "add_many") != targets.end());
+    CHECK(std::ranges::count_if(targets, [](const auto &target) { return target.starts_with("add(*, @"); }) == 1);
+    CHECK(std::ranges::count_if(targets, [](const auto &target) { return target.starts_with("add(@"); }) == 1);
+}
+
+TEST_CASE("Specialization - calls past the budget jump to the procedure") {
+    auto source = std::string{"PROCEDURE big(a, b) IS\nIN\n"};
+    for (auto i = 0u; i < 100; i++) {
+        source += "  a := a + b;\n";
+    }
+    source += R"(END
+        PROGRAM IS
+          x, y, z
+        IN
+          READ x;
+          READ y;
+          READ z;
+          big(x, y);
+          big(y, z);
+          big(z, x);
+          big(y, x);
+          big(z, y);
+          big(x, z);
+          WRITE x;
+          WRITE y;
+          WRITE z;
+        END
+    )";
+
+    const auto lines = emit(source);
+    const auto outputs = run(lines, {1, 2, 3}).outputs;
+    CHECK(outputs == run(emit(source, {.specialize_calls = false}), {1, 2, 3}).outputs);
+
+    // The first calls get copies until the budget runs out, the others share the procedure
+    const auto targets = call_targets(lines);
+    REQUIRE(targets.size() == 6);
+    const auto copies = std::ranges::count_if(targets, [](const auto &target) { return target.starts_with("big("); });
+    CHECK(copies > 0);
+    CHECK(copies < 6);
+    CHECK(std::ranges::all_of(targets | std::views::drop(copies), [](const auto &target) { return target == "big"; }));
+}
+
+TEST_CASE("Memory layout - the hottest variables of main get the lowest addresses") {
+    const auto source = std::string{R"(
+        PROCEDURE bump(a) IS
+          t
+        IN
+          t := a + 1;
+          a := t;
+        END
+
+        PROGRAM IS
+          s, n, i
+        IN
+          READ n;
+          s := 100;
+          i := 0;
+          WHILE i < n DO
+            bump(s);
+            i := i + 1;
+          ENDWHILE
+          WRITE s;
+        END
+    )"};
+
+    // i is used the most, main goes below the frame of bump
+    const auto hot = run(emit(source), {7});
+    CHECK(hot.outputs == std::vector<uint64_t>{107});
+    CHECK(hot.memory.at(0) == 7);
+    CHECK(hot.memory.at(1) == 107);
+
+    // In declaration order above the frame of bump
+    const auto declared = run(emit(source, {.layout_hot_variables = false}), {7});
+    CHECK(declared.outputs == std::vector<uint64_t>{107});
+    CHECK(declared.memory.at(3) == 107);
+    CHECK(declared.memory.at(5) == 7);
+}
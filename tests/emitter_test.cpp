@@ -44,18 +44,12 @@ TEST_CASE_TEMPLATE("Official tests", T, uint64_t, cln::cl_I) {
 
             auto lexer = Lexer(*filecontent);
 
-            auto tokens = std::vector<Token>{};
-
-            for (auto &token : lexer) {
-                REQUIRE(token.has_value());
-                tokens.push_back(*token);
-            }
-
-            auto parser = parser::Parser(tokens);
+            auto parser = parser::Parser(lexer);
 
             auto program = parser.parse_program();
 
             REQUIRE(program.has_value());
+            REQUIRE(parser.get_errors().empty());
 
             auto emitter = emitter::Emitter(std::move(*program));
 
@@ -99,21 +93,15 @@ TEST_CASE("Slowik tests") {
 
             auto lexer = Lexer(*filecontent);
 
-            auto tokens = std::vector<Token>{};
-
-            for (auto &token : lexer) {
-                if (!token) {
-                    display_error(token.error());
-                }
-                REQUIRE(token.has_value());
-                tokens.push_back(*token);
-            }
-
-            auto parser = parser::Parser(tokens);
+            auto parser = parser::Parser(lexer);
 
             auto program = parser.parse_program();
 
+            for (const auto &error : parser.get_errors()) {
+                display_error(error);
+            }
             REQUIRE(program.has_value());
+            REQUIRE(parser.get_errors().empty());
 
             auto emitter = emitter::Emitter(std::move(*program));
 
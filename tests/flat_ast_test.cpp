@@ -0,0 +1,131 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "emitter.hpp"
+#include "flat-ast.hpp"
+#include "lexer.hpp"
+#include "mw.hpp"
+#include "parser.hpp"
+#include "tests_shared.hpp"
+#include <memory>
+
+auto parse(const std::string &source) -> ast::Program {
+    auto lexer = Lexer(source);
+    auto parser = parser::Parser(lexer);
+    auto program = parser.parse_program();
+
+    REQUIRE(program.has_value());
+    REQUIRE(parser.get_errors().empty());
+
+    return std::move(*program);
+}
+
+/// Instructions of the program as text, comments included
+auto emit(ast::Program program) -> std::vector<std::string> {
+    auto emitter = emitter::Emitter(std::move(program));
+    emitter.emit();
+    REQUIRE(emitter.get_errors().empty());
+
+    auto lines = std::vector<std::string>{};
+    for (const auto &line : emitter.get_lines()) {
+        lines.push_back(instruction::to_string(line.instruction) + line.comment);
+    }
+    return lines;
+}
+
+auto run(ast::Program program, std::deque<uint64_t> inputs) -> std::vector<uint64_t> {
+    auto emitter = emitter::Emitter(std::move(program));
+    emitter.emit();
+    REQUIRE(emitter.get_errors().empty());
+
+    auto read_handler = std::make_unique<ReadHandlerDeque>(std::move(inputs));
+    auto write_handler = std::make_unique<WriteHandlerVector<uint64_t>>();
+    const auto program_state = run_machine(emitter.get_lines(), read_handler.get(), write_handler.get());
+    CHECK(!program_state.error);
+
+    return write_handler->get_outputs();
+}
+
+TEST_CASE("Flat AST - interning") {
+    auto symbols = Interner{};
+
+    const auto a = symbols.intern("a");
+    const auto b = symbols.intern("b");
+
+    CHECK(a != b);
+    CHECK(symbols.intern(std::string("a")) == a);
+    CHECK(symbols.name(b) == "b");
+    CHECK(symbols.size() == 2);
+}
+
+TEST_CASE("Flat AST - flattening and expanding keeps the program") {
+    const auto source = read_test_files();
+
+    const auto program = parse(source);
+    const auto flat = ast::flat::flatten(program);
+
+    CHECK(emit(ast::flat::expand(flat)) == emit(parse(source)));
+
+    // The commands of every block are consecutive, the body of main is flattened last
+    CHECK(flat.main.body.end() <= flat.commands.size());
+    CHECK(flat.procedures.size() == program.procedures.size());
+    CHECK(flat.symbols.size() < flat.values.size() + flat.declarations.size());
+}
+
+TEST_CASE("Flat AST - inlining shares the body of the procedure") {
+    const auto source = R"(
+        PROCEDURE factorial(T s, n) IS
+          i, j
+        IN
+          s[0] := 1;
+          i := 1;
+          j := 0;
+          WHILE i <= n DO
+            s[i] := s[j] * i;
+            i := i + 1;
+            j := j + 1;
+          ENDWHILE
+        END
+
+        PROCEDURE bc(n, k, m) IS
+          s[100], p
+        IN
+          factorial(s, n);
+          p := n - k;
+          m := s[n] / s[k];
+          m := m / s[p];
+        END
+
+        PROGRAM IS
+          n, k, w, v
+        IN
+          READ n;
+          READ k;
+          bc(n, k, w);
+          WRITE w;
+          bc(k, n, v);
+          WRITE v;
+          bc(n, k, w);
+          WRITE w;
+        END
+    )";
+
+    auto flat = ast::flat::flatten(parse(source));
+    const auto commands = flat.commands.size();
+
+    auto &bc = flat.procedures[1];
+    CHECK(flat.inline_call(bc.context.body.begin, bc.context));
+    for (const auto index : {2u, 4u, 6u}) {
+        CHECK(flat.inline_call(flat.main.body.begin + index, flat.main));
+    }
+    // A WRITE is not a call
+    CHECK(!flat.inline_call(flat.main.body.begin + 3, flat.main));
+
+    CHECK(flat.commands.size() == commands);
+    // Both calls with the same arguments share the locals, each call brings the renamed locals of factorial too
+    CHECK(flat.main.declarations.size == 4 + 2 * 4);
+
+    const auto expanded = ast::flat::expand(flat);
+    CHECK(std::holds_alternative<ast::InlinedProcedure>(expanded.main.commands[2]));
+
+    CHECK(run(expanded, {20, 9}) == std::vector<uint64_t>{167960, 0, 167960});
+    CHECK(run(expanded, {9, 20}) == run(parse(source), {9, 20}));
+}
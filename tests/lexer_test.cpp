@@ -91,7 +91,8 @@ TEST_CASE("Lexer - single character tokens") {
 
     for (auto i = 0u; i < chars.size(); i++) {
         const auto c = chars[i];
-        auto lexer = Lexer(std::string(1, c));
+        const auto source = std::string(1, c);
+        auto lexer = Lexer(source);
         const auto token = lexer.next_token();
         CHECK(token.has_value());
         CHECK(token->value().token_type == expected_types[i]);
@@ -116,6 +117,48 @@ TEST_CASE("Lexer - double character tokens") {
     }
 }
 
+TEST_CASE("Lexer - every keyword and words close to them") {
+    constexpr std::array expected = {
+        std::pair{"PROGRAM", TokenType::Program}, std::pair{"PROCEDURE", TokenType::Procedure},
+        std::pair{"IS", TokenType::Is},           std::pair{"IN", TokenType::In},
+        std::pair{"WHILE", TokenType::While},     std::pair{"ENDWHILE", TokenType::EndWhile},
+        std::pair{"IF", TokenType::If},           std::pair{"ENDIF", TokenType::EndIf},
+        std::pair{"THEN", TokenType::Then},       std::pair{"ELSE", TokenType::Else},
+        std::pair{"DO", TokenType::Do},           std::pair{"READ", TokenType::Read},
+        std::pair{"WRITE", TokenType::Write},     std::pair{"END", TokenType::End},
+        std::pair{"T", TokenType::T},             std::pair{"REPEAT", TokenType::Repeat},
+        std::pair{"UNTIL", TokenType::Until},
+    };
+
+    for (const auto &[keyword, token_type] : expected) {
+        auto lexer = Lexer(keyword);
+        const auto token = lexer.next_token();
+        REQUIRE(token.has_value());
+        REQUIRE(token->has_value());
+        CHECK(token->value().token_type == token_type);
+        CHECK(token->value().lexeme == keyword);
+    }
+
+    for (const auto *word : {"WRITS", "WHILST", "ENDWHIL", "PROGRAMS", "I", "TT", "ND", "A"}) {
+        auto lexer = Lexer(word);
+        const auto token = lexer.next_token();
+        REQUIRE(token.has_value());
+        CHECK(!token->has_value());
+    }
+}
+
+TEST_CASE("Lexer - lexemes are views of the source") {
+    const auto source = std::string{"PROGRAM IS abc IN abc := 12; END"};
+    auto lexer = Lexer(source);
+
+    for (auto &token : lexer) {
+        REQUIRE(token.has_value());
+        CHECK(token->lexeme.data() >= source.data());
+        CHECK(token->lexeme.data() + token->lexeme.size() <= source.data() + source.size());
+        CHECK(token->to_token().lexeme == token->lexeme);
+    }
+}
+
 TEST_CASE("Lexer - comments") {
     const auto comment = "   # a + b; <= This is a comment\n";
     auto lexer = Lexer(comment);
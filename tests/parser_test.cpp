@@ -1,6 +1,7 @@
 #include "ast.hpp"
 #include <format>
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "lexer.hpp"
 #include "parser.hpp"
 #include "tests_shared.hpp"
 #include "token.hpp"
@@ -305,3 +306,57 @@ TEST_CASE("Parser - parse expression") {
         CHECK(bin.op.token_type == operator_to_tokentype(op));
     }
 }
+
+TEST_CASE("Parser - tokens pulled from the lexer") {
+    SUBCASE("Lookahead") {
+        const auto source = std::string{"n, m"};
+        auto lexer = Lexer(source);
+        auto parser = parser::Parser(lexer);
+
+        CHECK(parser.peek(1)->token_type == TokenType::Comma);
+        CHECK(parser.peek()->lexeme == "n");
+        CHECK(parser.chop()->lexeme == "n");
+        CHECK(parser.match_and_chop(TokenType::Comma).has_value());
+        CHECK(parser.peek()->lexeme == "m");
+        CHECK(!parser.peek(1).has_value());
+        CHECK(parser.chop()->lexeme == "m");
+        CHECK(!parser.chop().has_value());
+    }
+
+    SUBCASE("Program") {
+        const auto source = std::string{R"(
+            PROCEDURE p(T t, n) IS
+            IN
+              t[n] := n + 1;
+            END
+            PROGRAM IS
+              a[4], b
+            IN
+              READ b;
+              p(a, b);
+              WRITE a[b];
+            END
+        )"};
+        auto lexer = Lexer(source);
+        auto parser = parser::Parser(lexer);
+
+        const auto program = parser.parse_program();
+
+        REQUIRE(program.has_value());
+        CHECK(parser.get_errors().empty());
+        CHECK(program->procedures.size() == 1);
+        CHECK(program->main.commands.size() == 3);
+        CHECK(std::holds_alternative<ast::Call>(program->main.commands[1]));
+    }
+
+    SUBCASE("Errors of the lexer") {
+        const auto source = std::string{"PROGRAM IS a IN READ a$; END"};
+        auto lexer = Lexer(source);
+        auto parser = parser::Parser(lexer);
+
+        parser.parse_program();
+
+        REQUIRE(!parser.get_errors().empty());
+        CHECK(parser.get_errors().front().source == "Lexer");
+    }
+}
@@ -0,0 +1,173 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "lexer.hpp"
+#include "mw.hpp"
+#include "parser.hpp"
+#include "pass-manager.hpp"
+#include "tests_shared.hpp"
+#include <memory>
+
+struct Compiled {
+    std::vector<instruction::Line> lines;
+    std::vector<passes::PassStats> stats;
+};
+
+auto compile(const std::string &source, passes::PassManager pass_manager) -> Compiled {
+    auto lexer = Lexer(source);
+    auto parser = parser::Parser(lexer);
+    auto program = parser.parse_program();
+
+    REQUIRE(program.has_value());
+    REQUIRE(parser.get_errors().empty());
+
+    pass_manager.run_ast_passes(*program, nullptr);
+
+    auto emitter = emitter::Emitter(std::move(*program), nullptr, 1, pass_manager.get_emitter_features());
+    emitter.emit_program();
+    pass_manager.run_line_passes(emitter);
+
+    REQUIRE(emitter.get_errors().empty());
+
+    return {emitter.get_lines(), pass_manager.get_stats()};
+}
+
+auto run(const std::vector<instruction::Line> &lines, std::deque<uint64_t> inputs)
+    -> std::pair<std::vector<uint64_t>, long long> {
+    auto read_handler = std::make_unique<ReadHandlerDeque>(std::move(inputs));
+    auto write_handler = std::make_unique<WriteHandlerVector<uint64_t>>();
+
+    const auto program_state = run_machine(lines, read_handler.get(), write_handler.get());
+    CHECK(!program_state.error);
+
+    return {write_handler->get_outputs(), program_state.t};
+}
+
+TEST_CASE("Pass manager - optimization levels and toggles") {
+    using enum passes::OptimizationLevel;
+
+    for (const auto &pass : passes::PassManager::get_passes()) {
+        CHECK(!passes::PassManager(O0).is_enabled(pass.name));
+        CHECK(passes::PassManager(O3).is_enabled(pass.name));
+    }
+
+    CHECK(passes::parse_optimization_level("2") == O2);
+    CHECK(!passes::parse_optimization_level("4"));
+
+    auto pass_manager = passes::PassManager(O1);
+    CHECK(!pass_manager.is_enabled("inline-procedures"));
+
+    // Enabling a pass enables what it requires, disabling a requirement disables the passes depending on it
+    CHECK(pass_manager.enable("inline-procedures"));
+    CHECK(pass_manager.is_enabled("calculate-procedure-call-counts"));
+    CHECK(pass_manager.disable("calculate-procedure-call-counts"));
+    CHECK(!pass_manager.is_enabled("inline-procedures"));
+
+    CHECK(!pass_manager.enable("no-such-pass"));
+}
+
+TEST_CASE("Pass manager - every level compiles the same program") {
+    using enum passes::OptimizationLevel;
+
+    const auto source = read_file(std::string(TESTS_DIR) + "/example4.imp");
+    REQUIRE(source.has_value());
+
+    auto costs = std::vector<long long>{};
+    for (const auto level : {O0, O1, O2, O3}) {
+        const auto compiled = compile(*source, passes::PassManager(level));
+        const auto [outputs, cost] = run(compiled.lines, {20, 9});
+
+        CHECK(outputs == std::vector<uint64_t>{167960});
+        // The passes of the emitter run as part of it and have no stats
+        const auto enabled = std::ranges::count_if(passes::PassManager::get_passes(), [&](const auto &pass) {
+            return pass.level <= level && !pass.emitter_feature;
+        });
+        CHECK(compiled.stats.size() == static_cast<size_t>(enabled));
+        costs.push_back(cost);
+    }
+
+    CHECK(costs.back() < costs.front());
+
+    const auto stats = compile(*source, passes::PassManager(O1)).stats;
+    const auto peephole = std::ranges::find(stats, "apply-peephole-rules", &passes::PassStats::name);
+    REQUIRE(peephole != stats.end());
+    CHECK(peephole->instructions_removed > 0);
+    CHECK(peephole->cost_saved > 0);
+}
+
+TEST_CASE("Pass manager - loops are unrolled only by the unrolling passes") {
+    using enum passes::OptimizationLevel;
+
+    const auto source = std::string{R"(
+        PROGRAM IS
+          x, i
+        IN
+          READ x;
+          i := 0;
+          WHILE i < 4 DO
+            WRITE x;
+            x := x + i;
+            i := i + 1;
+          ENDWHILE
+        END
+    )"};
+    auto count_jumps = [](const std::vector<instruction::Line> &lines) {
+        return std::ranges::count_if(lines, [](const auto &line) {
+            return std::holds_alternative<instruction::Jump>(line.instruction) ||
+                   std::holds_alternative<instruction::Jpos>(line.instruction) ||
+                   std::holds_alternative<instruction::Jzero>(line.instruction);
+        });
+    };
+
+    auto without_full_unrolling = passes::PassManager(O3);
+    without_full_unrolling.disable("unroll-loops-fully");
+    for (auto pass_manager : {passes::PassManager(O1), passes::PassManager(O2), without_full_unrolling}) {
+        const auto lines = compile(source, pass_manager).lines;
+        CHECK(run(lines, {5}).first == std::vector<uint64_t>{5, 5, 6, 8});
+        CHECK(count_jumps(lines) > 0);
+    }
+
+    const auto lines = compile(source, passes::PassManager(O3)).lines;
+    CHECK(run(lines, {5}).first == std::vector<uint64_t>{5, 5, 6, 8});
+    CHECK(count_jumps(lines) == 0);
+}
+
+TEST_CASE("Pass manager - the emitter optimizes only what its passes enable") {
+    using enum passes::OptimizationLevel;
+
+    const auto features = passes::PassManager(O0).get_emitter_features();
+    CHECK(!features.specialize_calls);
+    CHECK(!features.pass_arguments_in_registers);
+    CHECK(!features.overlap_frames);
+    CHECK(!features.layout_hot_variables);
+    CHECK(!features.rotate_loops);
+    CHECK(!features.simplify_expressions);
+    CHECK(!features.reuse_mar);
+
+    const auto examples = std::vector<std::tuple<std::string, std::deque<uint64_t>, std::vector<uint64_t>>>{
+        {"example2.imp", {0, 1}, {46368, 28657}},
+        {"example8.imp",
+         {},
+         {5, 2, 10, 4, 20, 8, 17, 16, 11, 9, 22, 18, 21, 13, 19, 3, 15, 6, 7, 12, 14, 1, 0, 1234567890, 0, 1, 2, 3, 4,
+          5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22}},
+        {"example9.imp", {20, 9}, {167960}},
+        {"gcd.imp", {12, 18, 96, 36}, {6}},
+    };
+    for (const auto &[filename, inputs, expected] : examples) {
+        const auto source = read_file(std::string(TESTS_DIR) + "/" + filename);
+        REQUIRE(source.has_value());
+
+        CHECK(run(compile(*source, passes::PassManager(O0)).lines, inputs).first == expected);
+        for (const auto &pass : passes::PassManager::get_passes()) {
+            if (!pass.emitter_feature) {
+                continue;
+            }
+            // Only this one on top of -O0, and only this one off at -O3
+            auto only = passes::PassManager(O0);
+            only.enable(pass.name);
+            auto all_but = passes::PassManager(O3);
+            all_but.disable(pass.name);
+
+            CHECK(run(compile(*source, only).lines, inputs).first == expected);
+            CHECK(run(compile(*source, all_but).lines, inputs).first == expected);
+        }
+    }
+}